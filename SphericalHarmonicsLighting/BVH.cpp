@@ -1,5 +1,12 @@
 #include "BVH.h"
 
+#include <algorithm>
+
+#include "VectorMath.h"
+
+#include "Util.h"
+
+// Leaf size used by the MEAN splitter
 #define TERMINATION_SIZE 2
 
 BVHNode::BVHNode() {
@@ -24,80 +31,17 @@ BVHNode::~BVHNode() {
 	}
 }
 
-bool BVHNode::intersects(const Ray& ray) const {
-	if (ray.intersects(aabb)) {
-		if (left) { // If the left node pointer is non-null, we are not in a leaf node and need to recurse
-			assert(triangles == NULL);
-
-			return left->intersects(ray) || right->intersects(ray);
-		} else { // The current node is a leaf
-			assert(left  == NULL);
-			assert(right == NULL);
-
-			for (int i = 0; i < triangle_count; i++) {
-				if (ray.intersects(*triangles[i])) {
-					return true;
-				}
-			}
-		}
-	}
-
-	return false;
-}
-
-float BVHNode::trace(const Ray & ray, int indices[3], float& u, float& v) const {
-	float min_distance = INFINITY;
-
-	if (ray.intersects(aabb)) {
-		if (left) { // If the left node pointer is non-null, we are not in a leaf node and need to recurse
-			assert(triangles == NULL);
-
-			int indices_left[3];
-			int indices_right[3];
-			float u_left, u_right;
-			float v_left, v_right;
+// Returns true if a node at the given depth has to be split at the median to keep its subtree within BVH_MAX_DEPTH.
+// Median splits halve the number of Triangles, so a subtree of n Triangles needs at most ceil(log2(n)) more levels
+static bool requires_median_split(int depth, int triangle_count) {
+	int levels = 0;
+	while ((1ll << levels) < triangle_count) levels++;
 
-			float left_distance  = left->trace (ray, indices_left,  u_left,  v_left);
-			float right_distance = right->trace(ray, indices_right, u_right, v_right);
-
-			if (left_distance < right_distance) {
-				memcpy(indices, indices_left, 3 * sizeof(int));
-				u = u_left;
-				v = v_left;
-
-				return left_distance;
-			} else {
-				memcpy(indices, indices_right, 3 * sizeof(int));
-				u = u_right;
-				v = v_right;
-
-				return right_distance;
-			}
-		} else { // The current node is a leaf
-			assert(left  == NULL);
-			assert(right == NULL);
-
-			int   _indices[3];
-			float _u;
-			float _v;
-
-			for (int i = 0; i < triangle_count; i++) {
-				float distance = ray.trace(*triangles[i], _indices, _u, _v);
-				if (distance < min_distance) {
-					min_distance = distance;
-
-					memcpy(indices, _indices, 3 * sizeof(int));
-					u = _u;
-					v = _v;
-				}
-			}
-		}
-	}
-
-	return min_distance;
+	return depth + levels >= BVH_MAX_DEPTH;
 }
 
-BVHNode const * BVHNode::build(int triangle_count, Triangle const * const triangles[]) {
+// Splits the longest axis at the mean of the Triangle centers
+static BVHNode const * build_mean(int triangle_count, Triangle const * const triangles[], int depth) {
 	BVHNode * node = new BVHNode();
 	node->triangle_count = triangle_count;
 
@@ -115,6 +59,10 @@ BVHNode const * BVHNode::build(int triangle_count, Triangle const * const triang
 
 	// Check termination condition
 	if (triangle_count <= TERMINATION_SIZE) {
+		for (int i = 0; i < triangle_count; i++) {
+			node->aabb.expand(triangles[i]->calc_aabb());
+		}
+
 		node->triangles = new Triangle const *[triangle_count];
 		memcpy(node->triangles, triangles, triangle_count * sizeof(Triangle *));
 
@@ -195,14 +143,604 @@ BVHNode const * BVHNode::build(int triangle_count, Triangle const * const triang
 
 	// Sanity check, at the end the left and right buffers should meet exactly
 	assert(triangle_index_left == triangle_index_right + 1);
+
+	// If all Triangle centers ended up on the same side (for example when they are all equal along the longest axis)
+	// the split would not make any progress and recurse forever, in that case split the Triangles in two equal halves
+	if (triangle_index_left == 0 || triangle_index_left == triangle_count) {
+		triangle_index_left = triangle_count / 2;
+	}
+
+	// Deep in the tree the mean is replaced by the median, which keeps the depth of the remaining subtree logarithmic
+	if (requires_median_split(depth, triangle_count)) {
+		triangle_index_left = triangle_count / 2;
+
+		std::nth_element(triangle_buffer, triangle_buffer + triangle_index_left, triangle_buffer + triangle_count, [longest_axis](const Triangle * a, const Triangle * b) {
+			return a->vertices[0][longest_axis] + a->vertices[1][longest_axis] + a->vertices[2][longest_axis]
+				 < b->vertices[0][longest_axis] + b->vertices[1][longest_axis] + b->vertices[2][longest_axis];
+		});
+	}
 	
 	delete[] triangle_centers;
 	
 	// Recurse
-	node->left  = build(triangle_index_left,                  triangle_buffer);
-	node->right = build(triangle_count - triangle_index_left, triangle_buffer + triangle_index_left);
+	node->left  = build_mean(triangle_index_left,                  triangle_buffer,                       depth + 1);
+	node->right = build_mean(triangle_count - triangle_index_left, triangle_buffer + triangle_index_left, depth + 1);
 	
 	delete[] triangle_buffer;
 
 	return node;
 }
+
+// Triangle with its AABB and center cached, used by the SAH splitter
+struct BuildTriangle {
+	Triangle const * triangle;
+
+	AABB      aabb;
+	glm::vec3 center;
+};
+
+static BVHNode * build_sah_leaf(BVHNode * node, int triangle_count, const BuildTriangle triangles[]) {
+	node->triangles = new Triangle const *[triangle_count];
+
+	for (int i = 0; i < triangle_count; i++) {
+		node->triangles[i] = triangles[i].triangle;
+	}
+
+	return node;
+}
+
+// Chooses the split with the lowest cost according to the Surface Area Heuristic.
+// Instead of evaluating every possible split position, Triangle centers are binned along every axis
+// and only the boundaries between bins are considered as split candidates.
+// The triangles array is partitioned in place
+static BVHNode const * build_sah(int triangle_count, BuildTriangle triangles[], const BVHBuildSettings& settings, int depth) {
+	BVHNode * node = new BVHNode();
+	node->triangle_count = triangle_count;
+
+	if (triangle_count == 0) return node;
+
+	// Calculate the bounds of the node, as well as the bounds of the Triangle centers
+	AABB center_bounds;
+	center_bounds.min = glm::vec3(+INFINITY);
+	center_bounds.max = glm::vec3(-INFINITY);
+
+	for (int i = 0; i < triangle_count; i++) {
+		node->aabb.expand(triangles[i].aabb);
+
+		center_bounds.min = min_componentwise(center_bounds.min, triangles[i].center);
+		center_bounds.max = max_componentwise(center_bounds.max, triangles[i].center);
+	}
+
+	if (triangle_count == 1) return build_sah_leaf(node, triangle_count, triangles);
+
+	// Deep in the tree the SAH is no longer evaluated, nodes become a leaf if they are small enough or are split at the median of the longest axis otherwise
+	if (requires_median_split(depth, triangle_count)) {
+		if (triangle_count <= settings.sah_max_leaf_size) return build_sah_leaf(node, triangle_count, triangles);
+
+		glm::vec3 extent = center_bounds.max - center_bounds.min;
+
+		int axis = 0;
+		if (extent.y > extent[axis]) axis = 1;
+		if (extent.z > extent[axis]) axis = 2;
+
+		int triangle_count_left = triangle_count / 2;
+
+		std::nth_element(triangles, triangles + triangle_count_left, triangles + triangle_count, [axis](const BuildTriangle& a, const BuildTriangle& b) {
+			return a.center[axis] < b.center[axis];
+		});
+
+		node->left  = build_sah(triangle_count_left,                  triangles,                       settings, depth + 1);
+		node->right = build_sah(triangle_count - triangle_count_left, triangles + triangle_count_left, settings, depth + 1);
+
+		return node;
+	}
+
+	struct Bin {
+		AABB aabb;
+		int  triangle_count;
+	};
+
+	const int bin_count = settings.sah_bin_count;
+	assert(bin_count >= 2);
+
+	Bin   * bins       = new Bin  [bin_count];
+	float * cost_right = new float[bin_count];
+
+	float inv_node_area = 1.0f / node->aabb.surface_area();
+
+	int   best_axis  = INVALID;
+	int   best_split = INVALID; // Bins [0, best_split) go left, bins [best_split, bin_count) go right
+	float best_cost  = INFINITY;
+
+	for (int axis = 0; axis < 3; axis++) {
+		float extent = center_bounds.max[axis] - center_bounds.min[axis];
+
+		// All Triangle centers are equal along this axis, no split possible
+		if (extent <= 0.0f) continue;
+
+		float bin_scale = float(bin_count) / extent;
+
+		for (int b = 0; b < bin_count; b++) {
+			bins[b].aabb.min = glm::vec3(+INFINITY);
+			bins[b].aabb.max = glm::vec3(-INFINITY);
+			bins[b].triangle_count = 0;
+		}
+
+		for (int i = 0; i < triangle_count; i++) {
+			int b = std::min(int((triangles[i].center[axis] - center_bounds.min[axis]) * bin_scale), bin_count - 1);
+
+			bins[b].aabb.expand(triangles[i].aabb);
+			bins[b].triangle_count++;
+		}
+
+		// Sweep from right to left to obtain the cost of the right side of every split candidate
+		AABB aabb_right = bins[bin_count - 1].aabb;
+		int  count_right = 0;
+
+		for (int b = bin_count - 1; b > 0; b--) {
+			aabb_right.expand(bins[b].aabb);
+			count_right += bins[b].triangle_count;
+
+			cost_right[b] = count_right > 0 ? aabb_right.surface_area() * float(count_right) : 0.0f;
+		}
+
+		// Sweep from left to right and evaluate the full cost of every split candidate
+		AABB aabb_left = bins[0].aabb;
+		int  count_left = 0;
+
+		for (int b = 1; b < bin_count; b++) {
+			aabb_left.expand(bins[b - 1].aabb);
+			count_left += bins[b - 1].triangle_count;
+
+			// Splits that leave one of the sides empty do not make progress
+			if (count_left == 0 || count_left == triangle_count) continue;
+
+			float cost = settings.sah_traversal_cost + settings.sah_intersection_cost * inv_node_area * (
+				aabb_left.surface_area() * float(count_left) + cost_right[b]
+			);
+
+			if (cost < best_cost) {
+				best_cost  = cost;
+				best_axis  = axis;
+				best_split = b;
+			}
+		}
+	}
+
+	delete[] bins;
+	delete[] cost_right;
+
+	float leaf_cost = settings.sah_intersection_cost * float(triangle_count);
+
+	// Create a leaf if that is cheaper than the best split
+	if (triangle_count <= settings.sah_max_leaf_size && leaf_cost <= best_cost) {
+		return build_sah_leaf(node, triangle_count, triangles);
+	}
+
+	int triangle_count_left;
+
+	if (best_axis == INVALID) {
+		// All Triangle centers coincide and the node is too large to become a leaf, split in two equal halves
+		triangle_count_left = triangle_count / 2;
+	} else {
+		float extent    = center_bounds.max[best_axis] - center_bounds.min[best_axis];
+		float bin_scale = float(bin_count) / extent;
+
+		BuildTriangle * middle = std::partition(triangles, triangles + triangle_count, [&](const BuildTriangle& triangle) {
+			int b = std::min(int((triangle.center[best_axis] - center_bounds.min[best_axis]) * bin_scale), bin_count - 1);
+
+			return b < best_split;
+		});
+
+		triangle_count_left = int(middle - triangles);
+	}
+
+	assert(triangle_count_left > 0 && triangle_count_left < triangle_count);
+
+	node->left  = build_sah(triangle_count_left,                  triangles,                       settings, depth + 1);
+	node->right = build_sah(triangle_count - triangle_count_left, triangles + triangle_count_left, settings, depth + 1);
+
+	return node;
+}
+
+BVHNode const * BVHNode::build(int triangle_count, Triangle const * const triangles[], const BVHBuildSettings& settings) {
+	switch (settings.splitter) {
+		case BVHBuildSettings::Splitter::MEAN: {
+			return build_mean(triangle_count, triangles, 0);
+		}
+
+		case BVHBuildSettings::Splitter::SAH: {
+			BuildTriangle * build_triangles = new BuildTriangle[triangle_count];
+
+			for (int i = 0; i < triangle_count; i++) {
+				build_triangles[i].triangle = triangles[i];
+				build_triangles[i].aabb     = triangles[i]->calc_aabb();
+				build_triangles[i].center   = (triangles[i]->vertices[0] + triangles[i]->vertices[1] + triangles[i]->vertices[2]) * 0.3333333333333333333333f;
+			}
+
+			BVHNode const * root = build_sah(triangle_count, build_triangles, settings, 0);
+
+			delete[] build_triangles;
+
+			return root;
+		}
+
+		default: abort();
+	}
+}
+
+// Counts the number of nodes in the tree rooted at the given node
+static int count_nodes(const BVHNode * node) {
+	if (node->left) {
+		return 1 + count_nodes(node->left) + count_nodes(node->right);
+	}
+
+	return 1;
+}
+
+// Recursively copies the tree into the flat arrays in depth-first order, returns the index of the flattened node
+static int flatten_node(const BVHNode * node, FlatBVH& bvh, int& node_index, int& triangle_index) {
+	int index = node_index++;
+	FlatBVHNode& flat_node = bvh.nodes[index];
+
+	if (node->left) {
+		flat_node.aabb           = node->aabb;
+		flat_node.triangle_count = 0;
+
+		// The left child is placed directly after its parent, so only the index of the right child has to be stored
+		flatten_node(node->left, bvh, node_index, triangle_index);
+		flat_node.right_or_first = flatten_node(node->right, bvh, node_index, triangle_index);
+	} else {
+		// Only the root is allowed to be an empty leaf, otherwise it would be mistaken for an interior node
+		assert(node->triangle_count > 0 || index == 0);
+
+		flat_node.right_or_first = triangle_index;
+		flat_node.triangle_count = node->triangle_count;
+
+		// Small leaves are not assigned an AABB by BVHNode::build, so calculate it here
+		flat_node.aabb.min = glm::vec3(+INFINITY);
+		flat_node.aabb.max = glm::vec3(-INFINITY);
+
+		for (int i = 0; i < node->triangle_count; i++) {
+			bvh.triangles[triangle_index++] = *node->triangles[i];
+
+			flat_node.aabb.expand(node->triangles[i]->calc_aabb());
+		}
+	}
+
+	return index;
+}
+
+FlatBVH FlatBVH::flatten(const BVHNode * root) {
+	FlatBVH bvh;
+	bvh.node_count     = count_nodes(root);
+	bvh.nodes          = new FlatBVHNode[bvh.node_count];
+	bvh.triangle_count = root->triangle_count;
+	bvh.triangles      = new Triangle[bvh.triangle_count];
+
+	int node_index     = 0;
+	int triangle_index = 0;
+	flatten_node(root, bvh, node_index, triangle_index);
+
+	// Sanity check, every node and every Triangle should have been visited exactly once
+	assert(node_index     == bvh.node_count);
+	assert(triangle_index == bvh.triangle_count);
+
+	bvh.triangles_soa.init(bvh.triangle_count, bvh.triangles);
+
+	return bvh;
+}
+
+void FlatBVH::free() {
+	delete[] nodes;
+	delete[] triangles;
+
+	triangles_soa.free();
+}
+
+bool FlatBVH::intersects(const Ray& _ray) const {
+	// An empty Mesh results in a single leaf without Triangles, which cannot be hit
+	if (triangle_count == 0) return false;
+
+	const TraversalRay ray(_ray);
+
+	if (ray.trace(nodes[0].aabb) == INFINITY) return false;
+
+	int stack[BVH_STACK_SIZE];
+	int stack_size = 1;
+	stack[0] = 0;
+
+	while (stack_size > 0) {
+		int node_index = stack[--stack_size];
+		const FlatBVHNode& node = nodes[node_index];
+
+		if (node.is_leaf()) {
+			if (triangles_soa.intersects(ray, node.right_or_first, node.triangle_count)) {
+				return true;
+			}
+		} else {
+			int child_near = node_index + 1;
+			int child_far  = node.right_or_first;
+
+			float distance_near = ray.trace(nodes[child_near].aabb);
+			float distance_far  = ray.trace(nodes[child_far ].aabb);
+
+			// Visit the closest child first, occluders near the origin of the Ray are more likely to be found there
+			if (distance_far < distance_near) {
+				std::swap(child_near,    child_far);
+				std::swap(distance_near, distance_far);
+			}
+
+			assert(stack_size + 2 <= BVH_STACK_SIZE);
+
+			if (distance_far  != INFINITY) stack[stack_size++] = child_far;
+			if (distance_near != INFINITY) stack[stack_size++] = child_near;
+		}
+	}
+
+	return false;
+}
+
+void FlatBVH::intersects(const RayPacket& packet, RayPacketMask& hits) const {
+	if (triangle_count == 0) return;
+
+	// Rays that have not hit anything yet
+	RayPacketMask active;
+	for (int i = 0; i < RAY_PACKET_MASK_SIZE; i++) {
+		active.bits[i] = ~hits.bits[i];
+	}
+
+	for (int i = packet.ray_count; i < RAY_PACKET_MAX_SIZE; i++) {
+		active.clear(i);
+	}
+
+	// Every entry on the stack stores the mask of Rays that hit the AABB of its node
+	struct StackEntry {
+		int           node_index;
+		RayPacketMask mask;
+	} stack[BVH_STACK_SIZE];
+	int stack_size = 1;
+
+	stack[0].node_index = 0;
+	if (!packet.intersects(nodes[0].aabb, active, stack[0].mask)) return;
+
+	while (stack_size > 0) {
+		const StackEntry& entry = stack[--stack_size];
+
+		int node_index = entry.node_index;
+
+		// Rays that were found to hit a Triangle in another part of the tree no longer need to be traced
+		RayPacketMask mask;
+		bool any_active = false;
+
+		for (int i = 0; i < RAY_PACKET_MASK_SIZE; i++) {
+			mask.bits[i] = entry.mask.bits[i] & active.bits[i];
+			any_active |= mask.bits[i] != 0;
+		}
+
+		if (!any_active) continue;
+
+		const FlatBVHNode& node = nodes[node_index];
+
+		if (node.is_leaf()) {
+			for (int i = 0; i < packet.ray_count; i++) {
+				if (mask.get(i) && triangles_soa.intersects(packet.rays[i], node.right_or_first, node.triangle_count)) {
+					hits  .set  (i);
+					active.clear(i);
+				}
+			}
+		} else {
+			int child_near = node_index + 1;
+			int child_far  = node.right_or_first;
+
+			// Visit the child whose center is closest to the shared origin first. The order does not influence the result,
+			// but Rays that are occluded by the near child do not have to be tested against the far child
+			glm::vec3 to_near = 0.5f * (nodes[child_near].aabb.min + nodes[child_near].aabb.max) - packet.origin;
+			glm::vec3 to_far  = 0.5f * (nodes[child_far ].aabb.min + nodes[child_far ].aabb.max) - packet.origin;
+
+			if (glm::dot(to_far, to_far) < glm::dot(to_near, to_near)) {
+				std::swap(child_near, child_far);
+			}
+
+			assert(stack_size + 2 <= BVH_STACK_SIZE);
+
+			if (packet.intersects(nodes[child_far].aabb, mask, stack[stack_size].mask)) {
+				stack[stack_size].node_index = child_far;
+				stack_size++;
+			}
+
+			if (packet.intersects(nodes[child_near].aabb, mask, stack[stack_size].mask)) {
+				stack[stack_size].node_index = child_near;
+				stack_size++;
+			}
+		}
+	}
+}
+
+float FlatBVH::trace(const Ray& _ray, int& triangle_index, float& u, float& v, float max_distance) const {
+	if (triangle_count == 0) return INFINITY;
+
+	const TraversalRay ray(_ray);
+
+	float min_distance = max_distance;
+	bool  hit          = false;
+
+	// Every entry on the stack also stores the distance at which the Ray enters the node,
+	// so that nodes can be skipped if a closer hit was found after they were pushed
+	struct StackEntry {
+		int   node_index;
+		float distance;
+	} stack[BVH_STACK_SIZE];
+	int stack_size = 1;
+
+	stack[0].node_index = 0;
+	stack[0].distance   = ray.trace(nodes[0].aabb, min_distance);
+
+	if (stack[0].distance == INFINITY) return INFINITY;
+
+	while (stack_size > 0) {
+		const StackEntry& entry = stack[--stack_size];
+
+		if (entry.distance > min_distance) continue;
+
+		int node_index = entry.node_index;
+		const FlatBVHNode& node = nodes[node_index];
+
+		if (node.is_leaf()) {
+			int leaf_triangle_index = triangles_soa.trace(ray, node.right_or_first, node.triangle_count, min_distance, u, v);
+			if (leaf_triangle_index != INVALID) {
+				hit = true;
+
+				triangle_index = leaf_triangle_index;
+			}
+		} else {
+			int child_near = node_index + 1;
+			int child_far  = node.right_or_first;
+
+			// Children that start beyond the closest hit found so far are culled
+			float distance_near = ray.trace(nodes[child_near].aabb, min_distance);
+			float distance_far  = ray.trace(nodes[child_far ].aabb, min_distance);
+
+			// Push the far child first so that the near child is popped first,
+			// this makes it likely that a close hit is found early, which in turn culls more nodes
+			if (distance_far < distance_near) {
+				std::swap(child_near,    child_far);
+				std::swap(distance_near, distance_far);
+			}
+
+			assert(stack_size + 2 <= BVH_STACK_SIZE);
+
+			if (distance_far != INFINITY) {
+				stack[stack_size].node_index = child_far;
+				stack[stack_size].distance   = distance_far;
+				stack_size++;
+			}
+
+			if (distance_near != INFINITY) {
+				stack[stack_size].node_index = child_near;
+				stack[stack_size].distance   = distance_near;
+				stack_size++;
+			}
+		}
+	}
+
+	return hit ? min_distance : INFINITY;
+}
+
+void FlatBVH::trace(const RayPacket& packet, const RayPacketMask& active, RayPacketHits& hits) const {
+	if (triangle_count == 0) return;
+
+	// Every entry on the stack stores the mask of Rays that hit the AABB of its node
+	struct StackEntry {
+		int           node_index;
+		RayPacketMask mask;
+	} stack[BVH_STACK_SIZE];
+	int stack_size = 1;
+
+	stack[0].node_index = 0;
+	if (!packet.intersects(nodes[0].aabb, active, hits.distances, stack[0].mask)) return;
+
+	while (stack_size > 0) {
+		const StackEntry& entry = stack[--stack_size];
+
+		int           node_index = entry.node_index;
+		RayPacketMask mask       = entry.mask;
+
+		const FlatBVHNode& node = nodes[node_index];
+
+		if (node.is_leaf()) {
+			for (int i = 0; i < packet.ray_count; i++) {
+				if (!mask.get(i)) continue;
+
+				int triangle_index = triangles_soa.trace(packet.rays[i], node.right_or_first, node.triangle_count, hits.distances[i], hits.u[i], hits.v[i]);
+				if (triangle_index != INVALID) {
+					hits.triangle_indices[i] = triangle_index;
+				}
+			}
+		} else {
+			int child_near = node_index + 1;
+			int child_far  = node.right_or_first;
+
+			// Visit the child whose center is closest to the shared origin first,
+			// hits found there shorten the Rays so that they are more likely to be culled by the far child
+			glm::vec3 to_near = 0.5f * (nodes[child_near].aabb.min + nodes[child_near].aabb.max) - packet.origin;
+			glm::vec3 to_far  = 0.5f * (nodes[child_far ].aabb.min + nodes[child_far ].aabb.max) - packet.origin;
+
+			if (glm::dot(to_far, to_far) < glm::dot(to_near, to_near)) {
+				std::swap(child_near, child_far);
+			}
+
+			assert(stack_size + 2 <= BVH_STACK_SIZE);
+
+			// Children that start beyond the closest hit found so far are culled per Ray
+			if (packet.intersects(nodes[child_far].aabb, mask, hits.distances, stack[stack_size].mask)) {
+				stack[stack_size].node_index = child_far;
+				stack_size++;
+			}
+
+			if (packet.intersects(nodes[child_near].aabb, mask, hits.distances, stack[stack_size].mask)) {
+				stack[stack_size].node_index = child_near;
+				stack_size++;
+			}
+		}
+	}
+}
+
+struct BVHReport {
+	float sah_cost;
+
+	int max_depth;
+	int leaf_count;
+	int leaf_depth_sum;
+
+	int leaf_size_histogram[17]; // Last entry counts all leaves with 16 or more Triangles
+};
+
+static void report_node(const FlatBVH& bvh, int node_index, int depth, float inv_root_area, const BVHBuildSettings& settings, BVHReport& report) {
+	const FlatBVHNode& node = bvh.nodes[node_index];
+
+	float relative_area = node.aabb.surface_area() * inv_root_area;
+
+	report.max_depth = std::max(report.max_depth, depth);
+
+	if (node.is_leaf()) {
+		report.sah_cost += relative_area * settings.sah_intersection_cost * float(node.triangle_count);
+
+		report.leaf_count++;
+		report.leaf_depth_sum += depth;
+		report.leaf_size_histogram[std::min(node.triangle_count, 16)]++;
+	} else {
+		report.sah_cost += relative_area * settings.sah_traversal_cost;
+
+		report_node(bvh, node_index + 1,      depth + 1, inv_root_area, settings, report);
+		report_node(bvh, node.right_or_first, depth + 1, inv_root_area, settings, report);
+	}
+}
+
+void FlatBVH::report(const char * name, const BVHBuildSettings& settings) const {
+	if (triangle_count == 0) return;
+
+	BVHReport report = { };
+	report_node(*this, 0, 0, 1.0f / nodes[0].aabb.surface_area(), settings, report);
+
+	const char * splitter_name = settings.splitter == BVHBuildSettings::Splitter::SAH ? "SAH" : "MEAN";
+
+	// The traversal stacks are sized for BVH_MAX_DEPTH, which the builders never exceed
+	assert(report.max_depth <= BVH_MAX_DEPTH);
+
+	printf("BVH %s (%s): %i nodes, %i leaves, SAH cost: %.2f, max depth: %i (limit %i), average leaf depth: %.2f\n",
+		name, splitter_name,
+		node_count, report.leaf_count,
+		report.sah_cost,
+		report.max_depth, BVH_MAX_DEPTH,
+		float(report.leaf_depth_sum) / float(report.leaf_count)
+	);
+
+	printf("Leaf sizes:");
+	for (int i = 1; i <= 16; i++) {
+		if (report.leaf_size_histogram[i] > 0) {
+			printf(i < 16 ? " %i: %i" : " %i+: %i", i, report.leaf_size_histogram[i]);
+		}
+	}
+	printf("\n");
+}
@@ -2,9 +2,40 @@
 #include <GL/glew.h>
 
 #include "Ray.h"
+#include "RayPacket.h"
+#include "TriangleSoA.h"
 
 #include "Types.h"
 
+// Size of the explicit stack used during traversal, this limits the depth of the tree
+#define BVH_STACK_SIZE 64
+// Deepest level at which the builders place a node. A traversal stack holds at most one pending sibling per level plus the children of the current node,
+// so this keeps the stack within BVH_STACK_SIZE. Nodes that would otherwise end up deeper are split at the median, see BVHNode::build
+#define BVH_MAX_DEPTH (BVH_STACK_SIZE - 2)
+
+struct BVHBuildSettings {
+	enum class Splitter {
+		MEAN, // Splits the longest axis at the mean of the Triangle centers
+		SAH   // Chooses the split with the lowest cost according to the binned Surface Area Heuristic
+	} splitter = Splitter::SAH;
+
+	// Number of bins per axis that are evaluated as split candidates by the SAH splitter
+	int sah_bin_count = 16;
+
+	// Relative costs used by the SAH, the cost of a leaf is its Triangle count times the intersection cost
+	float sah_traversal_cost    = 1.0f;
+	float sah_intersection_cost = 1.0f;
+
+	// Nodes with more Triangles than this are always split by the SAH splitter, even if the SAH prefers a leaf
+	int sah_max_leaf_size = 16;
+
+	// Branching factor of the tree used for raytracing. 2 uses the binary FlatBVH directly,
+	// 4 and 8 collapse it into a BVH4 or BVH8 whose child AABBs are tested using SIMD
+	int width = 2;
+};
+
+// Pointer based BVH node, only used during construction.
+// After construction the tree is converted into a FlatBVH, which is used for raytracing
 struct BVHNode {
 public:
 	AABB aabb;
@@ -18,10 +49,64 @@ public:
 	BVHNode();
 	~BVHNode();
 
-	bool  intersects(const Ray& ray) const;
-	float trace     (const Ray& ray, int indices[3], float& u, float& v) const;
+	// Builds the tree using the splitter of the settings. Nodes for which BVH_MAX_DEPTH could only be met by a balanced subtree
+	// are split at the median of their Triangle centers instead, so no leaf is ever deeper than BVH_MAX_DEPTH
+	static BVHNode const * build(int triangle_count, Triangle const * const triangles[], const BVHBuildSettings& settings);
+};
+
+// Node of a FlatBVH, 32 bytes in size so that two nodes fit in a single cache line
+struct FlatBVHNode {
+	AABB aabb;
+
+	// For interior nodes this is the index of the right child, the left child is always stored directly after its parent.
+	// For leaf nodes this is the index of the first Triangle of the leaf in the FlatBVH's Triangle array
+	int right_or_first;
+	int triangle_count; // 0 for interior nodes
+
+	inline bool is_leaf() const {
+		return triangle_count > 0;
+	}
+};
+
+static_assert(sizeof(FlatBVHNode) == 32, "FlatBVHNode should be 32 bytes");
+
+// Linearized BVH, the nodes are stored in a single array in depth-first order.
+// The Triangles are copied and reordered such that the Triangles of every leaf are contiguous in memory
+struct FlatBVH {
+public:
+	int           node_count;
+	FlatBVHNode * nodes;
+
+	int        triangle_count;
+	Triangle * triangles;
+
+	// Copy of the Triangles in SoA layout, in the same order, used by the SIMD intersection kernels in the leaves
+	TriangleSoA triangles_soa;
+
+	// Returns true if the Ray hits any Triangle, the traversal stops as soon as the first hit is found
+	bool intersects(const Ray& ray) const;
+
+	// Traces all Rays of the RayPacket through the tree together. Every node is fetched once for the whole packet,
+	// and every Ray only descends into the children whose AABB it hits. Rays that are already set in the hits mask are skipped,
+	// for all other Rays the bit in the hits mask is set to exactly the same result as intersects(packet.rays[i]) would return
+	void intersects(const RayPacket& packet, RayPacketMask& hits) const;
+
+	// Returns the distance to the closest Triangle hit by the Ray, or INFINITY if no Triangle closer than max_distance is hit.
+	// triangle_index is set to the index of the hit Triangle in the triangles array
+	float trace(const Ray& ray, int& triangle_index, float& u, float& v, float max_distance = INFINITY) const;
+
+	// Finds the closest hit of all Rays of the RayPacket that are set in the active mask, see RayPacketHits.
+	// Like the packet version of intersects every node is fetched once for the whole packet, and Rays are culled against the nodes
+	// using the closest hit they found so far. The distance of every Ray is the same as trace(packet.rays[i], ...),
+	// if multiple Triangles are hit at exactly that distance another one may be reported
+	void trace(const RayPacket& packet, const RayPacketMask& active, RayPacketHits& hits) const;
+
+	static FlatBVH flatten(const BVHNode * root);
+
+	void free();
 
-	static BVHNode const * build(int triangle_count, Triangle const * const triangles[]);
+	// Prints statistics that indicate the quality of the tree, such as its SAH cost, depth and a histogram of leaf sizes
+	void report(const char * name, const BVHBuildSettings& settings) const;
 };
 
 struct BVHDebugger {
@@ -0,0 +1,963 @@
+#include "Benchmark.h"
+
+#include <random>
+
+#include "AssetLoader.h"
+
+#include "BVH.h"
+#include "Light.h"
+#include "LightMixer.h"
+#include "LightProbe.h"
+#include "WideBVH.h"
+#include "SIMD.h"
+#include "SHRotation.h"
+#include "ThreadPool.h"
+
+#include "ScopedTimer.h"
+
+#include "Types.h"
+#include "Util.h"
+
+#define BENCHMARK_RAY_COUNT 1000000
+#define BENCHMARK_SEED      12345
+
+#define BENCHMARK_ROTATION_COUNT 100000
+#define BENCHMARK_ROTATION_BATCH 64 // Number of coefficient vectors a cached RotationMatrix is applied to
+
+#define BENCHMARK_SAMPLING_AXIS_COUNT        64
+#define BENCHMARK_SAMPLING_INTEGRATION_STEPS 65536 // Number of steps used to integrate the reference zonal coefficients
+
+#define BENCHMARK_PROBE_SIZE         256
+#define BENCHMARK_PROBE_SUPERSAMPLES 8 // Every pixel of the probe is integrated using BENCHMARK_PROBE_SUPERSAMPLES^2 points for the reference coefficients
+
+#define BENCHMARK_LIGHT_UPDATE_COUNT  100000
+#define BENCHMARK_LIGHT_SAMPLE_COUNT  65536 // Number of samples of the Monte Carlo projection the analytic Lights are compared to
+
+#define BENCHMARK_MIXER_LIGHT_COUNT 256
+#define BENCHMARK_MIXER_FRAME_COUNT 1000
+
+static const int    benchmark_model_count = 3;
+static const char * benchmark_models[benchmark_model_count] = {
+	DATA_PATH("Models/Bunny.obj"),
+	DATA_PATH("Models/HelloWorld.obj"),
+	DATA_PATH("Models/MonkeySubdivided2.obj")
+};
+
+struct BenchmarkMesh {
+	int        triangle_count;
+	Triangle * triangles;
+
+	FlatBVH bvh;
+
+	Array<Ray> rays;
+};
+
+// Loads the Mesh, builds its BVH and generates Rays the same way the bake does,
+// starting at the vertices of the Mesh and pointing into the hemisphere around the vertex normal
+static void init_benchmark_mesh(const char * file_name, BenchmarkMesh& mesh) {
+	const AssetLoader::MeshData * mesh_data = AssetLoader::load_mesh(file_name);
+
+	mesh.triangle_count = mesh_data->index_count / 3;
+	mesh.triangles      = new Triangle[mesh.triangle_count];
+
+	Triangle const ** triangle_pointers = new Triangle const *[mesh.triangle_count];
+
+	for (int i = 0; i < mesh.triangle_count; i++) {
+		for (int j = 0; j < 3; j++) {
+			mesh.triangles[i].indices [j] = mesh_data->indices[3*i + j];
+			mesh.triangles[i].vertices[j] = mesh_data->vertices[mesh.triangles[i].indices[j]].position;
+		}
+
+		glm::vec3 edge0 = mesh.triangles[i].vertices[1] - mesh.triangles[i].vertices[0];
+		glm::vec3 edge1 = mesh.triangles[i].vertices[2] - mesh.triangles[i].vertices[0];
+
+		mesh.triangles[i].plane.normal   =  glm::normalize(glm::cross(edge0, edge1));
+		mesh.triangles[i].plane.distance = -glm::dot(mesh.triangles[i].plane.normal, mesh.triangles[i].vertices[0]);
+
+		triangle_pointers[i] = &mesh.triangles[i];
+	}
+
+	BVHNode const * tree = BVHNode::build(mesh.triangle_count, triangle_pointers, BVHBuildSettings());
+	mesh.bvh = FlatBVH::flatten(tree);
+
+	delete tree;
+	delete[] triangle_pointers;
+
+	std::mt19937 gen(BENCHMARK_SEED);
+	std::uniform_int_distribution<u32>    random_vertex(0, mesh_data->vertex_count - 1);
+	std::uniform_real_distribution<float> U11(-1.0f, 1.0f);
+
+	mesh.rays.resize(BENCHMARK_RAY_COUNT);
+
+	for (int i = 0; i < BENCHMARK_RAY_COUNT; i++) {
+		const AssetLoader::Vertex& vertex = mesh_data->vertices[random_vertex(gen)];
+
+		// Rejection sample a direction on the unit sphere, then flip it into the hemisphere of the normal
+		glm::vec3 direction;
+		do {
+			direction = glm::vec3(U11(gen), U11(gen), U11(gen));
+		} while (glm::dot(direction, direction) > 1.0f || glm::dot(direction, direction) < 0.0001f);
+
+		direction = glm::normalize(direction);
+
+		if (glm::dot(direction, vertex.normal) < 0.0f) {
+			direction = -direction;
+		}
+
+		mesh.rays[i].origin    = vertex.position + vertex.normal * EPSILON;
+		mesh.rays[i].direction = direction;
+	}
+}
+
+// Closest hit traversal equivalent to FlatBVH::trace, parametrized on the type of Ray so that either
+// Ray::trace(const AABB&) or TraversalRay::trace(const AABB&) is used, while counting the number of AABB tests
+template<typename RayType>
+static float trace_counting_nodes(const FlatBVH& bvh, const RayType& ray, u128& node_count) {
+	float min_distance = INFINITY;
+
+	struct StackEntry {
+		int   node_index;
+		float distance;
+	} stack[BVH_STACK_SIZE];
+	int stack_size = 1;
+
+	node_count++;
+	stack[0].node_index = 0;
+	stack[0].distance   = ray.trace(bvh.nodes[0].aabb);
+
+	if (stack[0].distance == INFINITY) return INFINITY;
+
+	int   indices[3];
+	float u;
+	float v;
+
+	while (stack_size > 0) {
+		const StackEntry& entry = stack[--stack_size];
+
+		if (entry.distance > min_distance) continue;
+
+		const FlatBVHNode& node = bvh.nodes[entry.node_index];
+
+		if (node.is_leaf()) {
+			for (int i = node.right_or_first; i < node.right_or_first + node.triangle_count; i++) {
+				min_distance = std::min(min_distance, ray.trace(bvh.triangles[i], indices, u, v));
+			}
+		} else {
+			int child_near = entry.node_index + 1;
+			int child_far  = node.right_or_first;
+
+			node_count += 2;
+			float distance_near = ray.trace(bvh.nodes[child_near].aabb, min_distance);
+			float distance_far  = ray.trace(bvh.nodes[child_far ].aabb, min_distance);
+
+			if (distance_far < distance_near) {
+				std::swap(child_near,    child_far);
+				std::swap(distance_near, distance_far);
+			}
+
+			if (distance_far  != INFINITY) stack[stack_size++] = { child_far,  distance_far  };
+			if (distance_near != INFINITY) stack[stack_size++] = { child_near, distance_near };
+		}
+	}
+
+	return min_distance;
+}
+
+void Benchmark::bvh_traversal() {
+	printf("BVH traversal benchmark, %i rays per model\n", BENCHMARK_RAY_COUNT);
+
+	for (int m = 0; m < benchmark_model_count; m++) {
+		BenchmarkMesh mesh;
+		init_benchmark_mesh(benchmark_models[m], mesh);
+
+		char timer_name[256];
+
+		// The distances are summed so that the compiler cannot optimize the traversals away,
+		// they also serve as a sanity check that both slab tests produce the same result
+		double distance_sum_baseline  = 0.0;
+		double distance_sum_branchless = 0.0;
+
+		{
+			sprintf_s(timer_name, "%s - Ray::trace(AABB)", benchmark_models[m]);
+			ScopedTimer timer(timer_name, "nodes");
+
+			for (int i = 0; i < BENCHMARK_RAY_COUNT; i++) {
+				float distance = trace_counting_nodes(mesh.bvh, mesh.rays[i], timer.item_count);
+				if (distance != INFINITY) distance_sum_baseline += distance;
+			}
+		}
+
+		{
+			sprintf_s(timer_name, "%s - TraversalRay::trace(AABB)", benchmark_models[m]);
+			ScopedTimer timer(timer_name, "nodes");
+
+			for (int i = 0; i < BENCHMARK_RAY_COUNT; i++) {
+				// Construction of the TraversalRay is part of the measurement, since it happens once per query
+				float distance = trace_counting_nodes(mesh.bvh, TraversalRay(mesh.rays[i]), timer.item_count);
+				if (distance != INFINITY) distance_sum_branchless += distance;
+			}
+		}
+
+		printf("Sum of hit distances: %f (Ray) vs %f (TraversalRay)\n", distance_sum_baseline, distance_sum_branchless);
+
+		// Compare the leaf intersection kernels, using the full FlatBVH::trace
+		SIMD::Level supported_level = SIMD::get_level();
+
+		for (int level = int(SIMD::Level::SCALAR); level <= int(supported_level); level++) {
+			SIMD::set_level(SIMD::Level(level));
+
+			double distance_sum = 0.0;
+
+			{
+				sprintf_s(timer_name, "%s - FlatBVH::trace (%s)", benchmark_models[m], SIMD::get_level_name(SIMD::Level(level)));
+				ScopedTimer timer(timer_name, "rays");
+
+				int   triangle_index;
+				float u, v;
+
+				for (int i = 0; i < BENCHMARK_RAY_COUNT; i++) {
+					float distance = mesh.bvh.trace(mesh.rays[i], triangle_index, u, v);
+					if (distance != INFINITY) distance_sum += distance;
+				}
+
+				timer.item_count = BENCHMARK_RAY_COUNT;
+			}
+
+			printf("Sum of hit distances: %f (%s)\n", distance_sum, SIMD::get_level_name(SIMD::Level(level)));
+		}
+
+		SIMD::set_level(supported_level);
+
+		printf("\n");
+
+		delete[] mesh.triangles;
+		mesh.bvh.free();
+	}
+}
+
+// Measures the number of Rays per second for both closest hit and any hit queries on the given BVH type
+template<typename BVHType>
+static void benchmark_bvh(const char * model_name, const char * bvh_name, const BVHType& bvh, const Array<Ray>& rays) {
+	char timer_name[256];
+
+	double distance_sum = 0.0;
+	int    hit_count    = 0;
+
+	{
+		sprintf_s(timer_name, "%s - %s::trace", model_name, bvh_name);
+		ScopedTimer timer(timer_name, "rays");
+
+		int   triangle_index;
+		float u, v;
+
+		for (int i = 0; i < BENCHMARK_RAY_COUNT; i++) {
+			float distance = bvh.trace(rays[i], triangle_index, u, v);
+			if (distance != INFINITY) distance_sum += distance;
+		}
+
+		timer.item_count = BENCHMARK_RAY_COUNT;
+	}
+
+	{
+		sprintf_s(timer_name, "%s - %s::intersects", model_name, bvh_name);
+		ScopedTimer timer(timer_name, "rays");
+
+		for (int i = 0; i < BENCHMARK_RAY_COUNT; i++) {
+			hit_count += bvh.intersects(rays[i]);
+		}
+
+		timer.item_count = BENCHMARK_RAY_COUNT;
+	}
+
+	printf("Sum of hit distances: %f, hit count: %i\n", distance_sum, hit_count);
+}
+
+void Benchmark::bvh_width() {
+	printf("BVH width benchmark, %i rays per model\n", BENCHMARK_RAY_COUNT);
+
+	const char * models[2] = {
+		DATA_PATH("Models/Bunny.obj"),
+		DATA_PATH("Models/MonkeySubdivided2.obj")
+	};
+
+	for (int m = 0; m < 2; m++) {
+		BenchmarkMesh mesh;
+		init_benchmark_mesh(models[m], mesh);
+
+		BVH4 bvh4 = BVH4::collapse(mesh.bvh);
+		BVH8 bvh8 = BVH8::collapse(mesh.bvh);
+
+		benchmark_bvh(models[m], "FlatBVH", mesh.bvh, mesh.rays);
+		benchmark_bvh(models[m], "BVH4",    bvh4,     mesh.rays);
+		benchmark_bvh(models[m], "BVH8",    bvh8,     mesh.rays);
+
+		printf("\n");
+
+		delete[] mesh.triangles;
+		mesh.bvh.free();
+		bvh4.free();
+		bvh8.free();
+	}
+}
+
+void Benchmark::sh_rotation() {
+	const int num_bands         = SH_DEFAULT_NUM_BANDS;
+	const int coefficient_count = SH::get_coefficient_count(num_bands);
+
+	printf("SH rotation benchmark, %i rotations of %i bands\n", BENCHMARK_ROTATION_COUNT, num_bands);
+
+	std::mt19937 gen(BENCHMARK_SEED);
+	std::uniform_real_distribution<float> U01(0.0f, 1.0f);
+	std::uniform_real_distribution<float> U11(-1.0f, 1.0f);
+
+	// Random Euler angles, the quaternions describe the same rotations so that all methods produce the same result
+	struct EulerAngles {
+		float alpha, beta, gamma;
+	};
+	EulerAngles * angles    = new EulerAngles[BENCHMARK_ROTATION_COUNT];
+	glm::quat   * rotations = new glm::quat  [BENCHMARK_ROTATION_COUNT];
+	glm::vec3   * axes      = new glm::vec3  [BENCHMARK_ROTATION_COUNT];
+
+	for (int i = 0; i < BENCHMARK_ROTATION_COUNT; i++) {
+		angles[i].alpha = 2.0f * PI * U01(gen);
+		angles[i].beta  =        PI * U01(gen);
+		angles[i].gamma = 2.0f * PI * U01(gen);
+
+		rotations[i] =
+			glm::angleAxis(angles[i].alpha, glm::vec3(0.0f, 0.0f, 1.0f)) *
+			glm::angleAxis(angles[i].beta,  glm::vec3(0.0f, 1.0f, 0.0f)) *
+			glm::angleAxis(angles[i].gamma, glm::vec3(0.0f, 0.0f, 1.0f));
+
+		axes[i] = rotations[i] * glm::vec3(0.0f, 0.0f, 1.0f);
+	}
+
+	glm::vec3 * coeffs_in  = new glm::vec3[BENCHMARK_ROTATION_BATCH * coefficient_count];
+	glm::vec3 * coeffs_out = new glm::vec3[BENCHMARK_ROTATION_BATCH * coefficient_count];
+
+	for (int i = 0; i < BENCHMARK_ROTATION_BATCH * coefficient_count; i++) {
+		coeffs_in[i] = glm::vec3(U11(gen), U11(gen), U11(gen));
+	}
+
+	// The output is summed so that the compiler cannot optimize the rotations away
+	glm::vec3 sum;
+
+	{
+		sum = glm::vec3(0.0f);
+		ScopedTimer timer("SH::rotate", "rotations");
+
+		for (int i = 0; i < BENCHMARK_ROTATION_COUNT; i++) {
+			SH::rotate(rotations[i], coeffs_in, coeffs_out, num_bands);
+			sum += coeffs_out[coefficient_count - 1];
+		}
+
+		timer.item_count = BENCHMARK_ROTATION_COUNT;
+	}
+	printf("Checksum: %f %f %f\n", sum.r, sum.g, sum.b);
+
+	{
+		sum = glm::vec3(0.0f);
+		ScopedTimer timer("SH::RotationMatrix::init", "rotations");
+
+		SH::RotationMatrix matrix;
+
+		for (int i = 0; i < BENCHMARK_ROTATION_COUNT; i++) {
+			matrix.init(rotations[i], num_bands);
+			sum.r += matrix.blocks[0];
+		}
+
+		timer.item_count = BENCHMARK_ROTATION_COUNT;
+	}
+	printf("Checksum: %f\n", sum.r);
+
+	SIMD::Level supported_level = SIMD::get_level();
+
+	for (int level = int(SIMD::Level::SCALAR); level <= int(supported_level); level++) {
+		SIMD::set_level(SIMD::Level(level));
+
+		char timer_name[256];
+		sprintf_s(timer_name, "SH::RotationMatrix::apply, batches of %i (%s)", BENCHMARK_ROTATION_BATCH, SIMD::get_level_name(SIMD::Level(level)));
+
+		SH::RotationMatrix matrix;
+		matrix.init(rotations[0], num_bands);
+
+		{
+			sum = glm::vec3(0.0f);
+			ScopedTimer timer(timer_name, "rotations");
+
+			for (int i = 0; i < BENCHMARK_ROTATION_COUNT; i += BENCHMARK_ROTATION_BATCH) {
+				matrix.apply(BENCHMARK_ROTATION_BATCH, coeffs_in, coeffs_out, coefficient_count);
+				sum += coeffs_out[coefficient_count - 1];
+			}
+
+			timer.item_count = BENCHMARK_ROTATION_COUNT;
+		}
+		printf("Checksum: %f %f %f\n", sum.r, sum.g, sum.b);
+	}
+
+	SIMD::set_level(supported_level);
+
+	{
+		sum = glm::vec3(0.0f);
+		ScopedTimer timer("SH::rotate_zyz", "rotations");
+
+		for (int i = 0; i < BENCHMARK_ROTATION_COUNT; i++) {
+			SH::rotate_zyz(angles[i].alpha, angles[i].beta, angles[i].gamma, coeffs_in, coeffs_out, num_bands);
+			sum += coeffs_out[coefficient_count - 1];
+		}
+
+		timer.item_count = BENCHMARK_ROTATION_COUNT;
+	}
+	printf("Checksum: %f %f %f (should match SH::rotate)\n", sum.r, sum.g, sum.b);
+
+	{
+		sum = glm::vec3(0.0f);
+		ScopedTimer timer("SH::rotate_zonal", "rotations");
+
+		for (int i = 0; i < BENCHMARK_ROTATION_COUNT; i++) {
+			SH::rotate_zonal(axes[i], coeffs_in, coeffs_out, num_bands);
+			sum += coeffs_out[coefficient_count - 1];
+		}
+
+		timer.item_count = BENCHMARK_ROTATION_COUNT;
+	}
+	printf("Checksum: %f %f %f\n", sum.r, sum.g, sum.b);
+
+	// Every rotation gets its own set of coefficients, all sets start out as the same coefficients so that the checksum matches SH::rotate
+	float * sets_in  = new float[3 * coefficient_count * BENCHMARK_ROTATION_COUNT];
+	float * sets_out = new float[3 * coefficient_count * BENCHMARK_ROTATION_COUNT];
+
+	for (int k = 0; k < coefficient_count; k++) {
+		for (int c = 0; c < 3; c++) {
+			for (int i = 0; i < BENCHMARK_ROTATION_COUNT; i++) {
+				sets_in[(3*k + c) * BENCHMARK_ROTATION_COUNT + i] = coeffs_in[k][c];
+			}
+		}
+	}
+
+	// Compare a single thread against all threads
+	const int thread_counts[2] = { 1, 0 };
+
+	for (int t = 0; t < 2; t++) {
+		ThreadPool thread_pool(thread_counts[t]);
+
+		char timer_name[256];
+		sprintf_s(timer_name, "SH::rotate, batch of %i sets (%s, %i thread(s))", BENCHMARK_ROTATION_COUNT, SIMD::get_level_name(SIMD::get_level()), thread_pool.get_thread_count());
+
+		{
+			ScopedTimer timer(timer_name, "rotations");
+
+			SH::rotate(thread_pool, BENCHMARK_ROTATION_COUNT, rotations, sets_in, sets_out, BENCHMARK_ROTATION_COUNT, num_bands);
+
+			timer.item_count = BENCHMARK_ROTATION_COUNT;
+		}
+
+		sum = glm::vec3(0.0f);
+		for (int i = 0; i < BENCHMARK_ROTATION_COUNT; i++) {
+			for (int c = 0; c < 3; c++) {
+				sum[c] += sets_out[(3*(coefficient_count - 1) + c) * BENCHMARK_ROTATION_COUNT + i];
+			}
+		}
+		printf("Checksum: %f %f %f (should match SH::rotate)\n", sum.r, sum.g, sum.b);
+	}
+
+	printf("\n");
+
+	delete[] angles;
+	delete[] rotations;
+	delete[] axes;
+	delete[] coeffs_in;
+	delete[] coeffs_out;
+	delete[] sets_in;
+	delete[] sets_out;
+}
+
+void Benchmark::sh_sampling() {
+	const int num_bands         = SH_MAX_NUM_BANDS;
+	const int coefficient_count = SH::get_coefficient_count(num_bands);
+
+	printf("SH sampling benchmark, relative projection error of %i bands averaged over %i axes\n", num_bands, BENCHMARK_SAMPLING_AXIS_COUNT);
+
+	// The test functions only depend on the cosine of the angle with their axis, the channels hold a clamped cosine, a Phong lobe and a hemisphere
+	auto test_function = [](float cos_theta) {
+		float clamped_cosine = cos_theta > 0.0f ? cos_theta : 0.0f;
+
+		return glm::vec3(clamped_cosine, pow(clamped_cosine, 16.0f), cos_theta > 0.0f ? 1.0f : 0.0f);
+	};
+
+	// Rotationally symmetric functions only have zonal coefficients, which are accurately integrated using the midpoint rule over the cosine of theta
+	glm::dvec3 zonal_sums[SH_MAX_NUM_BANDS] = { };
+
+	for (int i = 0; i < BENCHMARK_SAMPLING_INTEGRATION_STEPS; i++) {
+		float cos_theta = -1.0f + (2.0f * (float)i + 1.0f) / (float)BENCHMARK_SAMPLING_INTEGRATION_STEPS;
+
+		glm::dvec3 value = glm::dvec3(test_function(cos_theta));
+
+		for (int l = 0; l < num_bands; l++) {
+			zonal_sums[l] += value * (double)SH::evaluate(l, 0, acos(cos_theta), 0.0f);
+		}
+	}
+
+	glm::vec3 zonal_coeffs[SH_MAX_NUM_BANDS];
+	for (int l = 0; l < num_bands; l++) {
+		zonal_coeffs[l] = glm::vec3(zonal_sums[l] * (4.0 * PI / (double)BENCHMARK_SAMPLING_INTEGRATION_STEPS));
+	}
+
+	std::mt19937 gen(BENCHMARK_SEED);
+	std::uniform_real_distribution<float> U01(0.0f, 1.0f);
+
+	glm::vec3 * axes       = new glm::vec3[BENCHMARK_SAMPLING_AXIS_COUNT];
+	glm::vec3 * references = new glm::vec3[BENCHMARK_SAMPLING_AXIS_COUNT * coefficient_count];
+
+	for (int a = 0; a < BENCHMARK_SAMPLING_AXIS_COUNT; a++) {
+		float cos_theta = 1.0f - 2.0f * U01(gen);
+		float sin_theta = sqrt(1.0f - cos_theta * cos_theta);
+		float phi       = 2.0f * PI * U01(gen);
+
+		axes[a] = glm::vec3(sin_theta * cos(phi), sin_theta * sin(phi), cos_theta);
+
+		SH::rotate_zonal(axes[a], zonal_coeffs, references + a * coefficient_count, num_bands);
+	}
+
+	const int    generator_count = 4;
+	const char * generator_names[generator_count] = { "Jittered", "Hammersley", "Sobol", "Fibonacci" };
+
+	// Square sample counts, so that the jittered grid can be used as well
+	const int sample_count_count = 4;
+	const int sample_counts[sample_count_count] = { 256, 1024, 2500, 4096 };
+
+	printf("%-10s %7s %16s %16s %16s\n", "Generator", "Samples", "Clamped cosine", "Phong lobe", "Hemisphere");
+
+	for (int g = 0; g < generator_count; g++) {
+		SH::SampleSettings settings;
+		settings.generator = SH::SampleSettings::Generator(g);
+		settings.seed      = BENCHMARK_SEED;
+
+		for (int n = 0; n < sample_count_count; n++) {
+			int sample_count = sample_counts[n];
+
+			SH::Sample * samples = new SH::Sample[sample_count];
+			SH::init_samples(samples, sample_count, settings);
+
+			glm::vec3 error = glm::vec3(0.0f);
+
+			for (int a = 0; a < BENCHMARK_SAMPLING_AXIS_COUNT; a++) {
+				glm::vec3 result[SH_MAX_COEFFICIENT_COUNT] = { };
+
+				for (int s = 0; s < sample_count; s++) {
+					glm::vec3 value = test_function(glm::dot(samples[s].direction, axes[a]));
+
+					for (int c = 0; c < coefficient_count; c++) {
+						result[c] += value * samples[s].coeffs[c];
+					}
+				}
+
+				const glm::vec3 * reference = references + a * coefficient_count;
+
+				glm::vec3 error_squared     = glm::vec3(0.0f);
+				glm::vec3 reference_squared = glm::vec3(0.0f);
+
+				for (int c = 0; c < coefficient_count; c++) {
+					glm::vec3 difference = result[c] * (4.0f * PI / (float)sample_count) - reference[c];
+
+					error_squared     += difference   * difference;
+					reference_squared += reference[c] * reference[c];
+				}
+
+				error += glm::sqrt(error_squared / reference_squared);
+			}
+
+			error /= (float)BENCHMARK_SAMPLING_AXIS_COUNT;
+
+			printf("%-10s %7i %16e %16e %16e\n", generator_names[g], sample_count, error.r, error.g, error.b);
+
+			delete[] samples;
+		}
+	}
+
+	printf("\n");
+
+	delete[] axes;
+	delete[] references;
+}
+
+// Relative error of the first coefficient_count coefficients, computed per channel and then averaged
+static float relative_error(const glm::vec3 coeffs[], const glm::vec3 reference[], int coefficient_count) {
+	glm::vec3 error_squared     = glm::vec3(0.0f);
+	glm::vec3 reference_squared = glm::vec3(0.0f);
+
+	for (int c = 0; c < coefficient_count; c++) {
+		glm::vec3 difference = coeffs[c] - reference[c];
+
+		error_squared     += difference   * difference;
+		reference_squared += reference[c] * reference[c];
+	}
+
+	glm::vec3 error = glm::sqrt(error_squared / reference_squared);
+
+	return (error.r + error.g + error.b) / 3.0f;
+}
+
+void Benchmark::light_projection() {
+	const int coefficient_count = SH_MAX_COEFFICIENT_COUNT;
+
+	printf("Light projection benchmark, relative error of %i bands\n", SH_MAX_NUM_BANDS);
+
+	// Light::init falls back to uniform samples for Lights that do not implement sample
+	struct UniformlySampledLight : public Light {
+		const Light * light;
+
+		void get_light(int count, const glm::vec3 directions[], glm::vec3 result[]) const {
+			light->get_light(count, directions, result);
+		}
+	};
+
+	const int light_count = 2;
+	const char * light_names[light_count] = { "Cap", "HDR Probe" };
+
+	Light     * lights           [light_count];
+	glm::vec3 * light_references [light_count];
+
+	// The cap is rotationally symmetric around the z axis, so only its zonal coefficients are non-zero
+	DirectionalLight * cap = new DirectionalLight();
+	lights[0] = cap;
+
+	light_references[0] = new glm::vec3[coefficient_count];
+	memset(light_references[0], 0, coefficient_count * sizeof(glm::vec3));
+
+	{
+		const float cos_cap_angle = cos(cap->cap_angle);
+
+		for (int l = 0; l < SH_MAX_NUM_BANDS; l++) {
+			double sum = 0.0;
+
+			for (int i = 0; i < BENCHMARK_SAMPLING_INTEGRATION_STEPS; i++) {
+				float cos_theta = cos_cap_angle + (1.0f - cos_cap_angle) * (float(i) + 0.5f) / float(BENCHMARK_SAMPLING_INTEGRATION_STEPS);
+
+				sum += SH::evaluate(l, 0, acos(cos_theta), 0.0f);
+			}
+
+			light_references[0][l * (l + 1)] = glm::vec3(float(2.0 * PI * (1.0 - cos_cap_angle) * sum / double(BENCHMARK_SAMPLING_INTEGRATION_STEPS)));
+		}
+	}
+
+	// Synthetic angular map probe, a dim sky that is brighter towards the top plus a sun with a radius of 2 degrees
+	const glm::vec3 sun_direction = glm::normalize(glm::vec3(0.3f, 0.4f, 0.8f));
+	const float     sun_cos_angle = cos(DEG_TO_RAD(2.0f));
+
+	auto get_map_direction = [](float u, float v) {
+		float r     = sqrt(u*u + v*v);
+		float theta = PI * r;
+		float phi   = atan2(v, u);
+
+		return glm::vec3(sin(theta) * cos(phi), sin(theta) * sin(phi), cos(theta));
+	};
+
+	glm::vec3 * probe_data = new glm::vec3[BENCHMARK_PROBE_SIZE * BENCHMARK_PROBE_SIZE];
+
+	for (int x = 0; x < BENCHMARK_PROBE_SIZE; x++) {
+		for (int y = 0; y < BENCHMARK_PROBE_SIZE; y++) {
+			float u = (float(x) + 0.5f) / float(BENCHMARK_PROBE_SIZE) * 2.0f - 1.0f;
+			float v = (float(y) + 0.5f) / float(BENCHMARK_PROBE_SIZE) * 2.0f - 1.0f;
+
+			glm::vec3 direction = get_map_direction(u, v);
+
+			glm::vec3 sky = glm::vec3(0.3f, 0.4f, 0.6f) * (1.0f + direction.z);
+			glm::vec3 sun = glm::dot(direction, sun_direction) > sun_cos_angle ? glm::vec3(2000.0f, 1800.0f, 1500.0f) : glm::vec3(0.0f);
+
+			probe_data[x * BENCHMARK_PROBE_SIZE + y] = u*u + v*v < 1.0f ? sky + sun : glm::vec3(0.0f);
+		}
+	}
+
+	// The ThreadPool is only used by HDRProbeLight::init, Light::init is called explicitly to use Monte Carlo integration
+	ThreadPool thread_pool;
+
+	HDRProbeLight * probe = new HDRProbeLight(BENCHMARK_PROBE_SIZE, probe_data, &thread_pool);
+	lights[1] = probe;
+
+	// The probe is constant within every pixel, so its coefficients are found by integrating the SH basis over the area of every pixel in the map,
+	// weighted by the ratio between solid angle and map area
+	light_references[1] = new glm::vec3[coefficient_count];
+	{
+		const int supersample_count = BENCHMARK_PROBE_SIZE * BENCHMARK_PROBE_SUPERSAMPLES;
+
+		Array<float>     directions_x(supersample_count);
+		Array<float>     directions_y(supersample_count);
+		Array<float>     directions_z(supersample_count);
+		Array<float>     weights     (supersample_count);
+		Array<glm::vec3> light       (supersample_count);
+		Array<float>     basis       (supersample_count * coefficient_count);
+
+		Array<glm::dvec3> sums(coefficient_count, glm::dvec3(0.0));
+
+		const float area = 4.0f / float(supersample_count * supersample_count);
+
+		// One row of supersamples at a time
+		for (int i = 0; i < supersample_count; i++) {
+			int count = 0;
+
+			for (int j = 0; j < supersample_count; j++) {
+				float u = (float(i) + 0.5f) / float(supersample_count) * 2.0f - 1.0f;
+				float v = (float(j) + 0.5f) / float(supersample_count) * 2.0f - 1.0f;
+
+				float r = sqrt(u*u + v*v);
+				if (r >= 1.0f) continue;
+
+				glm::vec3 direction = get_map_direction(u, v);
+
+				directions_x[count] = direction.x;
+				directions_y[count] = direction.y;
+				directions_z[count] = direction.z;
+				weights     [count] = area * (r > 0.0f ? PI * sin(PI * r) / r : PI * PI);
+
+				probe->get_light(1, &direction, &light[count]);
+
+				count++;
+			}
+
+			SH::evaluate(count, directions_x.data(), directions_y.data(), directions_z.data(), basis.data(), supersample_count);
+
+			for (int c = 0; c < coefficient_count; c++) {
+				for (int s = 0; s < count; s++) {
+					sums[c] += glm::dvec3(light[s] * (weights[s] * basis[c * supersample_count + s]));
+				}
+			}
+		}
+
+		for (int c = 0; c < coefficient_count; c++) {
+			light_references[1][c] = glm::vec3(sums[c]);
+		}
+	}
+
+	// Square sample counts, so that every generator can be used
+	const int sample_count_count = 5;
+	const int sample_counts[sample_count_count] = { 64, 256, 1024, 2500, 10000 };
+
+	printf("%-10s %7s %16s %16s\n", "Light", "Samples", "Uniform", "Importance");
+
+	for (int l = 0; l < light_count; l++) {
+		UniformlySampledLight uniform_light;
+		uniform_light.light = lights[l];
+
+		for (int n = 0; n < sample_count_count; n++) {
+			int sample_count = sample_counts[n];
+
+			SH::SampleSettings settings;
+			settings.seed = BENCHMARK_SEED;
+
+			SH::Sample * samples = new SH::Sample[sample_count];
+			SH::init_samples(samples, sample_count, settings);
+
+			// The DirectionalLight is an AnalyticLight, calling Light::init explicitly makes it use Monte Carlo integration as well
+			uniform_light.init(samples, sample_count);
+			lights[l]->Light::init(samples, sample_count);
+
+			float error_uniform    = relative_error(uniform_light.coefficients, light_references[l], coefficient_count);
+			float error_importance = relative_error(lights[l]  ->coefficients, light_references[l], coefficient_count);
+
+			printf("%-10s %7i %16e %16e\n", light_names[l], sample_count, error_uniform, error_importance);
+
+			delete[] samples;
+		}
+	}
+
+	// Integrating the SH basis over every pixel of the probe does not use samples, the first projection also computes the integrals of every pixel
+	{
+		const int sample_count = sample_counts[sample_count_count - 1];
+
+		SH::SampleSettings settings;
+		settings.seed = BENCHMARK_SEED;
+
+		SH::Sample * samples = new SH::Sample[sample_count];
+		SH::init_samples(samples, sample_count, settings);
+
+		char timer_name[256];
+		sprintf_s(timer_name, "HDR Probe - Light::init with %i samples", sample_count);
+
+		{
+			ScopedTimer timer(timer_name);
+			probe->Light::init(samples, sample_count);
+		}
+
+		{
+			ScopedTimer timer("HDR Probe - Pixel integration (first)");
+			probe->init(samples, sample_count);
+		}
+
+		{
+			ScopedTimer timer("HDR Probe - Pixel integration (cached)");
+			probe->init(samples, sample_count);
+		}
+
+		printf("%-10s %7s %16s %16e\n", light_names[1], "Pixels", "", relative_error(probe->coefficients, light_references[1], coefficient_count));
+
+		delete[] samples;
+	}
+
+	printf("\n");
+
+	for (int l = 0; l < light_count; l++) {
+		delete lights[l];
+		delete[] light_references[l];
+	}
+
+	LightProbe::free_tables();
+}
+
+void Benchmark::analytic_lights() {
+	printf("Analytic Light benchmark, relative difference to Monte Carlo integration with %i samples\n", BENCHMARK_LIGHT_SAMPLE_COUNT);
+
+	DirectionalLight cone;
+	cone.direction = glm::normalize(glm::vec3(0.3f, -0.5f, 0.8f));
+	cone.cap_angle = DEG_TO_RAD(20.0f);
+
+	SphereLight sphere;
+	sphere.position = glm::vec3(3.0f, 1.0f, -2.0f);
+	sphere.radius   = 1.5f;
+
+	RectangleLight rectangle;
+	rectangle.center = glm::vec3(1.0f, 2.0f, 1.5f);
+	rectangle.axis_u = glm::vec3(-1.5f, 0.0f, -0.5f);
+	rectangle.axis_v = glm::vec3( 0.0f, 2.0f,  0.0f);
+
+	SkyLight sky;
+
+	const int light_count = 4;
+	const char    * light_names[light_count] = { "Cone", "Sphere", "Rectangle", "Sky" };
+	AnalyticLight * lights     [light_count] = { &cone, &sphere, &rectangle, &sky };
+
+	SH::SampleSettings settings;
+	settings.seed = BENCHMARK_SEED;
+
+	SH::Sample * samples = new SH::Sample[BENCHMARK_LIGHT_SAMPLE_COUNT];
+	SH::init_samples(samples, BENCHMARK_LIGHT_SAMPLE_COUNT, settings);
+
+	char timer_name[256];
+
+	for (int l = 0; l < light_count; l++) {
+		glm::vec3 monte_carlo_coeffs[SH_MAX_COEFFICIENT_COUNT];
+
+		{
+			sprintf_s(timer_name, "%s - Light::init", light_names[l]);
+			ScopedTimer timer(timer_name);
+
+			lights[l]->Light::init(samples, BENCHMARK_LIGHT_SAMPLE_COUNT);
+		}
+
+		memcpy(monte_carlo_coeffs, lights[l]->coefficients, sizeof(monte_carlo_coeffs));
+
+		float checksum = 0.0f;
+
+		{
+			sprintf_s(timer_name, "%s - AnalyticLight::update", light_names[l]);
+			ScopedTimer timer(timer_name, "updates");
+
+			for (int i = 0; i < BENCHMARK_LIGHT_UPDATE_COUNT; i++) {
+				lights[l]->update();
+
+				checksum += lights[l]->coefficients[0].r;
+			}
+
+			timer.item_count = BENCHMARK_LIGHT_UPDATE_COUNT;
+		}
+
+		printf("%s - difference: %e (checksum %f)\n", light_names[l], relative_error(lights[l]->coefficients, monte_carlo_coeffs, SH_MAX_COEFFICIENT_COUNT), checksum);
+	}
+
+	printf("\n");
+
+	delete[] samples;
+}
+
+void Benchmark::light_mixer() {
+	const int num_bands         = SH_DEFAULT_NUM_BANDS;
+	const int coefficient_count = SH::get_coefficient_count(num_bands);
+
+	printf("Light mixer benchmark, %i frames of %i Lights with %i bands\n", BENCHMARK_MIXER_FRAME_COUNT, BENCHMARK_MIXER_LIGHT_COUNT, num_bands);
+
+	std::mt19937 gen(BENCHMARK_SEED);
+	std::uniform_real_distribution<float> U01(0.0f, 1.0f);
+	std::uniform_real_distribution<float> U11(-1.0f, 1.0f);
+
+	// Lights with random coefficients and intensities, every frame gives every Light a new random rotation
+	struct RandomLight : public Light {
+		void get_light(int /*count*/, const glm::vec3 /*directions*/[], glm::vec3 /*result*/[]) const { }
+	};
+
+	LightMixer mixer;
+	mixer.init(BENCHMARK_MIXER_LIGHT_COUNT);
+
+	for (int i = 0; i < BENCHMARK_MIXER_LIGHT_COUNT; i++) {
+		RandomLight light;
+		for (int k = 0; k < SH_MAX_COEFFICIENT_COUNT; k++) {
+			light.coefficients[k] = glm::vec3(U11(gen), U11(gen), U11(gen));
+		}
+
+		mixer.add(light, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(U01(gen), U01(gen), U01(gen)));
+	}
+
+	glm::quat * rotations = new glm::quat[BENCHMARK_MIXER_FRAME_COUNT * BENCHMARK_MIXER_LIGHT_COUNT];
+
+	for (int i = 0; i < BENCHMARK_MIXER_FRAME_COUNT * BENCHMARK_MIXER_LIGHT_COUNT; i++) {
+		rotations[i] = glm::normalize(glm::quat(U11(gen), U11(gen), U11(gen), U11(gen)));
+	}
+
+	glm::vec3 * results = new glm::vec3[BENCHMARK_MIXER_FRAME_COUNT * coefficient_count];
+
+	char timer_name[256];
+
+	auto run_frames = [&](ThreadPool& thread_pool) {
+		ScopedTimer timer(timer_name, "frames");
+
+		for (int f = 0; f < BENCHMARK_MIXER_FRAME_COUNT; f++) {
+			for (int i = 0; i < BENCHMARK_MIXER_LIGHT_COUNT; i++) {
+				mixer.set_rotation(i, rotations[f * BENCHMARK_MIXER_LIGHT_COUNT + i]);
+			}
+
+			mixer.mix(thread_pool, results + f * coefficient_count, num_bands);
+		}
+
+		timer.item_count = BENCHMARK_MIXER_FRAME_COUNT;
+	};
+
+	glm::vec3 * results_reference = new glm::vec3[BENCHMARK_MIXER_FRAME_COUNT * coefficient_count];
+
+	SIMD::Level supported_level = SIMD::get_level();
+
+	// Every SIMD level on a single thread, the results should be identical
+	{
+		ThreadPool thread_pool(1);
+
+		for (int level = int(SIMD::Level::SCALAR); level <= int(supported_level); level++) {
+			SIMD::set_level(SIMD::Level(level));
+
+			sprintf_s(timer_name, "LightMixer::mix (%s, 1 thread)", SIMD::get_level_name(SIMD::Level(level)));
+			run_frames(thread_pool);
+
+			if (level == int(SIMD::Level::SCALAR)) {
+				memcpy(results_reference, results, BENCHMARK_MIXER_FRAME_COUNT * coefficient_count * sizeof(glm::vec3));
+			} else {
+				bool identical = memcmp(results_reference, results, BENCHMARK_MIXER_FRAME_COUNT * coefficient_count * sizeof(glm::vec3)) == 0;
+
+				printf("Identical to %s: %s\n", SIMD::get_level_name(SIMD::Level::SCALAR), identical ? "yes" : "no");
+			}
+		}
+
+		SIMD::set_level(supported_level);
+	}
+
+	// All threads
+	{
+		ThreadPool thread_pool;
+
+		sprintf_s(timer_name, "LightMixer::mix (%s, %i threads)", SIMD::get_level_name(supported_level), thread_pool.get_thread_count());
+		run_frames(thread_pool);
+	}
+
+	printf("\n");
+
+	mixer.free();
+
+	delete[] rotations;
+	delete[] results;
+	delete[] results_reference;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+// Set to 1 to run the benchmarks on startup, before the Scene is initialized
+#define BENCHMARK 0
+
+namespace Benchmark {
+	// Compares the number of BVH nodes per second that can be processed using the
+	// original slab test (Ray::trace) and the branchless slab test (TraversalRay::trace)
+	void bvh_traversal();
+
+	// Compares the binary FlatBVH against the collapsed BVH4 and BVH8 in Rays per second
+	void bvh_width();
+
+	// Compares the ways of rotating SH coefficients in rotations per second: SH::rotate, which builds the matrix for every rotation,
+	// a cached SH::RotationMatrix applied to a batch of coefficient vectors for every SIMD level, the ZYZ Euler and zonal harmonic fast paths,
+	// and the batch SH::rotate that rotates every set by its own rotation, using a single thread and using all threads
+	void sh_rotation();
+
+	// Compares the sample generators of SH::init_samples by the error of projecting functions with known SH coefficients, for several sample counts.
+	// The test functions are a clamped cosine, a Phong lobe and a hemisphere, each rotated towards a number of random axes
+	void sh_sampling();
+
+	// Compares the error of projecting Lights using uniform samples against importance sampling, for several sample counts.
+	// Uses a DirectionalLight, whose cap has known SH coefficients, and a synthetic HDRProbeLight with a small and very bright sun
+	void light_projection();
+
+	// Measures the time it takes to update the coefficients of every type of AnalyticLight,
+	// and compares them to a Monte Carlo projection of the same Light
+	void analytic_lights();
+
+	// Measures the time per frame of rotating and summing many Lights with a LightMixer, for every SIMD level using a single thread and using all threads
+	void light_mixer();
+}
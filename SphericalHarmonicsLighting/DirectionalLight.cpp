@@ -1,9 +1,49 @@
 #include "Light.h"
 
+#include "SHRotation.h"
 #include "Util.h"
 
-glm::vec3 DirectionalLight::get_light(float theta, float phi) const {
-	return (theta < PI / 6.0f) 
-		? glm::vec3(1.0f, 1.0f, 1.0f) 
-		: glm::vec3(0.0f, 0.0f, 0.0f);
+void DirectionalLight::update() {
+	if (cap_angle > 0.0f) {
+		project_cap(direction, cos(cap_angle), color);
+	} else {
+		// The limit of a cap that shrinks while its radiance grows, such that its irradiance stays the same: Y_l0 evaluated on the axis
+		glm::vec3 zonal_coeffs[SH_MAX_NUM_BANDS];
+		for (int l = 0; l < SH_MAX_NUM_BANDS; l++) {
+			float axis_value = sqrt((2*l + 1) / (4.0f * PI));
+			zonal_coeffs[l] = color * axis_value;
+		}
+
+		SH::rotate_zonal(direction, zonal_coeffs, coefficients);
+	}
+}
+
+void DirectionalLight::get_light(int count, const glm::vec3 directions[], glm::vec3 result[]) const {
+	const float cos_cap_angle = cos(cap_angle);
+
+	for (int i = 0; i < count; i++) {
+		result[i] = (cap_angle > 0.0f && glm::dot(directions[i], direction) >= cos_cap_angle) 
+			? color 
+			: glm::vec3(0.0f, 0.0f, 0.0f);
+	}
+}
+
+bool DirectionalLight::sample(float u, float v, glm::vec3& sample_direction, float& pdf) const {
+	if (cap_angle <= 0.0f) return false;
+
+	// The cosine of theta is uniformly distributed over the height of the cap, which makes the directions uniformly distributed over its area
+	float one_minus_cos_cap_angle = 1.0f - cos(cap_angle);
+
+	float cos_theta = 1.0f - u * one_minus_cos_cap_angle;
+	float sin_theta = sqrt(glm::max(0.0f, 1.0f - cos_theta * cos_theta));
+	float phi       = 2.0f * PI * v;
+
+	// Orthonormal basis around the direction of the Light
+	glm::vec3 tangent   = glm::normalize(glm::cross(abs(direction.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f), direction));
+	glm::vec3 bitangent = glm::cross(direction, tangent);
+
+	sample_direction = (sin_theta * cos(phi)) * tangent + (sin_theta * sin(phi)) * bitangent + cos_theta * direction;
+	pdf              = 1.0f / (2.0f * PI * one_minus_cos_cap_angle);
+
+	return true;
 }
@@ -1,10 +1,12 @@
 #include "Light.h"
 
+#include <algorithm>
 #include <fstream>
 
+#include "LightProbe.h"
 #include "Util.h"
 
-HDRProbeLight::HDRProbeLight(const char* filename, int size) : size(size), data(new glm::vec3[size * size]) {
+HDRProbeLight::HDRProbeLight(const char* filename, int size, ThreadPool * thread_pool) : size(size), data(new glm::vec3[size * size]), thread_pool(thread_pool) {
 	std::ifstream file(filename, std::ios::in | std::ios::binary); 
 	if (!file.is_open()) {
 		abort();
@@ -12,24 +14,182 @@ HDRProbeLight::HDRProbeLight(const char* filename, int size) : size(size), data(
 
 	file.read(reinterpret_cast<char*>(data), size * size * sizeof(glm::vec3));
 	file.close();
+
+	init_distribution();
+}
+
+HDRProbeLight::HDRProbeLight(int size, glm::vec3 * data, ThreadPool * thread_pool) : size(size), data(data), thread_pool(thread_pool) {
+	init_distribution();
 }
 
 HDRProbeLight::~HDRProbeLight() {
 	assert(data);
 	delete[] data;
+
+	delete[] pixel_probabilities;
+	delete[] marginal_cdf;
+	delete[] conditional_cdfs;
 }
 
-glm::vec3 HDRProbeLight::get_light(float theta, float phi) const {
-	const glm::vec3 direction(sin(theta) * cos(phi), sin(theta) * sin(phi), cos(theta));
+// The probe is an angular map: a direction at angle theta from the z axis is found at distance theta / PI from the center of the map.
+// This maps the center of a pixel to the ratio between its solid angle and its area in the map, which is PI * sin(PI * r) / r
+static float get_solid_angle_factor(float u, float v) {
+	float r = sqrt(u*u + v*v);
+
+	if (r >= 1.0f) return 0.0f; // Outside of the disk that contains the probe
+	if (r < 1e-6f) return PI * PI;
+
+	return PI * sin(PI * r) / r;
+}
+
+void HDRProbeLight::init_distribution() {
+	pixel_probabilities = new float[size * size];
+	marginal_cdf        = new float[size + 1];
+	conditional_cdfs    = new float[size * (size + 1)];
+
+	// Weight every pixel by its luminance and its solid angle
+	double total_weight = 0.0;
+
+	for (int x = 0; x < size; x++) {
+		for (int y = 0; y < size; y++) {
+			float u = (float(x) + 0.5f) / float(size) * 2.0f - 1.0f;
+			float v = (float(y) + 0.5f) / float(size) * 2.0f - 1.0f;
+
+			const glm::vec3& pixel = data[x * size + y];
+			float luminance = 0.2126f * pixel.r + 0.7152f * pixel.g + 0.0722f * pixel.b;
+
+			pixel_probabilities[x * size + y] = std::max(luminance, 0.0f) * get_solid_angle_factor(u, v);
+
+			total_weight += pixel_probabilities[x * size + y];
+		}
+	}
+
+	// An entirely black probe is projected using uniform samples
+	if (total_weight <= 0.0) {
+		delete[] pixel_probabilities;
+		delete[] marginal_cdf;
+		delete[] conditional_cdfs;
+
+		pixel_probabilities = NULL;
+		marginal_cdf        = NULL;
+		conditional_cdfs    = NULL;
+
+		return;
+	}
+
+	for (int i = 0; i < size * size; i++) {
+		pixel_probabilities[i] = float(pixel_probabilities[i] / total_weight);
+	}
+
+	// The sums are done in double precision and every CDF ends at exactly one
+	double marginal_sum = 0.0;
+	marginal_cdf[0] = 0.0f;
+
+	for (int x = 0; x < size; x++) {
+		float * conditional_cdf = conditional_cdfs + x * (size + 1);
+		conditional_cdf[0] = 0.0f;
+
+		double row_sum = 0.0;
+		for (int y = 0; y < size; y++) {
+			row_sum += pixel_probabilities[x * size + y];
+		}
+
+		double conditional_sum = 0.0;
+		for (int y = 0; y < size; y++) {
+			conditional_sum += pixel_probabilities[x * size + y];
+
+			conditional_cdf[y + 1] = row_sum > 0.0 ? float(conditional_sum / row_sum) : float(y + 1) / float(size);
+		}
+		conditional_cdf[size] = 1.0f;
+
+		marginal_sum += row_sum;
+		marginal_cdf[x + 1] = float(marginal_sum);
+	}
+
+	for (int x = 1; x < size; x++) {
+		marginal_cdf[x] = float(double(marginal_cdf[x]) / marginal_sum);
+	}
+	marginal_cdf[size] = 1.0f;
+}
 
-	const float r = ONE_OVER_PI * acos(direction.z) / sqrt(direction.x*direction.x + direction.y*direction.y);
+void HDRProbeLight::init(const SH::Sample samples[], int sample_count) {
+	if (thread_pool == NULL) {
+		Light::init(samples, sample_count);
+
+		return;
+	}
+
+	// The rows of the data are the rows x of the angular map, the same as those of LightProbe::Image
+	LightProbe::project(LightProbe::Layout::ANGULAR, size, size, data, *thread_pool, coefficients);
+
+	// Scaled the same way as get_light
+	for (int n = 0; n < SH_MAX_COEFFICIENT_COUNT; n++) {
+		coefficients[n] *= ONE_OVER_PI;
+	}
+}
+
+// Finds the bin of a piecewise constant CDF that contains u, and remaps u to its relative position inside that bin.
+// Bins with zero probability are never chosen
+static int sample_cdf(const float cdf[], int count, float& u) {
+	int index = int(std::upper_bound(cdf, cdf + count + 1, u) - cdf) - 1;
+	index = std::min(std::max(index, 0), count - 1);
+
+	float bin_size = cdf[index + 1] - cdf[index];
+
+	// The remapped value is kept below one, so that it cannot end up in the next bin
+	u = bin_size > 0.0f ? std::min((u - cdf[index]) / bin_size, 0.99999994f) : 0.5f;
+
+	return index;
+}
+
+int HDRProbeLight::get_pixel_index(const glm::vec3& direction) const {
+	float length_xy = sqrt(direction.x*direction.x + direction.y*direction.y);
+
+	// The z axis itself maps to the center of the probe
+	const float r = length_xy > 0.0f ? ONE_OVER_PI * acos(glm::clamp(direction.z, -1.0f, 1.0f)) / length_xy : 0.0f;
 
 	const float u = direction.x * r;
 	const float v = direction.y * r;
 
-	const int x = (u * 0.5f + 0.5f) * size;
-	const int y = (v * 0.5f + 0.5f) * size;
+	const int x = std::min(std::max(int((u * 0.5f + 0.5f) * size), 0), size - 1);
+	const int y = std::min(std::max(int((v * 0.5f + 0.5f) * size), 0), size - 1);
+
+	return x * size + y;
+}
 
+void HDRProbeLight::get_light(int count, const glm::vec3 directions[], glm::vec3 result[]) const {
 	assert(data);
-	return data[x * size + y] * ONE_OVER_PI;
+
+	for (int i = 0; i < count; i++) {
+		result[i] = data[get_pixel_index(directions[i])] * ONE_OVER_PI;
+	}
+}
+
+bool HDRProbeLight::sample(float u, float v, glm::vec3& direction, float& pdf) const {
+	if (pixel_probabilities == NULL) return false;
+
+	// Choose a pixel, the remapped u and v give the position inside the pixel
+	int x = sample_cdf(marginal_cdf, size, u);
+	int y = sample_cdf(conditional_cdfs + x * (size + 1), size, v);
+
+	float map_u = (float(x) + u) / float(size) * 2.0f - 1.0f;
+	float map_v = (float(y) + v) / float(size) * 2.0f - 1.0f;
+
+	// Convert the position in the angular map to a direction
+	float r = sqrt(map_u*map_u + map_v*map_v);
+	r = std::min(r, 1.0f);
+
+	float theta = PI * r;
+	float phi   = atan2(map_v, map_u);
+
+	direction = glm::vec3(sin(theta) * cos(phi), sin(theta) * sin(phi), cos(theta));
+
+	// The density of the pixel in the map, divided by the ratio between solid angle and map area at the sampled position.
+	// The probability of the pixel that get_light will read is used, which only differs from pixel (x, y) due to rounding at its edges
+	float pixel_area = 4.0f / float(size * size);
+	float factor     = get_solid_angle_factor(map_u, map_v);
+
+	pdf = factor > 0.0f ? pixel_probabilities[get_pixel_index(direction)] / (pixel_area * factor) : 0.0f;
+
+	return true;
 }
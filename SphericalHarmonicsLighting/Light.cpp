@@ -1,25 +1,115 @@
 #include "Light.h"
 
+#include "SHRotation.h"
 #include "Util.h"
 
-void Light::init(const SH::Sample samples[SAMPLE_COUNT]) {
-	// Weighed by the area of a 3D unit sphere
-	const float weight = 4.0f * PI;
+bool Light::sample(float /*u*/, float /*v*/, glm::vec3& /*direction*/, float& /*pdf*/) const {
+	return false;
+}
+
+void Light::init(const SH::Sample samples[], int sample_count) {
+	glm::vec3 * directions = new glm::vec3[sample_count];
+	float     * weights    = new float    [sample_count];
+
+	// Map the sample directions back to the points in the unit square they were generated from, so that the warped samples keep their stratification
+	bool importance_sampled = true;
+
+	for (int s = 0; s < sample_count; s++) {
+		float u = 0.5f - 0.5f * cos(samples[s].theta);
+		float v = samples[s].phi * (0.5f * ONE_OVER_PI);
+
+		float pdf = 0.0f;
+		if (!sample(u, v, directions[s], pdf)) {
+			importance_sampled = false;
+
+			break;
+		}
+
+		// Directions with a density of zero can only be drawn where the Light is black
+		weights[s] = pdf > 0.0f ? 1.0f / pdf : 0.0f;
+	}
+
+	float factor;
+
+	float * directions_basis = NULL;
+
+	if (importance_sampled) {
+		// Divide by the number of samples, every sample was already weighted by its probability density
+		factor = 1.0f / sample_count;
+
+		// The SH basis is evaluated in the warped directions, in Structure of Arrays layout
+		float * directions_x = new float[sample_count];
+		float * directions_y = new float[sample_count];
+		float * directions_z = new float[sample_count];
+		directions_basis     = new float[SH_MAX_COEFFICIENT_COUNT * sample_count];
+
+		for (int s = 0; s < sample_count; s++) {
+			directions_x[s] = directions[s].x;
+			directions_y[s] = directions[s].y;
+			directions_z[s] = directions[s].z;
+		}
+
+		SH::evaluate(sample_count, directions_x, directions_y, directions_z, directions_basis, sample_count);
+
+		delete[] directions_x;
+		delete[] directions_y;
+		delete[] directions_z;
+	} else {
+		// Weighed by the area of a 3D unit sphere, divided by the number of samples
+		factor = 4.0f * PI / sample_count;
+
+		for (int s = 0; s < sample_count; s++) {
+			directions[s] = samples[s].direction;
+			weights   [s] = 1.0f;
+		}
+	}
+
+	// Evaluate the Light once for every sample
+	glm::vec3 * light = new glm::vec3[sample_count];
+	get_light(sample_count, directions, light);
+
+	for (int n = 0; n < SH_MAX_COEFFICIENT_COUNT; n++) {
+		coefficients[n] = glm::vec3(0.0f, 0.0f, 0.0f);
+	}
 
 	// For each sample
-	for (int i = 0; i < SAMPLE_COUNT; i++) {
-		float theta = samples[i].theta;
-		float phi   = samples[i].phi;
+	for (int s = 0; s < sample_count; s++) {
+		glm::vec3 weighted_light = light[s] * weights[s];
 
-		// For each SH coefficient
-		for (int n = 0; n < SH_COEFFICIENT_COUNT; n++) {
-			coefficients[n] += get_light(theta, phi) * samples[i].coeffs[n];
+		// For each SH coefficient, the basis of the uniform samples has already been evaluated
+		if (importance_sampled) {
+			for (int n = 0; n < SH_MAX_COEFFICIENT_COUNT; n++) {
+				coefficients[n] += weighted_light * directions_basis[n * sample_count + s];
+			}
+		} else {
+			for (int n = 0; n < SH_MAX_COEFFICIENT_COUNT; n++) {
+				coefficients[n] += weighted_light * samples[s].coeffs[n];
+			}
 		}
 	}
 
-	// Divide the result by weight and number of samples
-	const float factor = weight / SAMPLE_COUNT;
-	for (int i = 0; i < SH_COEFFICIENT_COUNT; i++) {
-		coefficients[i] *= factor;
+	for (int n = 0; n < SH_MAX_COEFFICIENT_COUNT; n++) {
+		coefficients[n] *= factor;
 	}
-}
\ No newline at end of file
+
+	delete[] directions;
+	delete[] weights;
+	delete[] light;
+	delete[] directions_basis;
+}
+
+void AnalyticLight::init(const SH::Sample /*samples*/[], int /*sample_count*/) {
+	update();
+}
+
+void AnalyticLight::project_cap(const glm::vec3& direction, float cos_cap_angle, const glm::vec3& radiance) {
+	float cap_coeffs[SH_MAX_NUM_BANDS];
+	SH::calc_cap_coeffs(cos_cap_angle, cap_coeffs);
+
+	glm::vec3 zonal_coeffs[SH_MAX_NUM_BANDS];
+	for (int l = 0; l < SH_MAX_NUM_BANDS; l++) {
+		zonal_coeffs[l] = radiance * cap_coeffs[l];
+	}
+
+	SH::rotate_zonal(direction, zonal_coeffs, coefficients);
+}
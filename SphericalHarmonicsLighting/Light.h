@@ -3,28 +3,144 @@
 
 #include "SphericalHarmonics.h"
 
+struct ThreadPool; // Forward Declaration, defined in ThreadPool.h
+
 class Light {
 public:
-	glm::vec3 coefficients[SH_COEFFICIENT_COUNT];
+	glm::vec3 coefficients[SH_MAX_COEFFICIENT_COUNT];
+
+	virtual ~Light() { }
+
+	// Projects the Light into SH coefficients using Monte Carlo integration. The Light is evaluated once per sample, in a single batch.
+	// Lights that support importance sampling warp the samples towards the bright parts of the Light and weight them by their probability density,
+	// other Lights use the uniformly distributed sample directions directly
+	virtual void init(const SH::Sample samples[], int sample_count);
+
+	// Evaluates the Light for count directions of unit length
+	virtual void get_light(int count, const glm::vec3 directions[], glm::vec3 result[]) const = 0;
+
+	// Maps a point in the unit square to a direction that is distributed approximately proportional to the Light,
+	// and stores the probability density of that direction with respect to solid angle in pdf.
+	// Returns false if the Light does not support importance sampling
+	virtual bool sample(float u, float v, glm::vec3& direction, float& pdf) const;
+};
+
+// Light whose SH coefficients are computed in closed form, using zonal harmonics that are rotated towards the Light.
+// The result is exact and does not depend on samples, so the parameters of the Light can be changed every frame, after which update recomputes the coefficients.
+// Lights that have a position are seen from the origin of the Scene
+class AnalyticLight : public Light {
+protected:
+	// Sets the coefficients to those of a spherical cap of constant radiance around a direction of unit length
+	void project_cap(const glm::vec3& direction, float cos_cap_angle, const glm::vec3& radiance);
+
+public:
+	// Computes the coefficients using update, the samples are not needed
+	void init(const SH::Sample samples[], int sample_count);
+
+	// Recomputes the coefficients from the current parameters of the Light
+	virtual void update() = 0;
+};
+
+// Light that shines uniformly from a spherical cap (a cone of directions) around its direction.
+// A cap angle of zero gives an infinitely distant point light, for which color is the irradiance instead of the radiance.
+// Such a Light cannot be evaluated in a direction, get_light returns black for it
+class DirectionalLight : public AnalyticLight {
+public:
+	glm::vec3 direction = glm::vec3(0.0f, 0.0f, 1.0f); // Unit length
+	glm::vec3 color     = glm::vec3(1.0f, 1.0f, 1.0f);
+	float     cap_angle = PI / 6.0f; // Angle between the direction and the edge of the cap
 
-	void init(const SH::Sample samples[SAMPLE_COUNT]);
+	void update();
 
-	virtual glm::vec3 get_light(float theta, float phi) const = 0;
+	void get_light(int count, const glm::vec3 directions[], glm::vec3 result[]) const;
+
+	// Samples the cap uniformly, no samples are wasted outside of it
+	bool sample(float u, float v, glm::vec3& sample_direction, float& pdf) const;
 };
 
-class DirectionalLight : public Light {
+// Spherical Light with a constant radiance, it covers a spherical cap whose angle follows from its radius and distance
+class SphereLight : public AnalyticLight {
 public:
-	glm::vec3 get_light(float theta, float phi) const;
+	glm::vec3 position = glm::vec3(0.0f, 0.0f, 10.0f);
+	float     radius   = 1.0f;
+	glm::vec3 color    = glm::vec3(1.0f, 1.0f, 1.0f);
+
+	void update();
+
+	void get_light(int count, const glm::vec3 directions[], glm::vec3 result[]) const;
 };
 
+// Rectangular area Light with a constant radiance. It emits light from one side only, towards cross(axis_u, axis_v)
+class RectangleLight : public AnalyticLight {
+public:
+	glm::vec3 center = glm::vec3(0.0f, 0.0f, 10.0f);
+	glm::vec3 axis_u = glm::vec3(-2.0f, 0.0f, 0.0f); // Half of the edge, orthogonal to axis_v
+	glm::vec3 axis_v = glm::vec3( 0.0f, 2.0f, 0.0f); // Half of the other edge
+	glm::vec3 color  = glm::vec3(1.0f, 1.0f, 1.0f);
+
+	void update();
+
+	void get_light(int count, const glm::vec3 directions[], glm::vec3 result[]) const;
+};
+
+// Sky that fades linearly from the ground color straight down to the sky color straight up, which only needs the first two bands
+class SkyLight : public AnalyticLight {
+public:
+	glm::vec3 up           = glm::vec3(0.0f, 0.0f, 1.0f); // Unit length
+	glm::vec3 sky_color    = glm::vec3(0.6f, 0.8f, 1.0f);
+	glm::vec3 ground_color = glm::vec3(0.2f, 0.2f, 0.2f);
+
+	void update();
+
+	void get_light(int count, const glm::vec3 directions[], glm::vec3 result[]) const;
+};
+
+// Light defined by a light probe in angular map format
 class HDRProbeLight : public Light {
 private:
 	int         size;
 	glm::vec3 * data;
 
+	ThreadPool * thread_pool; // If not NULL, init integrates the SH basis over every pixel instead of using Monte Carlo integration
+
+	// Piecewise constant distribution over the pixels of the probe, proportional to their luminance times their solid angle.
+	// A pixel is chosen by first picking a row x using the marginal CDF, and then a pixel y within that row using the conditional CDF of the row
+	float * pixel_probabilities; // size * size, probability of every pixel, indexed the same way as data
+	float * marginal_cdf;        // size + 1
+	float * conditional_cdfs;    // size * (size + 1)
+
+	void init_distribution();
+
+	int get_pixel_index(const glm::vec3& direction) const;
+
 public:
-	HDRProbeLight(const char* filename, int size);
+	HDRProbeLight(const char* filename, int size, ThreadPool * thread_pool = NULL);
+	HDRProbeLight(int size, glm::vec3 * data, ThreadPool * thread_pool = NULL); // Takes ownership of data, which should contain size * size pixels
 	~HDRProbeLight();
 
-	glm::vec3 get_light(float theta, float phi) const;
+	// With a ThreadPool the probe is projected using LightProbe::project, which gives the exact coefficients of the pixels without using the samples.
+	// Otherwise the pixels are importance sampled by Light::init
+	void init(const SH::Sample samples[], int sample_count);
+
+	void get_light(int count, const glm::vec3 directions[], glm::vec3 result[]) const;
+
+	// Importance samples the pixels of the probe based on their luminance
+	bool sample(float u, float v, glm::vec3& direction, float& pdf) const;
+};
+
+// Light defined by a light probe file in any of the formats of LightProbe::Image, such as an 8K equirectangular map.
+// The coefficients are computed directly from the pixels by LightProbe::project, which streams the file from a memory mapping.
+// The pixels are not kept afterwards, so unlike HDRProbeLight this Light cannot be evaluated in a direction and get_light aborts
+class ProbeLight : public Light {
+private:
+	const char * filename;
+	ThreadPool & thread_pool;
+
+public:
+	ProbeLight(const char * filename, ThreadPool& thread_pool);
+
+	// Projects the probe, the samples are not needed
+	void init(const SH::Sample samples[], int sample_count);
+
+	void get_light(int count, const glm::vec3 directions[], glm::vec3 result[]) const;
 };
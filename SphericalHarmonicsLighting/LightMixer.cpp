@@ -0,0 +1,121 @@
+#include "LightMixer.h"
+
+#include <cstring>
+
+#include "Light.h"
+#include "SHRotation.h"
+#include "SIMD.h"
+#include "SIMDLanes.h"
+#include "ThreadPool.h"
+
+#include "Util.h"
+
+void LightMixer::init(int capacity) {
+	this->capacity = capacity;
+	light_count    = 0;
+	stride         = (capacity + LANES_PARTIAL_SUM_COUNT - 1) & ~(LANES_PARTIAL_SUM_COUNT - 1);
+
+	coeffs         = new float[3 * SH_MAX_COEFFICIENT_COUNT * stride];
+	coeffs_rotated = new float[3 * SH_MAX_COEFFICIENT_COUNT * stride];
+	rotations      = new glm::quat[stride];
+	intensities    = new float[3 * stride];
+
+	// The padding lanes are summed as well, they have to be zero
+	memset(coeffs,         0, 3 * SH_MAX_COEFFICIENT_COUNT * stride * sizeof(float));
+	memset(coeffs_rotated, 0, 3 * SH_MAX_COEFFICIENT_COUNT * stride * sizeof(float));
+	memset(intensities,    0, 3 * stride * sizeof(float));
+}
+
+void LightMixer::free() {
+	delete[] coeffs;
+	delete[] coeffs_rotated;
+	delete[] rotations;
+	delete[] intensities;
+}
+
+int LightMixer::add(const Light& light, const glm::quat& rotation, const glm::vec3& intensity) {
+	assert(light_count < capacity);
+
+	int index = light_count++;
+
+	set_coefficients(index, light.coefficients);
+	set_rotation    (index, rotation);
+	set_intensity   (index, intensity);
+
+	return index;
+}
+
+void LightMixer::remove(int index) {
+	assert(index >= 0 && index < light_count);
+
+	int last = --light_count;
+
+	if (index != last) {
+		for (int row = 0; row < 3 * SH_MAX_COEFFICIENT_COUNT; row++) {
+			coeffs[row * stride + index] = coeffs[row * stride + last];
+		}
+
+		rotations[index] = rotations[last];
+
+		for (int c = 0; c < 3; c++) {
+			intensities[c * stride + index] = intensities[c * stride + last];
+		}
+	}
+
+	// The rotated coefficients of the last lane are no longer written by SH::rotate, a zero intensity keeps them out of the sum
+	for (int c = 0; c < 3; c++) {
+		intensities[c * stride + last] = 0.0f;
+	}
+}
+
+void LightMixer::set_coefficients(int index, const glm::vec3 coefficients[]) {
+	assert(index >= 0 && index < light_count);
+
+	for (int k = 0; k < SH_MAX_COEFFICIENT_COUNT; k++) {
+		for (int c = 0; c < 3; c++) {
+			coeffs[(3*k + c) * stride + index] = coefficients[k][c];
+		}
+	}
+}
+
+void LightMixer::set_rotation(int index, const glm::quat& rotation) {
+	assert(index >= 0 && index < light_count);
+
+	rotations[index] = rotation;
+}
+
+void LightMixer::set_intensity(int index, const glm::vec3& intensity) {
+	assert(index >= 0 && index < light_count);
+
+	for (int c = 0; c < 3; c++) {
+		intensities[c * stride + index] = intensity[c];
+	}
+}
+
+// Sums the first row_count rows of the rotated coefficients, every row weighted by the intensities of its color channel.
+// light_count is a multiple of LANES_PARTIAL_SUM_COUNT
+template<typename Lanes>
+static void sum_rows(int row_count, int light_count, int stride, const float coeffs_rotated[], const float intensities[], float result[]) {
+	for (int row = 0; row < row_count; row++) {
+		result[row] = dot<Lanes>(light_count, coeffs_rotated + row * stride, intensities + (row % 3) * stride);
+	}
+}
+
+void LightMixer::mix(ThreadPool& thread_pool, glm::vec3 result[], int num_bands) {
+	const int coefficient_count = SH::get_coefficient_count(num_bands);
+
+	SH::rotate(thread_pool, light_count, rotations, coeffs, coeffs_rotated, stride, num_bands);
+
+	// The padding up to a multiple of LANES_PARTIAL_SUM_COUNT is summed as well, its intensities are zero
+	int padded_light_count = (light_count + LANES_PARTIAL_SUM_COUNT - 1) & ~(LANES_PARTIAL_SUM_COUNT - 1);
+
+	float * result_floats = &result[0].x;
+
+	switch (SIMD::get_level()) {
+		case SIMD::Level::SCALAR: sum_rows<LanesScalar>(3 * coefficient_count, padded_light_count, stride, coeffs_rotated, intensities, result_floats); break;
+		case SIMD::Level::SSE:    sum_rows<LanesSSE>   (3 * coefficient_count, padded_light_count, stride, coeffs_rotated, intensities, result_floats); break;
+		case SIMD::Level::AVX2:   sum_rows<LanesAVX2>  (3 * coefficient_count, padded_light_count, stride, coeffs_rotated, intensities, result_floats); break;
+
+		default: abort();
+	}
+}
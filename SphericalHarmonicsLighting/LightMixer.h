@@ -0,0 +1,43 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "SphericalHarmonics.h"
+
+class Light;        // Forward Declaration, defined in Light.h
+struct ThreadPool;  // Forward Declaration, defined in ThreadPool.h
+
+// Combines the SH coefficients of many Lights into a single set of coefficients, which can be uploaded to the Shaders once per frame.
+// Every Light has its own rotation and intensity. The coefficients are stored in Structure of Arrays layout so that they can be rotated using the batch SH::rotate,
+// after which the rotated Lights are scaled by their intensities and summed using SIMD. All memory is allocated by init, mixing does not allocate
+struct LightMixer {
+	int capacity;
+	int light_count;
+	int stride; // capacity rounded up to a multiple of LANES_PARTIAL_SUM_COUNT, the lanes after light_count have an intensity of zero
+
+	// Channel c of coefficient k of Light i is found at coeffs[(3*k + c) * stride + i]
+	float * coeffs;
+	float * coeffs_rotated;
+
+	glm::quat * rotations;
+	float     * intensities; // Channel c of the intensity of Light i is found at intensities[c * stride + i]
+
+	void init(int capacity);
+	void free();
+
+	// Adds a Light using its current coefficients, returns the index of the Light in the mixer
+	int add(const Light& light, const glm::quat& rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f), const glm::vec3& intensity = glm::vec3(1.0f));
+
+	// Removes a Light by moving the last Light into its place, which changes the index of the last Light to index
+	void remove(int index);
+
+	// Copies new coefficients for a Light, for example after an AnalyticLight has been updated
+	void set_coefficients(int index, const glm::vec3 coefficients[]);
+
+	void set_rotation (int index, const glm::quat& rotation);
+	void set_intensity(int index, const glm::vec3& intensity);
+
+	// Rotates every Light by its rotation, scales it by its intensity, and writes the sum to get_coefficient_count(num_bands) coefficients.
+	// The SIMD kernel is selected at runtime based on SIMD::get_level(), all kernels produce identical results
+	void mix(ThreadPool& thread_pool, glm::vec3 result[], int num_bands = SH_MAX_NUM_BANDS);
+};
@@ -0,0 +1,766 @@
+#include "LightProbe.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "ScopedTimer.h"
+#include "SHRotation.h"
+#include "SIMD.h"
+#include "SIMDLanes.h"
+#include "ThreadPool.h"
+#include "StringHelper.h"
+
+bool MappedFile::open(const char * filename) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL) {
+		CloseHandle(file);
+		return false;
+	}
+
+	const void * view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == NULL) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	data = reinterpret_cast<const u8 *>(view);
+	size = size_t(file_size.QuadPart);
+
+	file_handle    = file;
+	mapping_handle = mapping;
+#else
+	int file = ::open(filename, O_RDONLY);
+	if (file < 0) return false;
+
+	struct stat file_status;
+	if (fstat(file, &file_status) != 0 || file_status.st_size == 0) {
+		::close(file);
+		return false;
+	}
+
+	void * view = mmap(NULL, size_t(file_status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+	if (view == MAP_FAILED) {
+		::close(file);
+		return false;
+	}
+
+	data = reinterpret_cast<const u8 *>(view);
+	size = size_t(file_status.st_size);
+
+	file_handle    = reinterpret_cast<void *>(intptr_t(file));
+	mapping_handle = NULL;
+#endif
+
+	return true;
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+	CloseHandle(mapping_handle);
+	CloseHandle(file_handle);
+#else
+	munmap(const_cast<u8 *>(data), size);
+	::close(int(intptr_t(file_handle)));
+#endif
+
+	data = NULL;
+	size = 0;
+}
+
+// Prints the reason a light probe could not be loaded and aborts
+static void invalid_probe(const char * filename, const char * reason) {
+	printf("Error loading light probe '%s': %s\n", filename, reason);
+	abort();
+}
+
+// Reads the next whitespace separated token of a text header, returns false if the end of the header was reached first
+static bool next_token(const char *& cursor, const char * end, char token[], int max_length) {
+	while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r' || *cursor == '\n')) cursor++;
+
+	int length = 0;
+	while (cursor < end && !(*cursor == ' ' || *cursor == '\t' || *cursor == '\r' || *cursor == '\n')) {
+		if (length == max_length - 1) return false;
+
+		token[length++] = *cursor++;
+	}
+	token[length] = '\0';
+
+	return length > 0;
+}
+
+// Reads the next line of a text header without its line ending, returns false if the end of the file was reached first
+static bool next_line(const char *& cursor, const char * end, char line[], int max_length) {
+	int length = 0;
+	while (cursor < end && *cursor != '\n') {
+		if (length < max_length - 1) line[length++] = *cursor;
+		cursor++;
+	}
+	line[length] = '\0';
+
+	if (cursor == end) return false;
+
+	cursor++; // Skip the line ending
+
+	return true;
+}
+
+// Walks over one channel of a run length encoded RGBE scanline, calling callback(pixel, value) for every pixel.
+// A count above 128 repeats the next byte count - 128 times, other counts are followed by that many literal bytes.
+// Returns the end of the channel, or NULL if the data is invalid
+template<typename Callback>
+static const u8 * decode_channel(const u8 * cursor, const u8 * end, int width, Callback callback) {
+	int pixel = 0;
+
+	while (pixel < width) {
+		if (cursor >= end) return NULL;
+
+		int count = *cursor++;
+
+		if (count > 128) {
+			count -= 128;
+			if (count > width - pixel || cursor >= end) return NULL;
+
+			u8 value = *cursor++;
+			for (int i = 0; i < count; i++) callback(pixel++, value);
+		} else {
+			if (count == 0 || count > width - pixel || cursor + count > end) return NULL;
+
+			for (int i = 0; i < count; i++) callback(pixel++, *cursor++);
+		}
+	}
+
+	return cursor;
+}
+
+// Scanlines of RGBE images use run length encoding if their width is in this range and they start with this marker
+static bool is_run_length_encoded(const u8 * scanline, const u8 * end, int width) {
+	return width >= 8 && width <= 0x7fff && end - scanline >= 4 &&
+		scanline[0] == 2 && scanline[1] == 2 && ((scanline[2] << 8) | scanline[3]) == width;
+}
+
+void LightProbe::Image::open(const char * filename) {
+	// Determine the format from the extension
+	int extension_index = StringHelper::last_index_of(".", filename);
+	if (extension_index == -1) invalid_probe(filename, "no file extension");
+
+	char extension[16];
+	if (strlen(filename + extension_index) >= sizeof(extension)) invalid_probe(filename, "unsupported file extension, expected .float, .pfm or .hdr");
+
+	strcpy_s(extension, sizeof(extension), filename + extension_index);
+	StringHelper::to_lower(extension);
+
+	if (strcmp(extension, ".float") == 0) {
+		format = Format::FLOAT;
+		layout = Layout::ANGULAR;
+	} else if (strcmp(extension, ".pfm") == 0) {
+		format = Format::PFM;
+		layout = Layout::EQUIRECTANGULAR;
+	} else if (strcmp(extension, ".hdr") == 0) {
+		format = Format::HDR;
+		layout = Layout::EQUIRECTANGULAR;
+	} else {
+		invalid_probe(filename, "unsupported file extension, expected .float, .pfm or .hdr");
+	}
+
+	if (!file.open(filename)) invalid_probe(filename, "unable to open or map the file");
+
+	const char * header     = reinterpret_cast<const char *>(file.data);
+	const char * header_end = header + file.size;
+
+	switch (format) {
+		case Format::FLOAT: {
+			// No header, the size follows from the size of the file
+			size_t pixel_count = file.size / sizeof(glm::vec3);
+
+			width  = int(sqrt(double(pixel_count)));
+			height = width;
+
+			if (size_t(width) * size_t(height) * sizeof(glm::vec3) != file.size) invalid_probe(filename, "the file does not contain a square image");
+
+			pixels = file.data;
+
+			break;
+		}
+
+		case Format::PFM: {
+			char token[64];
+
+			if (!next_token(header, header_end, token, sizeof(token))) invalid_probe(filename, "missing header");
+
+			if      (strcmp(token, "PF") == 0) channels = 3;
+			else if (strcmp(token, "Pf") == 0) channels = 1;
+			else invalid_probe(filename, "invalid PFM identifier");
+
+			if (!next_token(header, header_end, token, sizeof(token))) invalid_probe(filename, "missing width");
+			width = atoi(token);
+
+			if (!next_token(header, header_end, token, sizeof(token))) invalid_probe(filename, "missing height");
+			height = atoi(token);
+
+			// A negative scale means the floats are little endian
+			if (!next_token(header, header_end, token, sizeof(token))) invalid_probe(filename, "missing scale");
+			big_endian = atof(token) > 0.0;
+
+			// The pixels start after a single whitespace character
+			pixels = reinterpret_cast<const u8 *>(header + 1);
+
+			if (width <= 0 || height <= 0 || pixels + size_t(width) * size_t(height) * channels * sizeof(float) > file.data + file.size) {
+				invalid_probe(filename, "the image is empty or the file is truncated");
+			}
+
+			break;
+		}
+
+		case Format::HDR: {
+			char line[256];
+
+			if (!next_line(header, header_end, line, sizeof(line)) || !StringHelper::starts_with(line, "#?")) invalid_probe(filename, "missing Radiance header");
+
+			// Header variables end at an empty line
+			while (true) {
+				if (!next_line(header, header_end, line, sizeof(line))) invalid_probe(filename, "unterminated header");
+
+				if (line[0] == '\0' || (line[0] == '\r' && line[1] == '\0')) break;
+
+				if (StringHelper::starts_with(line, "FORMAT=") && !StringHelper::starts_with(line, "FORMAT=32-bit_rle_rgbe")) {
+					invalid_probe(filename, "only the 32-bit_rle_rgbe format is supported");
+				}
+			}
+
+			// Only the standard orientation is supported, where the image is stored left to right, either top to bottom (-Y) or bottom to top (+Y)
+			if (!next_line(header, header_end, line, sizeof(line))) invalid_probe(filename, "missing resolution");
+
+			const char * resolution     = line;
+			const char * resolution_end = line + strlen(line);
+
+			char y_axis[16], height_token[16], x_axis[16], width_token[16];
+			if (!next_token(resolution, resolution_end, y_axis,       sizeof(y_axis))       ||
+				!next_token(resolution, resolution_end, height_token, sizeof(height_token)) ||
+				!next_token(resolution, resolution_end, x_axis,       sizeof(x_axis))       ||
+				!next_token(resolution, resolution_end, width_token,  sizeof(width_token))) {
+				invalid_probe(filename, "invalid resolution string");
+			}
+
+			height = atoi(height_token);
+			width  = atoi(width_token);
+
+			if ((strcmp(y_axis, "-Y") != 0 && strcmp(y_axis, "+Y") != 0) || strcmp(x_axis, "+X") != 0 || width <= 0 || height <= 0) {
+				invalid_probe(filename, "unsupported resolution string");
+			}
+
+			bool bottom_to_top = strcmp(y_axis, "+Y") == 0;
+
+			pixels = reinterpret_cast<const u8 *>(header);
+
+			// Run length encoded scanlines have a variable size, so the start of every channel of every scanline is found up front.
+			// This only walks over the run lengths, the pixels themselves are decoded by read_row
+			scanlines.resize(4 * height);
+
+			const u8 * cursor = pixels;
+			const u8 * end    = file.data + file.size;
+
+			for (int i = 0; i < height; i++) {
+				const u8 ** scanline_channels = &scanlines[4 * (bottom_to_top ? height - 1 - i : i)];
+
+				if (is_run_length_encoded(cursor, end, width)) {
+					cursor += 4;
+
+					for (int c = 0; c < 4; c++) {
+						scanline_channels[c] = cursor;
+
+						cursor = decode_channel(cursor, end, width, [](int /*pixel*/, u8 /*value*/) { });
+						if (cursor == NULL) invalid_probe(filename, "invalid run length encoding");
+					}
+				} else {
+					// Flat scanline of RGBE pixels, old style run length encoding is not supported
+					if (end - cursor < 4 * width) invalid_probe(filename, "the file is truncated");
+
+					scanline_channels[0] = cursor;
+					scanline_channels[1] = NULL;
+					scanline_channels[2] = NULL;
+					scanline_channels[3] = NULL;
+
+					cursor += 4 * width;
+				}
+			}
+
+			break;
+		}
+
+		default: abort();
+	}
+}
+
+void LightProbe::Image::close() {
+	file.close();
+
+	scanlines.clear();
+	scanlines.shrink_to_fit();
+}
+
+// RGBE pixels share an exponent between the channels, zero is black
+static float get_rgbe_scale(u8 exponent) {
+	return exponent > 0 ? ldexp(1.0f, int(exponent) - (128 + 8)) : 0.0f;
+}
+
+void LightProbe::Image::read_row(int row, glm::vec3 result[]) const {
+	assert(row >= 0 && row < height);
+
+	switch (format) {
+		case Format::FLOAT: {
+			memcpy(result, pixels + size_t(row) * width * sizeof(glm::vec3), width * sizeof(glm::vec3));
+
+			break;
+		}
+
+		case Format::PFM: {
+			// Rows are stored bottom to top
+			const u8 * source = pixels + size_t(height - 1 - row) * width * channels * sizeof(float);
+
+			for (int i = 0; i < width; i++) {
+				float values[3];
+
+				for (int c = 0; c < channels; c++) {
+					u8 bytes[4];
+					memcpy(bytes, source + (i * channels + c) * sizeof(float), sizeof(float));
+
+					if (big_endian) {
+						u8 swapped[4] = { bytes[3], bytes[2], bytes[1], bytes[0] };
+						memcpy(bytes, swapped, sizeof(float));
+					}
+
+					memcpy(&values[c], bytes, sizeof(float));
+				}
+
+				result[i] = channels == 3 ? glm::vec3(values[0], values[1], values[2]) : glm::vec3(values[0]);
+			}
+
+			break;
+		}
+
+		case Format::HDR: {
+			const u8 * const * scanline_channels = &scanlines[4 * row];
+			const u8 *         end               = file.data + file.size;
+
+			if (scanline_channels[1] == NULL) {
+				for (int i = 0; i < width; i++) {
+					const u8 * rgbe = scanline_channels[0] + 4 * i;
+
+					float scale = get_rgbe_scale(rgbe[3]);
+					result[i] = glm::vec3((rgbe[0] + 0.5f) * scale, (rgbe[1] + 0.5f) * scale, (rgbe[2] + 0.5f) * scale);
+				}
+			} else {
+				// The channels are decoded one at a time without a temporary buffer: the scale from the exponent is stored in the red channel,
+				// which is multiplied into the blue and green channels before the red channel itself is decoded
+				decode_channel(scanline_channels[3], end, width, [result](int pixel, u8 value) { result[pixel].r = get_rgbe_scale(value); });
+				decode_channel(scanline_channels[2], end, width, [result](int pixel, u8 value) { result[pixel].b = (value + 0.5f) * result[pixel].r; });
+				decode_channel(scanline_channels[1], end, width, [result](int pixel, u8 value) { result[pixel].g = (value + 0.5f) * result[pixel].r; });
+				decode_channel(scanline_channels[0], end, width, [result](int pixel, u8 value) { result[pixel].r = (value + 0.5f) * result[pixel].r; });
+			}
+
+			break;
+		}
+
+		default: abort();
+	}
+}
+
+void LightProbe::project(const char * filename, ThreadPool& thread_pool, glm::vec3 result[], int num_bands) {
+	Image image;
+	image.open(filename);
+
+	project(image, thread_pool, result, num_bands);
+
+	image.close();
+}
+
+// Gauss-Legendre quadrature on [-1, 1], used to integrate the SH basis over the area of a single pixel.
+// Three points are exact for polynomials up to degree five, the basis functions vary slowly enough within a pixel that the error is negligible
+#define QUADRATURE_ORDER 3
+
+static const double quadrature_nodes  [QUADRATURE_ORDER] = { -0.774596669241483377, 0.0, 0.774596669241483377 };
+static const double quadrature_weights[QUADRATURE_ORDER] = { 5.0 / 9.0, 8.0 / 9.0, 5.0 / 9.0 };
+
+// Integrals of the SH basis over every pixel of a light probe, these only depend on the layout and size of the probe and are computed once
+struct ProjectionTable {
+	LightProbe::Layout layout;
+	int width;
+	int height;
+	int num_bands;
+
+	int padded_width;
+
+	// The basis functions of an equirectangular map are separable when the y axis is used as the polar axis,
+	// so the integral over a pixel is the integral of the part that depends on theta over its row times the integral of the part that depends on phi over its column
+	Array<float> row_integrals;    // height * coefficient_count, the integral of N_lm P_lm(cos(theta)) sin(theta) over the latitudes of every row
+	Array<float> column_integrals; // (2 * num_bands - 1) * padded_width, the integral of cos(m phi), 1 or sin(|m| phi) over every column, indexed by m + num_bands - 1
+
+	// Angular maps store the integral of every basis function over every pixel, row by row in Structure of Arrays layout.
+	// Empty if the table would take more than PROBE_TABLE_MAX_CACHED_BYTES, every row is then integrated when it is projected
+	Array<float> pixel_integrals;
+};
+
+// Scratch memory used to integrate a row of an angular map
+struct QuadratureBuffers {
+	Array<float> directions_x;
+	Array<float> directions_y;
+	Array<float> directions_z;
+	Array<float> weights;
+
+	Array<float> basis; // SH basis in Structure of Arrays layout
+
+	void init(int padded_width, int num_bands) {
+		const int point_count = QUADRATURE_ORDER * QUADRATURE_ORDER * padded_width;
+
+		directions_x.resize(point_count);
+		directions_y.resize(point_count);
+		directions_z.resize(point_count);
+		weights     .resize(point_count);
+
+		basis.resize(SH::get_coefficient_count(num_bands) * point_count);
+	}
+};
+
+// Integrates the SH basis over every pixel of a row of an angular map, the integral of basis function k over pixel i is stored in result[k * padded_width + i].
+// Every pixel is integrated using a grid of quadrature points, weighted by the ratio between solid angle and map area PI * sin(PI * r) / r.
+// Points outside of the disk that contains the probe, as well as the padding after the width of the map, have a weight of zero
+static void integrate_angular_row(int width, int row, int padded_width, int num_bands, QuadratureBuffers& buffers, float result[]) {
+	const int coefficient_count = SH::get_coefficient_count(num_bands);
+	const int point_count       = QUADRATURE_ORDER * QUADRATURE_ORDER * padded_width;
+
+	// The map spans [-1, 1] in both directions
+	const double half_pixel_size = 1.0 / double(width);
+
+	for (int a = 0; a < QUADRATURE_ORDER; a++) {
+		double u = (double(row) + 0.5) * 2.0 * half_pixel_size - 1.0 + half_pixel_size * quadrature_nodes[a];
+
+		for (int b = 0; b < QUADRATURE_ORDER; b++) {
+			const int offset = (a * QUADRATURE_ORDER + b) * padded_width;
+
+			const double weight = half_pixel_size * half_pixel_size * quadrature_weights[a] * quadrature_weights[b];
+
+			for (int i = 0; i < padded_width; i++) {
+				double v = (double(i) + 0.5) * 2.0 * half_pixel_size - 1.0 + half_pixel_size * quadrature_nodes[b];
+				double r = sqrt(u*u + v*v);
+
+				if (i >= width || r >= 1.0) {
+					buffers.directions_x[offset + i] = 0.0f;
+					buffers.directions_y[offset + i] = 0.0f;
+					buffers.directions_z[offset + i] = 1.0f;
+					buffers.weights     [offset + i] = 0.0f;
+
+					continue;
+				}
+
+				// The direction at angle theta = PI * r from the z axis, the cosine and sine of phi are u / r and v / r
+				double sin_theta = sin(PI * r);
+				double cos_theta = cos(PI * r);
+
+				double sin_theta_over_r = r > 0.0 ? sin_theta / r : PI;
+
+				buffers.directions_x[offset + i] = float(u * sin_theta_over_r);
+				buffers.directions_y[offset + i] = float(v * sin_theta_over_r);
+				buffers.directions_z[offset + i] = float(cos_theta);
+				buffers.weights     [offset + i] = float(weight * PI * sin_theta_over_r);
+			}
+		}
+	}
+
+	SH::evaluate(point_count, buffers.directions_x.data(), buffers.directions_y.data(), buffers.directions_z.data(), buffers.basis.data(), point_count, num_bands);
+
+	for (int k = 0; k < coefficient_count; k++) {
+		const float * basis = buffers.basis.data() + k * point_count;
+
+		for (int i = 0; i < padded_width; i++) {
+			float sum = 0.0f;
+
+			for (int q = 0; q < QUADRATURE_ORDER * QUADRATURE_ORDER; q++) {
+				sum += buffers.weights[q * padded_width + i] * basis[q * padded_width + i];
+			}
+
+			result[k * padded_width + i] = sum;
+		}
+	}
+}
+
+static void init_equirectangular_table(ProjectionTable& table) {
+	const int num_bands         = table.num_bands;
+	const int coefficient_count = SH::get_coefficient_count(num_bands);
+
+	// Rows, the part of a basis function that depends on theta is the basis function itself evaluated at phi = 0 for m >= 0.
+	// Basis functions with m < 0 share it with the one for |m|
+	table.row_integrals.resize(table.height * coefficient_count);
+
+	for (int row = 0; row < table.height; row++) {
+		double theta_0 = PI * double(row)     / double(table.height);
+		double theta_1 = PI * double(row + 1) / double(table.height);
+
+		double half_size = 0.5 * (theta_1 - theta_0);
+		double center    = 0.5 * (theta_1 + theta_0);
+
+		double integrals[SH_MAX_COEFFICIENT_COUNT] = { };
+
+		for (int q = 0; q < QUADRATURE_ORDER; q++) {
+			double theta  = center + half_size * quadrature_nodes[q];
+			double weight = half_size * quadrature_weights[q] * sin(theta);
+
+			for (int l = 0; l < num_bands; l++) {
+				for (int m = -l; m <= l; m++) {
+					integrals[l*(l + 1) + m] += weight * SH::evaluate(l, abs(m), float(theta), 0.0f);
+				}
+			}
+		}
+
+		for (int k = 0; k < coefficient_count; k++) {
+			table.row_integrals[row * coefficient_count + k] = float(integrals[k]);
+		}
+	}
+
+	// Columns, integrated in closed form. The padding after the width of the map is zero
+	const int m_count = 2 * num_bands - 1;
+
+	table.column_integrals.resize(m_count * table.padded_width, 0.0f);
+
+	for (int i = 0; i < table.width; i++) {
+		double phi_0 = 2.0 * PI * (double(i)     / double(table.width) - 0.5);
+		double phi_1 = 2.0 * PI * (double(i + 1) / double(table.width) - 0.5);
+
+		for (int m = -(num_bands - 1); m < num_bands; m++) {
+			double integral;
+
+			if (m == 0) {
+				integral = phi_1 - phi_0;
+			} else if (m > 0) {
+				integral = (sin(m * phi_1) - sin(m * phi_0)) / double(m);
+			} else {
+				integral = (cos(-m * phi_0) - cos(-m * phi_1)) / double(-m);
+			}
+
+			table.column_integrals[(m + num_bands - 1) * table.padded_width + i] = float(integral);
+		}
+	}
+}
+
+static std::mutex               cached_tables_mutex;
+static Array<ProjectionTable *> cached_tables;
+
+// Returns the table for the given layout, size and number of bands, the table is computed on first use and cached until LightProbe::free_tables
+static const ProjectionTable& get_table(LightProbe::Layout layout, int width, int height, int num_bands, ThreadPool& thread_pool) {
+	std::lock_guard<std::mutex> lock(cached_tables_mutex);
+
+	for (const ProjectionTable * table : cached_tables) {
+		if (table->layout == layout && table->width == width && table->height == height && table->num_bands == num_bands) return *table;
+	}
+
+	ScopedTimer timer("LightProbe - Projection table");
+
+	ProjectionTable * table = new ProjectionTable();
+	table->layout    = layout;
+	table->width     = width;
+	table->height    = height;
+	table->num_bands = num_bands;
+
+	table->padded_width = (width + LANES_PARTIAL_SUM_COUNT - 1) & ~(LANES_PARTIAL_SUM_COUNT - 1);
+
+	if (layout == LightProbe::Layout::EQUIRECTANGULAR) {
+		init_equirectangular_table(*table);
+	} else {
+		const size_t row_size = size_t(SH::get_coefficient_count(num_bands)) * size_t(table->padded_width);
+
+		if (height * row_size * sizeof(float) <= PROBE_TABLE_MAX_CACHED_BYTES) {
+			table->pixel_integrals.resize(height * row_size);
+
+			Array<QuadratureBuffers> buffers(thread_pool.get_thread_count());
+
+			for (int t = 0; t < thread_pool.get_thread_count(); t++) {
+				buffers[t].init(table->padded_width, num_bands);
+			}
+
+			thread_pool.parallel_for(height, 1, [&](int row, int thread_index) {
+				integrate_angular_row(width, row, table->padded_width, num_bands, buffers[thread_index], &table->pixel_integrals[row * row_size]);
+			});
+		}
+	}
+
+	cached_tables.push_back(table);
+
+	return *table;
+}
+
+void LightProbe::free_tables() {
+	std::lock_guard<std::mutex> lock(cached_tables_mutex);
+
+	for (ProjectionTable * table : cached_tables) {
+		delete table;
+	}
+
+	cached_tables.clear();
+}
+
+// Scratch memory of a single thread, so that no memory is allocated per row
+struct RowBuffers {
+	Array<glm::vec3> pixels;
+	Array<float>     channels[3]; // Every color channel of the pixels, padded with zeros
+
+	Array<float> column_sums; // Equirectangular only, the dot products of every color channel with the column integrals
+
+	Array<float>      pixel_integrals; // Angular only, used if the table does not store the integrals
+	QuadratureBuffers quadrature;
+};
+
+// Projects a light probe row by row, read_row(row, result) writes the width pixels of a row to result.
+// The pixels are multiplied by the integrals of the SH basis over their area from the ProjectionTable, so the result is the exact projection
+// of the piecewise constant function defined by the pixels. Equirectangular maps are first projected with the y axis as the polar axis and rotated afterwards
+template<typename ReadRow>
+static void project_rows(LightProbe::Layout layout, int width, int height, ReadRow read_row, ThreadPool& thread_pool, glm::vec3 result[], int num_bands) {
+	const ProjectionTable& table = get_table(layout, width, height, num_bands, thread_pool);
+
+	const int coefficient_count = SH::get_coefficient_count(num_bands);
+	const int m_count           = 2 * num_bands - 1;
+
+	const int padded_width = table.padded_width;
+	const int tile_count   = (height + PROBE_TILE_ROWS - 1) / PROBE_TILE_ROWS;
+
+	Array<RowBuffers> buffers(thread_pool.get_thread_count());
+
+	for (int t = 0; t < thread_pool.get_thread_count(); t++) {
+		buffers[t].pixels.resize(width);
+
+		for (int c = 0; c < 3; c++) {
+			buffers[t].channels[c].resize(padded_width, 0.0f);
+		}
+
+		if (layout == LightProbe::Layout::EQUIRECTANGULAR) {
+			buffers[t].column_sums.resize(3 * m_count);
+		} else if (table.pixel_integrals.empty()) {
+			buffers[t].pixel_integrals.resize(coefficient_count * padded_width);
+			buffers[t].quadrature.init(padded_width, num_bands);
+		}
+	}
+
+	// The dot products of the rows use the same kernel for every row, all kernels produce identical results
+	float (* dot_kernel)(int count, const float a[], const float b[]);
+
+	switch (SIMD::get_level()) {
+		case SIMD::Level::SCALAR: dot_kernel = dot<LanesScalar>; break;
+		case SIMD::Level::SSE:    dot_kernel = dot<LanesSSE>;    break;
+		case SIMD::Level::AVX2:   dot_kernel = dot<LanesAVX2>;   break;
+
+		default: abort();
+	}
+
+	// Every tile has its own sums, which are added up in order afterwards. This way the result does not depend on which thread projected which tile
+	Array<glm::dvec3> tile_sums(tile_count * coefficient_count, glm::dvec3(0.0));
+
+	thread_pool.parallel_for(tile_count, 1, [&](int tile, int thread_index) {
+		RowBuffers & row_buffers = buffers[thread_index];
+		glm::dvec3 * sums        = &tile_sums[tile * coefficient_count];
+
+		int row_end = std::min((tile + 1) * PROBE_TILE_ROWS, height);
+
+		for (int row = tile * PROBE_TILE_ROWS; row < row_end; row++) {
+			read_row(row, row_buffers.pixels.data());
+
+			for (int i = 0; i < width; i++) {
+				for (int c = 0; c < 3; c++) {
+					row_buffers.channels[c][i] = row_buffers.pixels[i][c];
+				}
+			}
+
+			if (layout == LightProbe::Layout::EQUIRECTANGULAR) {
+				// Only 2 * num_bands - 1 dot products per color channel, all bands share the part that depends on phi
+				for (int c = 0; c < 3; c++) {
+					for (int j = 0; j < m_count; j++) {
+						row_buffers.column_sums[c * m_count + j] = dot_kernel(padded_width, row_buffers.channels[c].data(), &table.column_integrals[j * padded_width]);
+					}
+				}
+
+				const float * row_integrals = &table.row_integrals[row * coefficient_count];
+
+				for (int l = 0; l < num_bands; l++) {
+					for (int m = -l; m <= l; m++) {
+						const int k = l*(l + 1) + m;
+
+						for (int c = 0; c < 3; c++) {
+							sums[k][c] += double(row_integrals[k] * row_buffers.column_sums[c * m_count + m + num_bands - 1]);
+						}
+					}
+				}
+			} else {
+				const float * pixel_integrals;
+
+				if (table.pixel_integrals.empty()) {
+					integrate_angular_row(width, row, padded_width, num_bands, row_buffers.quadrature, row_buffers.pixel_integrals.data());
+
+					pixel_integrals = row_buffers.pixel_integrals.data();
+				} else {
+					pixel_integrals = &table.pixel_integrals[size_t(row) * size_t(coefficient_count * padded_width)];
+				}
+
+				for (int k = 0; k < coefficient_count; k++) {
+					for (int c = 0; c < 3; c++) {
+						sums[k][c] += dot_kernel(padded_width, row_buffers.channels[c].data(), pixel_integrals + k * padded_width);
+					}
+				}
+			}
+		}
+	});
+
+	for (int k = 0; k < coefficient_count; k++) {
+		glm::dvec3 sum = glm::dvec3(0.0);
+
+		for (int tile = 0; tile < tile_count; tile++) {
+			sum += tile_sums[tile * coefficient_count + k];
+		}
+
+		result[k] = glm::vec3(sum);
+	}
+
+	// The polar axis z of the equirectangular table is the y axis of the map, and its x and y axes are the z and x axes of the map
+	if (layout == LightProbe::Layout::EQUIRECTANGULAR) {
+		glm::vec3 coeffs[SH_MAX_COEFFICIENT_COUNT];
+		memcpy(coeffs, result, coefficient_count * sizeof(glm::vec3));
+
+		glm::quat rotation = glm::quat_cast(glm::mat3(glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+
+		SH::rotate(rotation, coeffs, result, num_bands);
+	}
+}
+
+void LightProbe::project(const Image& image, ThreadPool& thread_pool, glm::vec3 result[], int num_bands) {
+	project_rows(image.layout, image.width, image.height, [&image](int row, glm::vec3 pixels[]) {
+		image.read_row(row, pixels);
+	}, thread_pool, result, num_bands);
+}
+
+void LightProbe::project(Layout layout, int width, int height, const glm::vec3 pixels[], ThreadPool& thread_pool, glm::vec3 result[], int num_bands) {
+	project_rows(layout, width, height, [pixels, width](int row, glm::vec3 result[]) {
+		memcpy(result, pixels + size_t(row) * size_t(width), width * sizeof(glm::vec3));
+	}, thread_pool, result, num_bands);
+}
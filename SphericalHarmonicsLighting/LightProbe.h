@@ -0,0 +1,84 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include "SphericalHarmonics.h"
+#include "Types.h"
+#include "Util.h"
+
+struct ThreadPool; // Forward Declaration, defined in ThreadPool.h
+
+// Number of consecutive rows of a light probe that are projected by a thread at once
+#define PROBE_TILE_ROWS 16
+
+// Angular maps cache the integral of every SH basis function over every pixel up to this size, larger maps integrate their pixels again on every projection
+#define PROBE_TABLE_MAX_CACHED_BYTES (256 * 1024 * 1024)
+
+// Read only view of a whole file that is memory mapped instead of read into memory,
+// the operating system pages the file in as it is accessed and can drop the pages again at any time
+struct MappedFile {
+	const u8 * data;
+	size_t     size;
+
+	void * file_handle;
+	void * mapping_handle;
+
+	// Returns false if the file could not be opened or mapped
+	bool open(const char * filename);
+	void close();
+};
+
+namespace LightProbe {
+	// How the directions of the sphere are laid out in the image of a light probe
+	enum class Layout {
+		ANGULAR,        // Angular map, a direction at angle theta from the z axis is found at distance theta / PI from the center of the image
+		EQUIRECTANGULAR // Latitude-longitude map, the top row is the +y axis and the center of the image looks along the z axis
+	};
+
+	enum class Format {
+		FLOAT, // Headerless 32 bit float RGB angular map, the extension is .float and the image is square
+		PFM,   // Portable Float Map, 32 bit float RGB or grayscale equirectangular map, stored bottom to top
+		HDR    // Radiance RGBE equirectangular map, scanlines are usually run length encoded
+	};
+
+	// Light probe whose pixels are decoded one row at a time, directly from a MappedFile.
+	// Rows are numbered top to bottom and can be decoded in any order and from multiple threads at the same time
+	struct Image {
+		Format format;
+		Layout layout;
+
+		int width;
+		int height;
+
+		MappedFile file;
+
+		const u8 * pixels; // First pixel of the image in the file
+
+		bool big_endian; // Only used by PFM
+		int  channels;   // Only used by PFM, either 3 for RGB or 1 for grayscale
+
+		// Only used by HDR, the start of the R, G, B and E channels of every row. Rows that are not run length encoded only store the start of their RGBE pixels
+		Array<const u8 *> scanlines;
+
+		// The format is chosen based on the extension of the filename. Aborts if the file cannot be opened or is not a valid light probe
+		void open(const char * filename);
+		void close();
+
+		void read_row(int row, glm::vec3 result[]) const;
+	};
+
+	// Projects the light probe in the given file into get_coefficient_count(num_bands) coefficients.
+	// The image is divided into tiles of PROBE_TILE_ROWS rows that are projected in parallel. Every pixel is multiplied by the integrals of the SH basis over its area,
+	// which gives the exact projection of the pixels without any noise. These integrals only depend on the layout and size of the probe,
+	// they are computed on first use and cached until free_tables is called. The file is unmapped again when the projection is done
+	void project(const char * filename, ThreadPool& thread_pool, glm::vec3 result[], int num_bands = SH_MAX_NUM_BANDS);
+
+	// Projects an Image that is already open
+	void project(const Image& image, ThreadPool& thread_pool, glm::vec3 result[], int num_bands = SH_MAX_NUM_BANDS);
+
+	// Projects a light probe that is already in memory, rows are numbered top to bottom and row r starts at pixels[r * width].
+	// For an angular map a row is a column of the image, the same way as for an Image
+	void project(Layout layout, int width, int height, const glm::vec3 pixels[], ThreadPool& thread_pool, glm::vec3 result[], int num_bands = SH_MAX_NUM_BANDS);
+
+	// Frees the cached integrals of all sizes that have been projected
+	void free_tables();
+}
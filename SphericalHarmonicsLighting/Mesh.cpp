@@ -13,7 +13,7 @@ struct Vertex {
 	glm::vec3 normal;
 };
 
-Mesh::Mesh(const char* file_name, const MeshShader& shader) : file_name(file_name), mesh_data(AssetLoader::load_mesh(file_name)), material(shader) {
+Mesh::Mesh(const char* file_name, const MeshShader& shader, const BVHBuildSettings& bvh_settings) : file_name(file_name), mesh_data(AssetLoader::load_mesh(file_name)), material(shader) {
 	assert(mesh_data->index_count % 3 == 0);
 	
 	vertex_count = mesh_data->vertex_count;
@@ -40,6 +40,13 @@ Mesh::Mesh(const char* file_name, const MeshShader& shader) : file_name(file_nam
 		triangles[i].plane.distance = -glm::dot(triangles[i].plane.normal, triangles[i].vertices[0]);
 	}
 
+	aabb.min = glm::vec3(+INFINITY);
+	aabb.max = glm::vec3(-INFINITY);
+
+	for (int i = 0; i < triangle_count; i++) {
+		aabb.expand(triangles[i].calc_aabb());
+	}
+
 	// Decide in which file to look for the transfer coefficients, 
 	// based on whether the Mesh uses a DIFFUSE or GLOSSY MeshShader
 	{
@@ -51,19 +58,23 @@ Mesh::Mesh(const char* file_name, const MeshShader& shader) : file_name(file_nam
 		int last_dot_index = StringHelper::last_index_of(".", transfer_coeffs_file_name);
 		assert(last_dot_index != INVALID);
 
+		num_bands = material.shader.num_bands;
+
+		int coefficient_count = SH::get_coefficient_count(num_bands);
+
 		transfer_coeff_count = INVALID;
 		switch (material.shader.type) {
 			case MeshShader::Type::DIFFUSE: {
-				// For diffuse transfer functions we use a SH_COEFFICIENT_COUNT dimensional vector
-				transfer_coeff_count = SH_COEFFICIENT_COUNT;
+				// For diffuse transfer functions we use a coefficient_count dimensional vector
+				transfer_coeff_count = coefficient_count;
 
 				const char * diffuse_str = "_diffuse.dat";
 				strcpy_s(transfer_coeffs_file_name + last_dot_index, strlen(diffuse_str) + 1, diffuse_str);
 			} break;
 
 			case MeshShader::Type::GLOSSY: {
-				// For glossy transfer functions we use a SH_COEFFICIENT_COUNT x SH_COEFFICIENT_COUNT matrix
-				transfer_coeff_count = SH_COEFFICIENT_COUNT * SH_COEFFICIENT_COUNT;
+				// For glossy transfer functions we use a coefficient_count x coefficient_count matrix
+				transfer_coeff_count = coefficient_count * coefficient_count;
 
 				const char * glossy_str = "_glossy.dat";
 				strcpy_s(transfer_coeffs_file_name + last_dot_index, strlen(glossy_str) + 1, glossy_str);
@@ -83,15 +94,45 @@ Mesh::Mesh(const char* file_name, const MeshShader& shader) : file_name(file_nam
 				triangles_copy[i] = &triangles[i];
 			}
 
-			bvh = BVHNode::build(triangle_count, triangles_copy);
+			BVHNode const * tree = BVHNode::build(triangle_count, triangles_copy, bvh_settings);
+
+			bvh_debugger.init(tree);
+
+			// Convert the pointer based tree into a linear array of nodes that is more efficient to traverse
+			bvh = FlatBVH::flatten(tree);
+
+			delete tree;
 		}
 		delete[] triangles_copy;
 
-		bvh_debugger.init(bvh);
+		bvh.report(file_name, bvh_settings);
+
+		// Optionally collapse the binary tree into a wider tree, after which the binary tree is no longer needed
+		bvh_width = bvh_settings.width;
+
+		switch (bvh_width) {
+			case 2: break;
+
+			case 4: {
+				bvh4 = BVH4::collapse(bvh);
+				bvh4.report(file_name);
+
+				bvh.free();
+			} break;
+
+			case 8: {
+				bvh8 = BVH8::collapse(bvh);
+				bvh8.report(file_name);
+
+				bvh.free();
+			} break;
+
+			default: abort();
+		}
 	}
 }
 
-void Mesh::init_material(const SH::Sample samples[SAMPLE_COUNT]) {
+void Mesh::init_material(const SH::Sample samples[], int sample_count) {
 	// For GLOSSY materials, we need to convolve with a BRDF (Phong lobe)
 	// We compute this here and pass it to the Shader
 	if (material.shader.type == MeshShader::Type::GLOSSY) {	
@@ -114,23 +155,23 @@ void Mesh::init_material(const SH::Sample samples[SAMPLE_COUNT]) {
 		brdf.specular_power = material.specular_power;
 		brdf.albedo         = material.albedo;
 
-		glm::vec3 brdf_coeffs_full[SH_COEFFICIENT_COUNT];
-		for (int i = 0; i < SH_COEFFICIENT_COUNT; i++) {
+		glm::vec3 brdf_coeffs_full[SH_MAX_COEFFICIENT_COUNT];
+		for (int i = 0; i < SH_MAX_COEFFICIENT_COUNT; i++) {
 			brdf_coeffs_full[i] = glm::vec3(0.0f, 0.0f, 0.0f);
 		}
 
 		// Project the BRDF into Spherical Harmonic representation using Monte Carlo integration
-		SH::project_polar_function(brdf, samples, brdf_coeffs_full);
+		SH::project_polar_function(brdf, samples, sample_count, brdf_coeffs_full, num_bands);
 
 		// Because the kernel is only dependend on theta, we can condense it into a representation with only 
-		// SH_NUM_BANDS coefficients instead of the standard SH_NUM_BANDS^2 coefficients.
-		for (int l = 0; l < SH_NUM_BANDS; l++) {
+		// num_bands coefficients instead of the standard num_bands^2 coefficients.
+		for (int l = 0; l < num_bands; l++) {
 			material.brdf_coeffs[l] = sqrt(4.0f * PI / (2.0f * l + 1.0f)) * brdf_coeffs_full[l*(l + 1)];
 		}
 	}
 }
 
-bool Mesh::try_to_load_transfer_coeffs(glm::vec3 transfer_coeffs[]) const {
+bool Mesh::try_to_load_transfer_coeffs(glm::vec3 transfer_coeffs[], int& sample_count) const {
 	bool was_loaded = false;
 
 	std::ifstream in_file(transfer_coeffs_file_name, std::ios::in | std::ios::binary); 
@@ -146,9 +187,18 @@ bool Mesh::try_to_load_transfer_coeffs(glm::vec3 transfer_coeffs[]) const {
 		in_file.read(reinterpret_cast<char*>(&file_transfer_count), sizeof(u32));
 
 		if (file_transfer_count == transfer_coeff_count) {
-			in_file.read(reinterpret_cast<char*>(transfer_coeffs), vertex_count * transfer_coeff_count * sizeof(glm::vec3));
+			std::streamsize data_size = vertex_count * transfer_coeff_count * sizeof(glm::vec3);
+
+			in_file.read(reinterpret_cast<char*>(transfer_coeffs), data_size);
+
+			// A file that was cut short while it was being saved is not used
+			was_loaded = in_file.gcount() == data_size;
 
-			was_loaded = true;
+			// The number of samples follows the coefficients, files that were saved before it was stored are treated as fully baked
+			u32 file_sample_count;
+			in_file.read(reinterpret_cast<char*>(&file_sample_count), sizeof(u32));
+
+			sample_count = in_file.gcount() == sizeof(u32) ? int(file_sample_count) : INVALID;
 		}
 
 		in_file.close();
@@ -157,7 +207,7 @@ bool Mesh::try_to_load_transfer_coeffs(glm::vec3 transfer_coeffs[]) const {
 	return was_loaded;
 }
 
-void Mesh::save_transfer_coeffs(glm::vec3 transfer_coeffs[]) const {
+void Mesh::save_transfer_coeffs(const glm::vec3 transfer_coeffs[], int sample_count) const {
 	assert(transfer_coeffs);
 	assert(transfer_coeffs_file_name);
 
@@ -170,196 +220,383 @@ void Mesh::save_transfer_coeffs(glm::vec3 transfer_coeffs[]) const {
 		out_file.write(reinterpret_cast<const char*>(&transfer_coeff_count), sizeof(u32));
 		// Write the actual data, either the transfer vector or the transfer matrix
 		out_file.write(reinterpret_cast<const char*>(transfer_coeffs), vertex_count * transfer_coeff_count * sizeof(glm::vec3));
+		// Write the number of samples the coefficients were baked with, so that a progressive bake can continue where it left off
+		out_file.write(reinterpret_cast<const char*>(&sample_count), sizeof(u32));
 	}
 	out_file.close();
+}
+
+template<int NumBands>
+void Mesh::accumulate_light_direct_vertex(const SH::Sample samples[], int sample_count, int v, glm::vec3 transfer_coeffs[]) const {
+	const int coefficient_count = SH::get_coefficient_count(NumBands);
+
+	// Initialize SH coefficients to 0
+	for (int i = 0; i < transfer_coeff_count; i++) {
+		transfer_coeffs[v * transfer_coeff_count + i] = glm::vec3(0.0f, 0.0f, 0.0f);
+	}
+
+	// Iterate over SH samples
+	for (int s = 0; s < sample_count; s++) {
+		float dot = glm::dot(mesh_data->vertices[v].normal, samples[s].direction);
+
+		// Only accept samples within the hemisphere defined by the Vertex normal, that were not occluded
+		if (dot >= 0.0f && !visibility.is_occluded(v, s)) {
+			switch (material.shader.type) {
+				// For diffuse materials, compose the transfer vector.
+				// This vector includes the BDRF, incorporating the albedo colour, a lambertian diffuse factor (dot) and a SH sample
+				case MeshShader::Type::DIFFUSE: {
+					for (int i = 0; i < coefficient_count; i++) {
+						// Add the contribution of this sample
+						transfer_coeffs[v * coefficient_count + i] += material.albedo * dot * samples[s].coeffs[i];
+					}
+				} break;
+
+				// For glossy materials, compose the transfer matrix.
+				// This matrix does not include the BDRF, incorporating only two SH samples
+				case MeshShader::Type::GLOSSY: {
+					for (int j = 0; j < coefficient_count; j++) {
+						for (int i = 0; i < coefficient_count; i++) {
+							// Add the contribution of this sample
+							transfer_coeffs[(v * coefficient_count + j) * coefficient_count + i] += samples[s].coeffs[j] * samples[s].coeffs[i];
+						}
+					}
+				} break;
+			}
+		}
+	}
+
+	const float normalization_factor = 4.0f * PI / sample_count;
 
-	delete[] transfer_coeffs_file_name;
+	// Normalize coefficients
+	for (int i = 0; i < transfer_coeff_count; i++) {
+		transfer_coeffs[v * transfer_coeff_count + i] *= normalization_factor;
+	}
 }
 
-void Mesh::init_light_direct(const Scene& scene, const SH::Sample samples[SAMPLE_COUNT], glm::vec3 transfer_coeffs[]) {
+void Mesh::init_light_direct(const Scene& scene, const BakeSettings& settings, ThreadPool& thread_pool, const SH::Sample samples[], int sample_count, glm::vec3 transfer_coeffs[]) {
 	ScopedTimer timer("Mesh Direct + Shadowed Lighting");
 
-	Ray ray;
-	hits = new bool[vertex_count * SAMPLE_COUNT];
+	visibility.init(vertex_count, sample_count, settings.store_occluder_records);
 	
-	// Iterate over vertices
-	for (int v = 0; v < vertex_count; v++) {
-		// Initialize SH coefficients to 0
-		for (int i = 0; i < transfer_coeff_count; i++) {
-			transfer_coeffs[v * transfer_coeff_count + i] = glm::vec3(0.0f, 0.0f, 0.0f);
-		}
+	// Every vertex only writes to its own transfer coefficients and visibility, and iterates over the samples in the same order.
+	// This means the result is identical regardless of the number of threads or how the vertices are distributed over them.
+	thread_pool.parallel_for(vertex_count, BAKE_CHUNK_SIZE, [&](int v, int /*thread_index*/) {
+		init_light_direct_vertex(scene, settings, samples, sample_count, v, transfer_coeffs);
+	}, "Mesh Direct + Shadowed Lighting");
+}
 
-		// Iterate over SH samples
-		for (int s = 0; s < SAMPLE_COUNT; s++) {
-			float dot = glm::dot(mesh_data->vertices[v].normal, samples[s].direction);
+void Mesh::init_light_direct_vertex(const Scene& scene, const BakeSettings& settings, const SH::Sample samples[], int sample_count, int v, glm::vec3 transfer_coeffs[]) {
+	Ray ray;
+	ray.origin = mesh_data->vertices[v].position + mesh_data->vertices[v].normal * EPSILON;
+
+	// First determine which samples are occluded, samples outside the hemisphere defined by the Vertex normal are never traced.
+	// If records are stored, closest hits are traced instead of any hits, so that the bounce passes can reuse them.
+	// A Ray hits something if and only if it has a closest hit, so the occluded samples are the same in all modes
+	Array<OccluderRecord> vertex_records;
+
+	if (settings.use_ray_packets) {
+		// All Rays of a vertex share the same origin, which makes them coherent enough to be traced together
+		RayPacket     packet;
+		RayPacketMask packet_hits;
+		RayPacketHits packet_closest_hits;
+		const Mesh *  packet_meshes[RAY_PACKET_MAX_SIZE];
+
+		glm::vec3 packet_directions[BAKE_RAY_PACKET_SIZE];
+		int       packet_samples   [BAKE_RAY_PACKET_SIZE];
+		int       packet_size = 0;
+
+		for (int s = 0; s < sample_count; s++) {
+			if (glm::dot(mesh_data->vertices[v].normal, samples[s].direction) >= 0.0f) {
+				packet_directions[packet_size] = samples[s].direction;
+				packet_samples   [packet_size] = s;
+				packet_size++;
+			}
 
-			// Only accept samples within the hemisphere defined by the Vertex normal
-			if (dot >= 0.0f) {
-				ray.origin    = mesh_data->vertices[v].position + mesh_data->vertices[v].normal * EPSILON;
-				ray.direction = samples[s].direction;
+			// Trace the packet once it is full, or when the last sample has been added
+			if (packet_size == BAKE_RAY_PACKET_SIZE || (s == sample_count - 1 && packet_size > 0)) {
+				packet.init(ray.origin, packet_size, packet_directions);
+
+				if (settings.store_occluder_records) {
+					packet_closest_hits.init();
+
+					scene.trace(packet, packet_closest_hits, packet_meshes);
+
+					for (int i = 0; i < packet_size; i++) {
+						if (packet_closest_hits.distances[i] != INFINITY) {
+							OccluderRecord record;
+							record.init(packet_samples[i], scene.get_mesh_index(packet_meshes[i]), packet_closest_hits.triangle_indices[i], packet_closest_hits.u[i], packet_closest_hits.v[i]);
+
+							vertex_records.push_back(record);
 
-				bool hit = scene.intersects(ray);
-				hits[v * SAMPLE_COUNT + s] = hit;
-
-				// If the Ray was not occluded
-				if (!hit) {
-					switch (material.shader.type) {
-						// For diffuse materials, compose the transfer vector.
-						// This vector includes the BDRF, incorporating the albedo colour, a lambertian diffuse factor (dot) and a SH sample
-						case MeshShader::Type::DIFFUSE: {
-							for (int i = 0; i < SH_COEFFICIENT_COUNT; i++) {
-								// Add the contribution of this sample
-								transfer_coeffs[v * SH_COEFFICIENT_COUNT + i] += material.albedo * dot * samples[s].coeffs[i];
-							}
-						} break;
-
-						// For glossy materials, compose the transfer matrix.
-						// This matrix does not include the BDRF, incorporating only two SH samples
-						case MeshShader::Type::GLOSSY: {
-							for (int j = 0; j < SH_COEFFICIENT_COUNT; j++) {
-								for (int i = 0; i < SH_COEFFICIENT_COUNT; i++) {
-									// Add the contribution of this sample
-									transfer_coeffs[(v * SH_COEFFICIENT_COUNT + j) * SH_COEFFICIENT_COUNT + i] += samples[s].coeffs[j] * samples[s].coeffs[i];
-								}
-							}
-						} break;
+							visibility.set_occluded(v, packet_samples[i], true);
+						}
+					}
+				} else {
+					memset(packet_hits.bits, 0, sizeof(packet_hits.bits));
+
+					scene.intersects(packet, packet_hits);
+
+					for (int i = 0; i < packet_size; i++) {
+						visibility.set_occluded(v, packet_samples[i], packet_hits.get(i));
 					}
 				}
-			} else {
-				hits[v * SAMPLE_COUNT + s] = false;
+
+				packet_size = 0;
 			}
 		}
+	} else {
+		for (int s = 0; s < sample_count; s++) {
+			if (glm::dot(mesh_data->vertices[v].normal, samples[s].direction) >= 0.0f) {
+				ray.direction = samples[s].direction;
+
+				if (settings.store_occluder_records) {
+					int   triangle_index;
+					float weight_u;
+					float weight_v;
+					const Mesh * hit_mesh = NULL;
 
-		const float normalization_factor = 4.0f * PI / SAMPLE_COUNT;
+					if (scene.trace(ray, triangle_index, weight_u, weight_v, hit_mesh) != INFINITY) {
+						OccluderRecord record;
+						record.init(s, scene.get_mesh_index(hit_mesh), triangle_index, weight_u, weight_v);
 
-		// Normalize coefficients
-		for (int i = 0; i < transfer_coeff_count; i++) {
-			transfer_coeffs[v * transfer_coeff_count + i] *= normalization_factor;
+						vertex_records.push_back(record);
+
+						visibility.set_occluded(v, s, true);
+					}
+				} else {
+					visibility.set_occluded(v, s, scene.intersects(ray));
+				}
+			}
 		}
+	}
 
-		//printf("Bounce 0: Vertex %u out of %u done\n", v, vertex_count);
+	if (settings.store_occluder_records) {
+		visibility.set_records(v, vertex_records.data(), int(vertex_records.size()));
 	}
+
+	// The loops over the coefficients are instantiated for the number of bands of the Mesh
+	SH::dispatch_num_bands(num_bands, [&](auto bands) {
+		accumulate_light_direct_vertex<decltype(bands)::value>(samples, sample_count, v, transfer_coeffs);
+	});
 }
 
-void Mesh::init_light_bounce(const Scene& scene, const SH::Sample samples[SAMPLE_COUNT], const glm::vec3 previous_bounce_transfer_coeffs[], glm::vec3 bounce_transfer_coeffs[]) const {
-	Ray ray;
-	
-	int indices[3];
+// Calls callback(s, dot, hit_mesh, indices, u, v) for every sample of vertex v that is inside the hemisphere of its normal
+// and was occluded in the direct lighting pass, in increasing order of sample index
+template<typename Callback>
+void Mesh::for_each_occluder(const Scene& scene, const SH::Sample samples[], int sample_count, int v, Callback callback) const {
+	int   triangle_index;
 	float weight_u;
 	float weight_v;
 
 	const Mesh * hit_mesh = NULL;
 
-	// Iterate over vertices
-	for (int v = 0; v < vertex_count; v++) {
-		// Iterate over samples
-		for (int s = 0; s < SAMPLE_COUNT; s++) {
-			// If the ray in the current sample direction hit anything in the direct lighting pass
-			if (hits[v * SAMPLE_COUNT + s]) {
+	// Iterate over the samples that hit anything in the direct lighting pass
+	if (visibility.store_records) {
+		for (int r = 0; r < visibility.record_counts[v]; r++) {
+			const OccluderRecord& record = visibility.records[v][r];
+			int s = record.sample_index;
+
+			float dot = glm::dot(samples[s].direction, mesh_data->vertices[v].normal);
+			// if ray inside hemisphere, continue processing.
+			if (dot > 0.0f) {
+				// The hit was already found by the direct lighting pass
+				hit_mesh = scene.get_mesh(record.mesh_index);
+
+				weight_u = record.get_u();
+				weight_v = record.get_v();
+
+				callback(s, dot, hit_mesh, hit_mesh->get_bvh_triangle(record.triangle_index).indices, weight_u, weight_v);
+			}
+		}
+	} else {
+		for (int s = 0; s < sample_count; s++) {
+			if (visibility.is_occluded(v, s)) {
 				float dot = glm::dot(samples[s].direction, mesh_data->vertices[v].normal);
 				// if ray inside hemisphere, continue processing.
 				if (dot > 0.0f) {
+					Ray ray;
 					ray.origin    = mesh_data->vertices[v].position + mesh_data->vertices[v].normal * EPSILON;
 					ray.direction = samples[s].direction;
 
-					float distance = scene.trace(ray, indices, weight_u, weight_v, hit_mesh);	
+					float distance = scene.trace(ray, triangle_index, weight_u, weight_v, hit_mesh);
 					assert(distance != INFINITY);
 					assert(hit_mesh);
 
-					float weight_w = 1.0f - (weight_u + weight_v);
-
-					// previous_bounce_transfer_coeffs is an array that contains the transfer coefficients for all Meshes in the Scene in a contiguous array.
-					// To correctly index in it we need to use the transfer_coeffs_scene_offset of the Mesh we hit, and multiply the indices by its transfer_coeff_count.
-					const glm::vec3 * hit_transfer_coeffs_vertex0 = previous_bounce_transfer_coeffs + (indices[0] * hit_mesh->transfer_coeff_count + hit_mesh->transfer_coeffs_scene_offset);
-					const glm::vec3 * hit_transfer_coeffs_vertex1 = previous_bounce_transfer_coeffs + (indices[1] * hit_mesh->transfer_coeff_count + hit_mesh->transfer_coeffs_scene_offset);
-					const glm::vec3 * hit_transfer_coeffs_vertex2 = previous_bounce_transfer_coeffs + (indices[2] * hit_mesh->transfer_coeff_count + hit_mesh->transfer_coeffs_scene_offset);
-
-					if (material.shader.type == MeshShader::Type::DIFFUSE && hit_mesh->material.shader.type == MeshShader::Type::DIFFUSE) {
-						glm::vec3 albedo = material.albedo * ONE_OVER_PI;
-
-						// Sum reflected SH light for this vertex
-						// Lerp hit vertices SH vectors to get SH at hit point
-						for (int i = 0; i < SH_COEFFICIENT_COUNT; i++) {
-							bounce_transfer_coeffs[v * SH_COEFFICIENT_COUNT + i] += albedo * dot * (
-								weight_u * hit_transfer_coeffs_vertex0[i] + 
-								weight_v * hit_transfer_coeffs_vertex1[i] + 
-								weight_w * hit_transfer_coeffs_vertex2[i]
-							);
-						}
-					} else if (material.shader.type == MeshShader::Type::GLOSSY && hit_mesh->material.shader.type == MeshShader::Type::GLOSSY) {
-						glm::vec3 hit_normal0 = hit_mesh->mesh_data->vertices[indices[0]].normal;
-						glm::vec3 hit_normal1 = hit_mesh->mesh_data->vertices[indices[1]].normal;
-						glm::vec3 hit_normal2 = hit_mesh->mesh_data->vertices[indices[2]].normal;
-
-						// Calculate actual hit normal by blending the normals using the barycentric u,v,w coordinates
-						glm::vec3 hit_normal = glm::normalize(weight_u * hit_normal0 + weight_v * hit_normal1 + weight_w * hit_normal2);
-
-						// Obtain reflection direction R
-						glm::vec3 R = glm::reflect(-ray.direction, hit_normal);
-
-						/////////////////////////////////////////////////////////////////////////////////////////////////
-						// @TODO: check if it's possible to reflect in spherical coordinates, in which case we can use //
-						// theta,phi from the current sample, instead of recalculating R_theta,R_phi each iteration	   //
-						/////////////////////////////////////////////////////////////////////////////////////////////////
-
-						// Convert reflection direction R into spherical coordinates (R_theta, R_phi)
-						float R_theta       = acos(R.z);
-						float inv_sin_theta = 1.0f / sin(R_theta);
-						float R_phi         = acos(glm::clamp(R.x * inv_sin_theta, -1.0f, 1.0f));
-	
-						// Keep phi in the range [0, 2 pi]
-						if (R.y * inv_sin_theta < 0.0f) {
-							R_phi = 2.0f * PI - R_phi;
-						}
+					callback(s, dot, hit_mesh, hit_mesh->get_bvh_triangle(triangle_index).indices, weight_u, weight_v);
+				}
+			}
+		}
+	}
+}
 
-						// Evaluate SH coefficients in the reflection direction R
-						float y_R[SH_COEFFICIENT_COUNT];
-						for (int l = 0; l < SH_NUM_BANDS; l++) {
-							for (int m = -l; m <= l; m++) {
-								int k = l*(l+1) + m;
+void Mesh::init_transport(const Scene& scene, ThreadPool& thread_pool, const SH::Sample samples[], int sample_count) {
+	// Only the diffuse bounce is a linear map on the transfer vectors, glossy bounces are still calculated per sample
+	if (material.shader.type != MeshShader::Type::DIFFUSE) return;
 
-								y_R[k] = SH::evaluate(l, m, R_theta, R_phi);
-							}
-						}
+	ScopedTimer timer("Mesh Transport Matrix");
 
-						for (int j = 0; j < SH_COEFFICIENT_COUNT; j++) {
-							for (int i = 0; i < SH_COEFFICIENT_COUNT; i++) {
-								glm::vec3 k_sum(0.0f, 0.0f, 0.0f);
+	// Only the bands that both Meshes have can be transported, so the entries are split up by the number of bands of the hit Mesh
+	Array<TransportEntry> * rows[SH_MAX_NUM_BANDS];
+	for (int b = 0; b < SH_MAX_NUM_BANDS; b++) {
+		rows[b] = new Array<TransportEntry>[vertex_count];
+	}
 
-								for (int l = 0; l < SH_NUM_BANDS; l++) {
-									for (int m = -l; m <= l; m++) {
-										int k = l*(l+1) + m;
+	const float normalization_factor = 4.0f * PI / sample_count;
 
-										glm::vec3 M_kj = 
-											weight_u * hit_transfer_coeffs_vertex0[k * SH_COEFFICIENT_COUNT + j] +
-											weight_v * hit_transfer_coeffs_vertex1[k * SH_COEFFICIENT_COUNT + j] +
-											weight_w * hit_transfer_coeffs_vertex2[k * SH_COEFFICIENT_COUNT + j];
+	glm::vec3 albedo = material.albedo * ONE_OVER_PI;
 
-										k_sum += hit_mesh->material.brdf_coeffs[l] * M_kj * y_R[k];
-									}
-								}
+	// Every vertex only writes to its own row, and adds its entries in the same order regardless of the number of threads
+	thread_pool.parallel_for(vertex_count, BAKE_CHUNK_SIZE, [&](int v, int /*thread_index*/) {
+		for_each_occluder(scene, samples, sample_count, v, [&](int /*s*/, float dot, const Mesh * hit_mesh, const int indices[3], float weight_u, float weight_v) {
+			// Light reflected by Meshes with a different Shader is currently unsupported :(
+			if (hit_mesh->material.shader.type != MeshShader::Type::DIFFUSE) return;
 
-								bounce_transfer_coeffs[(v * SH_COEFFICIENT_COUNT + j) * SH_COEFFICIENT_COUNT + i] += k_sum * samples[s].coeffs[i];
-							}
-						}
-					} else {
-						// Currently unsupported :(
+			float weight_w = 1.0f - (weight_u + weight_v);
+
+			glm::vec3 weight = albedo * dot * normalization_factor;
+
+			// The SH vector at the hit point is a lerp of the SH vectors of the hit vertices, so every hit vertex gets its own entry.
+			// transfer_coeffs_scene_offset is used to index the Scene wide coefficient array, just like in the glossy bounce
+			TransportEntry entries[3] = {
+				{ hit_mesh->transfer_coeffs_scene_offset + indices[0] * hit_mesh->transfer_coeff_count, weight * weight_u },
+				{ hit_mesh->transfer_coeffs_scene_offset + indices[1] * hit_mesh->transfer_coeff_count, weight * weight_v },
+				{ hit_mesh->transfer_coeffs_scene_offset + indices[2] * hit_mesh->transfer_coeff_count, weight * weight_w }
+			};
+
+			Array<TransportEntry>& row = rows[hit_mesh->num_bands - 1][v];
+			row.insert(row.end(), entries, entries + 3);
+		});
+
+		for (int b = 0; b < SH_MAX_NUM_BANDS; b++) {
+			TransportMatrix::compact_row(rows[b][v]);
+		}
+	}, "Mesh Transport Matrix");
+
+	for (int b = 0; b < SH_MAX_NUM_BANDS; b++) {
+		int shared_num_bands = std::min(num_bands, b + 1);
+
+		transports[b].init(SH::get_coefficient_count(shared_num_bands), vertex_count, rows[b]);
+
+		delete[] rows[b];
+	}
+
+	// The transport matrices contain everything the diffuse bounces need
+	visibility.free();
+}
+
+template<int NumBands>
+void Mesh::init_light_bounce_vertex_glossy(const Scene& scene, const SH::Sample samples[], int sample_count, int v, const glm::vec3 previous_bounce_transfer_coeffs[], glm::vec3 bounce_transfer_coeffs[]) const {
+	const int coefficient_count = SH::get_coefficient_count(NumBands);
+
+	for_each_occluder(scene, samples, sample_count, v, [&](int s, float /*dot*/, const Mesh * hit_mesh, const int indices[3], float weight_u, float weight_v) {
+		// Light reflected by Meshes with a different Shader is currently unsupported :(
+		if (hit_mesh->material.shader.type != MeshShader::Type::GLOSSY) return;
+
+		// Only the bands that both Meshes have can be transported
+		int shared_num_bands         = std::min(NumBands, hit_mesh->num_bands);
+		int shared_coefficient_count = SH::get_coefficient_count(shared_num_bands);
+		int hit_coefficient_count    = SH::get_coefficient_count(hit_mesh->num_bands);
+
+		float weight_w = 1.0f - (weight_u + weight_v);
+
+		// previous_bounce_transfer_coeffs is an array that contains the transfer coefficients for all Meshes in the Scene in a contiguous array.
+		// To correctly index in it we need to use the transfer_coeffs_scene_offset of the Mesh we hit, and multiply the indices by its transfer_coeff_count.
+		const glm::vec3 * hit_transfer_coeffs_vertex0 = previous_bounce_transfer_coeffs + (indices[0] * hit_mesh->transfer_coeff_count + hit_mesh->transfer_coeffs_scene_offset);
+		const glm::vec3 * hit_transfer_coeffs_vertex1 = previous_bounce_transfer_coeffs + (indices[1] * hit_mesh->transfer_coeff_count + hit_mesh->transfer_coeffs_scene_offset);
+		const glm::vec3 * hit_transfer_coeffs_vertex2 = previous_bounce_transfer_coeffs + (indices[2] * hit_mesh->transfer_coeff_count + hit_mesh->transfer_coeffs_scene_offset);
+
+		glm::vec3 hit_normal0 = hit_mesh->mesh_data->vertices[indices[0]].normal;
+		glm::vec3 hit_normal1 = hit_mesh->mesh_data->vertices[indices[1]].normal;
+		glm::vec3 hit_normal2 = hit_mesh->mesh_data->vertices[indices[2]].normal;
+
+		// Calculate actual hit normal by blending the normals using the barycentric u,v,w coordinates
+		glm::vec3 hit_normal = glm::normalize(weight_u * hit_normal0 + weight_v * hit_normal1 + weight_w * hit_normal2);
+
+		// Obtain reflection direction R
+		glm::vec3 R = glm::reflect(-samples[s].direction, hit_normal);
+
+		// Evaluate SH coefficients in the reflection direction R, directly from its Cartesian coordinates
+		float y_R[SH_MAX_COEFFICIENT_COUNT];
+		SH::evaluate(R, y_R, shared_num_bands);
+
+		for (int j = 0; j < shared_coefficient_count; j++) {
+			for (int i = 0; i < coefficient_count; i++) {
+				glm::vec3 k_sum(0.0f, 0.0f, 0.0f);
+
+				for (int l = 0; l < shared_num_bands; l++) {
+					for (int m = -l; m <= l; m++) {
+						int k = l*(l+1) + m;
+
+						glm::vec3 M_kj = 
+							weight_u * hit_transfer_coeffs_vertex0[k * hit_coefficient_count + j] +
+							weight_v * hit_transfer_coeffs_vertex1[k * hit_coefficient_count + j] +
+							weight_w * hit_transfer_coeffs_vertex2[k * hit_coefficient_count + j];
+
+						k_sum += hit_mesh->material.brdf_coeffs[l] * M_kj * y_R[k];
 					}
 				}
+
+				bounce_transfer_coeffs[(v * coefficient_count + j) * coefficient_count + i] += k_sum * samples[s].coeffs[i];
 			}
 		}
-		
-		//printf("Bounce n: Vertex %u out of %u done\n", v, vertex_count);
-	}
+	});
 	
-	const float normalization_factor = 4.0f * PI / SAMPLE_COUNT;
+	const float normalization_factor = 4.0f * PI / sample_count;
 
-	for (int j = 0; j < vertex_count * transfer_coeff_count; j++) {
-		bounce_transfer_coeffs[j] *= normalization_factor;
+	for (int i = 0; i < transfer_coeff_count; i++) {
+		bounce_transfer_coeffs[v * transfer_coeff_count + i] *= normalization_factor;
 	}
 }
 
-void Mesh::init_shader(const SH::Sample samples[SAMPLE_COUNT], glm::vec3 transfer_coeffs[]) {
+void Mesh::init_light_bounce_vertex(const Scene& scene, const SH::Sample samples[], int sample_count, int v, const glm::vec3 previous_bounce_transfer_coeffs[], glm::vec3 bounce_transfer_coeffs[]) const {
+	// A diffuse bounce is a single row of the transport matrices times the coefficients of the previous bounce, this already includes the normalization
+	if (material.shader.type == MeshShader::Type::DIFFUSE) {
+		for (int b = 0; b < SH_MAX_NUM_BANDS; b++) {
+			if (transports[b].entry_count > 0) {
+				transports[b].multiply_row(v, previous_bounce_transfer_coeffs, bounce_transfer_coeffs + v * transfer_coeff_count);
+			}
+		}
+
+		return;
+	}
+
+	SH::dispatch_num_bands(num_bands, [&](auto bands) {
+		init_light_bounce_vertex_glossy<decltype(bands)::value>(scene, samples, sample_count, v, previous_bounce_transfer_coeffs, bounce_transfer_coeffs);
+	});
+}
+
+size_t Mesh::get_visibility_memory_usage() const {
+	return visibility.get_memory_usage();
+}
+
+size_t Mesh::get_occluder_record_memory_usage() const {
+	return visibility.get_record_memory_usage();
+}
+
+size_t Mesh::get_transport_memory_usage() const {
+	if (material.shader.type != MeshShader::Type::DIFFUSE) return 0;
+
+	size_t memory_usage = 0;
+
+	for (int b = 0; b < SH_MAX_NUM_BANDS; b++) {
+		memory_usage += transports[b].get_memory_usage();
+	}
+
+	return memory_usage;
+}
+
+void Mesh::free_bake_data() {
+	// Diffuse Meshes have already released their visibility when the transport matrices were built
+	if (material.shader.type == MeshShader::Type::DIFFUSE) {
+		for (int b = 0; b < SH_MAX_NUM_BANDS; b++) {
+			transports[b].free();
+		}
+	} else {
+		visibility.free();
+	}
+}
+
+void Mesh::init_shader(const glm::vec3 transfer_coeffs[]) {
 	Vertex * vertices = new Vertex[vertex_count];
 	
 	// Copy positions and normals
@@ -392,12 +629,73 @@ void Mesh::init_shader(const SH::Sample samples[SAMPLE_COUNT], glm::vec3 transfe
 	delete[] vertices;
 }
 
+void Mesh::update_shader(const glm::vec3 transfer_coeffs[]) {
+	glBindBuffer(GL_TEXTURE_BUFFER, tbo);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, vertex_count * transfer_coeff_count * sizeof(glm::vec3), transfer_coeffs);
+}
+
 bool Mesh::intersects(const Ray& ray) const {
-	return bvh->intersects(ray);
+	switch (bvh_width) {
+		case 2: return bvh .intersects(ray);
+		case 4: return bvh4.intersects(ray);
+		case 8: return bvh8.intersects(ray);
+
+		default: abort();
+	}
+}
+
+void Mesh::intersects(const RayPacket& packet, RayPacketMask& hits) const {
+	if (bvh_width == 2) {
+		bvh.intersects(packet, hits);
+	} else {
+		// Packet traversal is only implemented for the binary tree, wide trees trace the Rays of the packet one by one
+		for (int i = 0; i < packet.ray_count; i++) {
+			if (!hits.get(i) && intersects(packet.rays[i])) {
+				hits.set(i);
+			}
+		}
+	}
+}
+
+float Mesh::trace(const Ray& ray, int& triangle_index, float& u, float& v, float max_distance) const {
+	switch (bvh_width) {
+		case 2: return bvh .trace(ray, triangle_index, u, v, max_distance);
+		case 4: return bvh4.trace(ray, triangle_index, u, v, max_distance);
+		case 8: return bvh8.trace(ray, triangle_index, u, v, max_distance);
+
+		default: abort();
+	}
 }
 
-float Mesh::trace(const Ray& ray, int indices[3], float& u, float& v) const {
-	return bvh->trace(ray, indices, u, v);
+void Mesh::trace(const RayPacket& packet, const RayPacketMask& active, RayPacketHits& hits) const {
+	if (bvh_width == 2) {
+		bvh.trace(packet, active, hits);
+	} else {
+		// Packet traversal is only implemented for the binary tree, wide trees trace the Rays of the packet one by one
+		for (int i = 0; i < packet.ray_count; i++) {
+			if (!active.get(i)) continue;
+
+			int   triangle_index;
+			float u, v;
+			float distance = trace(packet.rays[i], triangle_index, u, v, hits.distances[i]);
+			if (distance != INFINITY) {
+				hits.distances       [i] = distance;
+				hits.triangle_indices[i] = triangle_index;
+				hits.u[i] = u;
+				hits.v[i] = v;
+			}
+		}
+	}
+}
+
+const Triangle& Mesh::get_bvh_triangle(int triangle_index) const {
+	switch (bvh_width) {
+		case 2: return bvh .triangles[triangle_index];
+		case 4: return bvh4.triangles[triangle_index];
+		case 8: return bvh8.triangles[triangle_index];
+
+		default: abort();
+	}
 }
 
 void Mesh::render() const {
@@ -4,20 +4,44 @@
 #include "Shader.h"
 #include "SphericalHarmonics.h"
 
-// Base class that provides the abstraction to differentiate between Diffuse and Glossy materials
+// Defines that pass the number of SH bands of a MeshShader on to its GLSL source.
+// The Shader only reads the definitions while it is being compiled, so this can be a temporary in the constructor of a MeshShader
+struct MeshShaderDefines {
+	char num_bands        [16];
+	char coefficient_count[16];
+
+	const char * names      [2];
+	const char * definitions[2];
+
+	const Shader::Defines defines;
+
+	inline MeshShaderDefines(int num_bands) : defines(2, names, definitions) {
+		sprintf_s(this->num_bands,         "%i", num_bands);
+		sprintf_s(this->coefficient_count, "%i", SH::get_coefficient_count(num_bands));
+
+		names[0] = "SH_NUM_BANDS";         definitions[0] = this->num_bands;
+		names[1] = "SH_COEFFICIENT_COUNT"; definitions[1] = this->coefficient_count;
+	}
+};
+
+// Base class that provides the abstraction to differentiate between Diffuse and Glossy materials.
+// Every MeshShader is compiled for a specific number of SH bands, which determines the number of bands of the Meshes that use it
 class MeshShader : public Shader {
 public:
 	const enum Type { DIFFUSE, GLOSSY } type;
 
+	const int num_bands;
+
 	inline MeshShader(
 		Type type,
+		int num_bands,
 		const char* vertex_filename, 
 		const char* fragment_filename, 
-		const char* geometry_filename = nullptr, 
-		const Defines& defines = Defines(0, nullptr, nullptr)) :
-		Shader(vertex_filename, fragment_filename, geometry_filename, defines),
+		const char* geometry_filename = nullptr) :
+		Shader(vertex_filename, fragment_filename, geometry_filename, MeshShaderDefines(num_bands).defines),
 
 		type(type),
+		num_bands(num_bands),
 
 		uni_tbo_texture    (get_uniform("tbo_texture")),
 		uni_light_coeffs   (get_uniform("light_coeffs")),
@@ -31,7 +55,7 @@ public:
 		};
 
 	inline void set_light_coeffs(const glm::vec3 light_coeffs[]) const {
-		glUniform3fv(uni_light_coeffs, SH_COEFFICIENT_COUNT, reinterpret_cast<const GLfloat*>(light_coeffs));
+		glUniform3fv(uni_light_coeffs, SH::get_coefficient_count(num_bands), reinterpret_cast<const GLfloat*>(light_coeffs));
 	}
 
 	inline void set_view_projection(const glm::mat4& view_projection) const {
@@ -46,15 +70,15 @@ protected:
 
 class DiffuseShader : public MeshShader {
 public:
-	DiffuseShader();
+	DiffuseShader(int num_bands);
 };
 
 class GlossyShader : public MeshShader {
 public:
-	GlossyShader();
+	GlossyShader(int num_bands);
 
-	inline void set_brdf_coeffs(const glm::vec3 coeffs[SH_NUM_BANDS]) const {
-		glUniform3fv(uni_brdf_coeffs, SH_NUM_BANDS, reinterpret_cast<const GLfloat*>(coeffs));
+	inline void set_brdf_coeffs(const glm::vec3 coeffs[]) const {
+		glUniform3fv(uni_brdf_coeffs, num_bands, reinterpret_cast<const GLfloat*>(coeffs));
 	}
 
 	inline void set_camera_position(const glm::vec3& camera_position) const {
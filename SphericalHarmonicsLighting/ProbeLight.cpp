@@ -0,0 +1,22 @@
+#include "Light.h"
+
+#include "LightProbe.h"
+#include "ScopedTimer.h"
+#include "Util.h"
+
+ProbeLight::ProbeLight(const char * filename, ThreadPool& thread_pool) : filename(filename), thread_pool(thread_pool) { }
+
+void ProbeLight::init(const SH::Sample /*samples*/[], int /*sample_count*/) {
+	ScopedTimer timer("ProbeLight::init");
+
+	LightProbe::project(filename, thread_pool, coefficients);
+
+	// Scaled the same way as HDRProbeLight::get_light, so that both Lights give the same lighting for the same probe
+	for (int n = 0; n < SH_MAX_COEFFICIENT_COUNT; n++) {
+		coefficients[n] *= ONE_OVER_PI;
+	}
+}
+
+void ProbeLight::get_light(int /*count*/, const glm::vec3 /*directions*/[], glm::vec3 /*result*/[]) const {
+	abort();
+}
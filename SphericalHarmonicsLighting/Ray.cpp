@@ -1,6 +1,7 @@
 #include "Ray.h"
 
 #include <algorithm>
+#include <cmath>
 
 #include "VectorMath.h"
 
@@ -12,6 +13,12 @@ void AABB::expand(const AABB& other) {
 	max = max_componentwise(max, other.max);
 }
 
+float AABB::surface_area() const {
+	glm::vec3 size = max - min;
+
+	return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
 AABB Triangle::calc_aabb() const {
 	AABB aabb;
 
@@ -77,7 +84,7 @@ float Ray::trace(const Triangle& triangle, int indices[3], float& u, float& v) c
 	return t;
 }
 
-bool Ray::intersects(const AABB& aabb) const {
+float Ray::trace(const AABB& aabb, float max_distance) const {
 	float inv_direction_x = 1.0f / direction.x;
 	float inv_direction_y = 1.0f / direction.y;
 	float inv_direction_z = 1.0f / direction.z;
@@ -92,7 +99,7 @@ bool Ray::intersects(const AABB& aabb) const {
  
 	if (tymin > tymax) std::swap(tymin, tymax); 
  
-	if ((tmin > tymax) || (tymin > tmax)) return false; 
+	if ((tmin > tymax) || (tymin > tmax)) return INFINITY; 
  
 	if (tymin > tmin) tmin = tymin; 
 	if (tymax < tmax) tmax = tymax; 
@@ -102,7 +109,28 @@ bool Ray::intersects(const AABB& aabb) const {
  
 	if (tzmin > tzmax) std::swap(tzmin, tzmax); 
  
-	if ((tmin > tzmax) || (tzmin > tmax)) return false; 
+	if ((tmin > tzmax) || (tzmin > tmax)) return INFINITY; 
+
+	if (tzmin > tmin) tmin = tzmin;
+	if (tzmax < tmax) tmax = tzmax;
+
+	// Clip the interval against the valid range of the Ray
+	if (tmin < 0.0f)         tmin = 0.0f;
+	if (tmax > max_distance) tmax = max_distance;
+
+	if (tmin > tmax) return INFINITY;
  
-	return true;
+	return tmin;
+}
+
+TraversalRay::TraversalRay(const Ray& ray) {
+	origin    = ray.origin;
+	direction = ray.direction;
+
+	inv_direction = 1.0f / direction;
+
+	// The sign bit is used rather than a comparison with zero, so that a component of -0 (whose inverse is -infinity) is considered negative as well
+	direction_sign[0] = std::signbit(direction.x);
+	direction_sign[1] = std::signbit(direction.y);
+	direction_sign[2] = std::signbit(direction.z);
 }
@@ -1,4 +1,6 @@
 #pragma once
+#include <algorithm>
+
 #include <glm/glm.hpp>
 
 #define EPSILON 0.001f
@@ -9,6 +11,8 @@ struct AABB {
 	glm::vec3 max;
 
 	void expand(const AABB& other);
+
+	float surface_area() const;
 };
 
 struct Plane {
@@ -32,5 +36,40 @@ struct Ray {
 	bool  intersects(const Triangle& triangle) const;
 	float trace     (const Triangle& triangle, int indices[3], float& u, float& v) const;
 
-	bool intersects(const AABB& aabb) const;
+	// Returns the distance at which the Ray enters the AABB, or INFINITY if the Ray misses the AABB.
+	// Hits behind the origin of the Ray or further away than max_distance are also considered misses.
+	// NOTE: BVH traversal uses the faster TraversalRay::trace instead
+	float trace(const AABB& aabb, float max_distance = INFINITY) const;
+};
+
+// Ray that caches data that stays constant during BVH traversal, so that it is only calculated once per Ray instead of once per AABB test
+struct TraversalRay : public Ray {
+	glm::vec3 inv_direction;
+	int       direction_sign[3]; // 1 if the sign bit of the direction is set along the corresponding axis, 0 otherwise
+
+	TraversalRay() { }
+	TraversalRay(const Ray& ray);
+
+	using Ray::trace; // Don't hide the Triangle overload
+
+	// Branchless version of Ray::trace(const AABB&, float)
+	// Returns the distance at which the Ray enters the AABB, or INFINITY if the Ray misses the AABB
+	inline float trace(const AABB& aabb, float max_distance = INFINITY) const {
+		// The sign of the direction determines which side of the slab is entered first along every axis,
+		// this avoids the swaps that are needed if the order is unknown
+		const glm::vec3 * bounds = &aabb.min; // bounds[0] is min, bounds[1] is max
+
+		float tmin_x = (bounds[    direction_sign[0]].x - origin.x) * inv_direction.x;
+		float tmax_x = (bounds[1 - direction_sign[0]].x - origin.x) * inv_direction.x;
+		float tmin_y = (bounds[    direction_sign[1]].y - origin.y) * inv_direction.y;
+		float tmax_y = (bounds[1 - direction_sign[1]].y - origin.y) * inv_direction.y;
+		float tmin_z = (bounds[    direction_sign[2]].z - origin.z) * inv_direction.z;
+		float tmax_z = (bounds[1 - direction_sign[2]].z - origin.z) * inv_direction.z;
+
+		// std::min and std::max on floats compile to minss / maxss, so there are no branches up until the final select
+		float tmin = std::max(std::max(tmin_x, tmin_y), std::max(tmin_z, 0.0f));
+		float tmax = std::min(std::min(tmax_x, tmax_y), std::min(tmax_z, max_distance));
+
+		return tmin <= tmax ? tmin : INFINITY;
+	}
 };
@@ -0,0 +1,193 @@
+#include "RayPacket.h"
+
+#include <cmath>
+
+#include <immintrin.h>
+
+#include "SIMD.h"
+
+#include "Util.h"
+
+void RayPacketHits::init() {
+	for (int i = 0; i < RAY_PACKET_MAX_SIZE; i++) {
+		distances       [i] = INFINITY;
+		triangle_indices[i] = INVALID;
+	}
+}
+
+void RayPacket::init(const glm::vec3& origin, int ray_count, const glm::vec3 directions[]) {
+	assert(ray_count <= RAY_PACKET_MAX_SIZE);
+
+	this->origin    = origin;
+	this->ray_count = ray_count;
+
+	for (int i = 0; i < RAY_PACKET_MAX_SIZE; i++) {
+		// Unused lanes are filled with zeroes, they are never part of an active mask
+		if (i >= ray_count) {
+			inv_direction_x[i] = 0.0f;
+			inv_direction_y[i] = 0.0f;
+			inv_direction_z[i] = 0.0f;
+
+			direction_negative_x[i] = 0;
+			direction_negative_y[i] = 0;
+			direction_negative_z[i] = 0;
+
+			continue;
+		}
+
+		Ray ray;
+		ray.origin    = origin;
+		ray.direction = directions[i];
+
+		rays[i] = TraversalRay(ray);
+
+		inv_direction_x[i] = rays[i].inv_direction.x;
+		inv_direction_y[i] = rays[i].inv_direction.y;
+		inv_direction_z[i] = rays[i].inv_direction.z;
+
+		// Same as TraversalRay::direction_sign, a component of -0 is negative since its inverse is -infinity
+		direction_negative_x[i] = std::signbit(directions[i].x) ? 0xffffffff : 0;
+		direction_negative_y[i] = std::signbit(directions[i].y) ? 0xffffffff : 0;
+		direction_negative_z[i] = std::signbit(directions[i].z) ? 0xffffffff : 0;
+	}
+}
+
+// Returns true if the point lies strictly inside the AABB
+static inline bool aabb_contains(const AABB& aabb, const glm::vec3& point) {
+	return
+		point.x > aabb.min.x && point.x < aabb.max.x &&
+		point.y > aabb.min.y && point.y < aabb.max.y &&
+		point.z > aabb.min.z && point.z < aabb.max.z;
+}
+
+// The SIMD kernels below perform exactly the same operations as TraversalRay::trace(const AABB&, float).
+// Because the origin is shared, the AABB relative to the origin can be calculated once for the whole RayPacket,
+// which gives the same values as the per Ray subtraction in TraversalRay::trace.
+// std::max(a, b) is defined as (a < b) ? b : a, which is equivalent to _mm_max_ps(b, a) including for NaNs and signed zeroes.
+// Likewise std::min(a, b) is equivalent to _mm_min_ps(b, a)
+
+// max_distances is NULL if all Rays have an infinite maximum distance
+
+static u8 intersects_scalar(const RayPacket& packet, const AABB& aabb, const float max_distances[], int group, u8 active) {
+	u8 hit = 0;
+
+	for (int lane = 0; lane < 8; lane++) {
+		float max_distance = max_distances ? max_distances[8*group + lane] : INFINITY;
+
+		if ((active & (1 << lane)) && packet.rays[8*group + lane].trace(aabb, max_distance) != INFINITY) {
+			hit |= 1 << lane;
+		}
+	}
+
+	return hit;
+}
+
+static u8 intersects_sse(const RayPacket& packet, const glm::vec3& lo, const glm::vec3& hi, const float max_distances[], int group) {
+	const __m128 lo_x = _mm_set1_ps(lo.x), lo_y = _mm_set1_ps(lo.y), lo_z = _mm_set1_ps(lo.z);
+	const __m128 hi_x = _mm_set1_ps(hi.x), hi_y = _mm_set1_ps(hi.y), hi_z = _mm_set1_ps(hi.z);
+
+	u8 hit = 0;
+
+	// A group of 8 Rays is processed in two halves of 4
+	for (int half = 0; half < 2; half++) {
+		int i = 8*group + 4*half;
+
+		__m128 negative_x = _mm_castsi128_ps(_mm_load_si128(reinterpret_cast<const __m128i *>(packet.direction_negative_x + i)));
+		__m128 negative_y = _mm_castsi128_ps(_mm_load_si128(reinterpret_cast<const __m128i *>(packet.direction_negative_y + i)));
+		__m128 negative_z = _mm_castsi128_ps(_mm_load_si128(reinterpret_cast<const __m128i *>(packet.direction_negative_z + i)));
+
+		__m128 inv_direction_x = _mm_load_ps(packet.inv_direction_x + i);
+		__m128 inv_direction_y = _mm_load_ps(packet.inv_direction_y + i);
+		__m128 inv_direction_z = _mm_load_ps(packet.inv_direction_z + i);
+
+		// Select the near and far side of every slab based on the sign of the direction. SSE2 does not have a blend instruction
+		__m128 tmin_x = _mm_mul_ps(_mm_or_ps(_mm_and_ps(negative_x, hi_x), _mm_andnot_ps(negative_x, lo_x)), inv_direction_x);
+		__m128 tmax_x = _mm_mul_ps(_mm_or_ps(_mm_and_ps(negative_x, lo_x), _mm_andnot_ps(negative_x, hi_x)), inv_direction_x);
+		__m128 tmin_y = _mm_mul_ps(_mm_or_ps(_mm_and_ps(negative_y, hi_y), _mm_andnot_ps(negative_y, lo_y)), inv_direction_y);
+		__m128 tmax_y = _mm_mul_ps(_mm_or_ps(_mm_and_ps(negative_y, lo_y), _mm_andnot_ps(negative_y, hi_y)), inv_direction_y);
+		__m128 tmin_z = _mm_mul_ps(_mm_or_ps(_mm_and_ps(negative_z, hi_z), _mm_andnot_ps(negative_z, lo_z)), inv_direction_z);
+		__m128 tmax_z = _mm_mul_ps(_mm_or_ps(_mm_and_ps(negative_z, lo_z), _mm_andnot_ps(negative_z, hi_z)), inv_direction_z);
+
+		__m128 tmin = _mm_max_ps(_mm_max_ps(_mm_setzero_ps(),       tmin_z), _mm_max_ps(tmin_y, tmin_x));
+		__m128 max_distance = max_distances ? _mm_load_ps(max_distances + i) : _mm_set1_ps(INFINITY);
+
+		__m128 tmax = _mm_min_ps(_mm_min_ps(max_distance, tmax_z), _mm_min_ps(tmax_y, tmax_x));
+
+		hit |= _mm_movemask_ps(_mm_cmple_ps(tmin, tmax)) << (4*half);
+	}
+
+	return hit;
+}
+
+static u8 intersects_avx2(const RayPacket& packet, const glm::vec3& lo, const glm::vec3& hi, const float max_distances[], int group) {
+	const __m256 lo_x = _mm256_set1_ps(lo.x), lo_y = _mm256_set1_ps(lo.y), lo_z = _mm256_set1_ps(lo.z);
+	const __m256 hi_x = _mm256_set1_ps(hi.x), hi_y = _mm256_set1_ps(hi.y), hi_z = _mm256_set1_ps(hi.z);
+
+	int i = 8*group;
+
+	__m256 negative_x = _mm256_castsi256_ps(_mm256_load_si256(reinterpret_cast<const __m256i *>(packet.direction_negative_x + i)));
+	__m256 negative_y = _mm256_castsi256_ps(_mm256_load_si256(reinterpret_cast<const __m256i *>(packet.direction_negative_y + i)));
+	__m256 negative_z = _mm256_castsi256_ps(_mm256_load_si256(reinterpret_cast<const __m256i *>(packet.direction_negative_z + i)));
+
+	__m256 inv_direction_x = _mm256_load_ps(packet.inv_direction_x + i);
+	__m256 inv_direction_y = _mm256_load_ps(packet.inv_direction_y + i);
+	__m256 inv_direction_z = _mm256_load_ps(packet.inv_direction_z + i);
+
+	// Select the near and far side of every slab based on the sign of the direction
+	__m256 tmin_x = _mm256_mul_ps(_mm256_blendv_ps(lo_x, hi_x, negative_x), inv_direction_x);
+	__m256 tmax_x = _mm256_mul_ps(_mm256_blendv_ps(hi_x, lo_x, negative_x), inv_direction_x);
+	__m256 tmin_y = _mm256_mul_ps(_mm256_blendv_ps(lo_y, hi_y, negative_y), inv_direction_y);
+	__m256 tmax_y = _mm256_mul_ps(_mm256_blendv_ps(hi_y, lo_y, negative_y), inv_direction_y);
+	__m256 tmin_z = _mm256_mul_ps(_mm256_blendv_ps(lo_z, hi_z, negative_z), inv_direction_z);
+	__m256 tmax_z = _mm256_mul_ps(_mm256_blendv_ps(hi_z, lo_z, negative_z), inv_direction_z);
+
+	__m256 tmin = _mm256_max_ps(_mm256_max_ps(_mm256_setzero_ps(),       tmin_z), _mm256_max_ps(tmin_y, tmin_x));
+	__m256 max_distance = max_distances ? _mm256_load_ps(max_distances + i) : _mm256_set1_ps(INFINITY);
+
+	__m256 tmax = _mm256_min_ps(_mm256_min_ps(max_distance, tmax_z), _mm256_min_ps(tmax_y, tmax_x));
+
+	return u8(_mm256_movemask_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ)));
+}
+
+bool RayPacket::intersects(const AABB& aabb, const RayPacketMask& active, RayPacketMask& hit) const {
+	return intersects(aabb, active, NULL, hit);
+}
+
+bool RayPacket::intersects(const AABB& aabb, const RayPacketMask& active, const float max_distances[RAY_PACKET_MAX_SIZE], RayPacketMask& hit) const {
+	// All Rays start inside the AABB, so they enter it at distance zero, which is never beyond their maximum distance
+	if (aabb_contains(aabb, origin)) {
+		hit = active;
+
+		return active.any();
+	}
+
+	glm::vec3 lo = aabb.min - origin;
+	glm::vec3 hi = aabb.max - origin;
+
+	SIMD::Level level = SIMD::get_level();
+
+	bool any_hit = false;
+
+	for (int group = 0; group < RAY_PACKET_MASK_SIZE; group++) {
+		// Skip groups of 8 Rays that are all inactive
+		if (active.bits[group] == 0) {
+			hit.bits[group] = 0;
+
+			continue;
+		}
+
+		u8 group_hit;
+		switch (level) {
+			case SIMD::Level::SCALAR: group_hit = intersects_scalar(*this, aabb, max_distances, group, active.bits[group]); break;
+			case SIMD::Level::SSE:    group_hit = intersects_sse   (*this, lo, hi, max_distances, group);                   break;
+			case SIMD::Level::AVX2:   group_hit = intersects_avx2  (*this, lo, hi, max_distances, group);                   break;
+
+			default: abort();
+		}
+
+		hit.bits[group] = group_hit & active.bits[group];
+		any_hit |= hit.bits[group] != 0;
+	}
+
+	return any_hit;
+}
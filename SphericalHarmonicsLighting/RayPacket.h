@@ -0,0 +1,80 @@
+#pragma once
+#include "Ray.h"
+
+#include "Types.h"
+
+// Maximum number of Rays in a RayPacket, should be a multiple of 8
+#define RAY_PACKET_MAX_SIZE 64
+// Number of bytes needed to store one bit per Ray of a RayPacket
+#define RAY_PACKET_MASK_SIZE (RAY_PACKET_MAX_SIZE / 8)
+
+// Bitmask with one bit per Ray of a RayPacket, bit i of byte j corresponds to Ray 8*j + i
+struct RayPacketMask {
+	u8 bits[RAY_PACKET_MASK_SIZE];
+
+	inline bool get(int ray_index) const {
+		return (bits[ray_index >> 3] >> (ray_index & 7)) & 1;
+	}
+
+	inline void set(int ray_index) {
+		bits[ray_index >> 3] |= 1 << (ray_index & 7);
+	}
+
+	inline void clear(int ray_index) {
+		bits[ray_index >> 3] &= ~(1 << (ray_index & 7));
+	}
+
+	inline bool any() const {
+		for (int i = 0; i < RAY_PACKET_MASK_SIZE; i++) {
+			if (bits[i]) return true;
+		}
+
+		return false;
+	}
+};
+
+// Closest hits of the Rays of a RayPacket, indexed by Ray.
+// Before tracing, distances contains the maximum distance of every Ray. Rays that hit a Triangle closer than that get their
+// distance, Triangle index and barycentric coordinates updated, the entries of all other Rays are left untouched
+struct RayPacketHits {
+	alignas(32) float distances[RAY_PACKET_MAX_SIZE];
+
+	int   triangle_indices[RAY_PACKET_MAX_SIZE];
+	float u[RAY_PACKET_MAX_SIZE];
+	float v[RAY_PACKET_MAX_SIZE];
+
+	// Sets all distances to INFINITY and all Triangle indices to INVALID
+	void init();
+};
+
+// Group of Rays that share the same origin, which are traced through a BVH together.
+// Besides the TraversalRays themselves, the inverse directions and direction signs are stored in SoA layout,
+// so that an AABB can be tested against 4 (SSE) or 8 (AVX2) Rays at once
+struct RayPacket {
+	glm::vec3 origin;
+
+	int          ray_count;
+	TraversalRay rays[RAY_PACKET_MAX_SIZE];
+
+	alignas(32) float inv_direction_x[RAY_PACKET_MAX_SIZE];
+	alignas(32) float inv_direction_y[RAY_PACKET_MAX_SIZE];
+	alignas(32) float inv_direction_z[RAY_PACKET_MAX_SIZE];
+
+	// All bits set if the sign bit of the direction is set along the corresponding axis, 0 otherwise
+	alignas(32) u32 direction_negative_x[RAY_PACKET_MAX_SIZE];
+	alignas(32) u32 direction_negative_y[RAY_PACKET_MAX_SIZE];
+	alignas(32) u32 direction_negative_z[RAY_PACKET_MAX_SIZE];
+
+	// Initializes the RayPacket with rays sharing the given origin, ray_count cannot exceed RAY_PACKET_MAX_SIZE
+	void init(const glm::vec3& origin, int ray_count, const glm::vec3 directions[]);
+
+	// Tests the AABB against all Rays that are set in the active mask, the result is stored in the hit mask.
+	// For every Ray the result is exactly the same as TraversalRay::trace(aabb) != INFINITY.
+	// An AABB that strictly contains the shared origin is hit by every Ray, in that case the slab tests are skipped.
+	// Returns true if any Ray hit the AABB
+	bool intersects(const AABB& aabb, const RayPacketMask& active, RayPacketMask& hit) const;
+
+	// Same as above, but Ray i only hits the AABB if it enters it no further than max_distances[i], which should not be negative.
+	// For every Ray the result is exactly the same as TraversalRay::trace(aabb, max_distances[i]) != INFINITY
+	bool intersects(const AABB& aabb, const RayPacketMask& active, const float max_distances[RAY_PACKET_MAX_SIZE], RayPacketMask& hit) const;
+};
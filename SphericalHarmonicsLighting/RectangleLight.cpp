@@ -0,0 +1,55 @@
+#include "Light.h"
+
+#include "Util.h"
+
+void RectangleLight::update() {
+	glm::vec3 normal = glm::cross(axis_u, axis_v);
+
+	// The origin only receives light if it is on the emitting side of the rectangle
+	if (glm::dot(normal, center) >= 0.0f) {
+		for (int n = 0; n < SH_MAX_COEFFICIENT_COUNT; n++) {
+			coefficients[n] = glm::vec3(0.0f, 0.0f, 0.0f);
+		}
+
+		return;
+	}
+
+	// Project the corners onto the unit sphere, which turns the rectangle into a spherical polygon
+	glm::vec3 vertices[4] = {
+		glm::normalize(center - axis_u - axis_v),
+		glm::normalize(center + axis_u - axis_v),
+		glm::normalize(center + axis_u + axis_v),
+		glm::normalize(center - axis_u + axis_v)
+	};
+
+	float polygon_coeffs[SH_MAX_COEFFICIENT_COUNT];
+	SH::project_polygon(4, vertices, polygon_coeffs);
+
+	for (int n = 0; n < SH_MAX_COEFFICIENT_COUNT; n++) {
+		coefficients[n] = color * polygon_coeffs[n];
+	}
+}
+
+void RectangleLight::get_light(int count, const glm::vec3 directions[], glm::vec3 result[]) const {
+	glm::vec3 normal = glm::cross(axis_u, axis_v);
+
+	float normal_dot_center = glm::dot(normal, center);
+
+	float axis_u_length_squared = glm::dot(axis_u, axis_u);
+	float axis_v_length_squared = glm::dot(axis_v, axis_v);
+
+	for (int i = 0; i < count; i++) {
+		result[i] = glm::vec3(0.0f, 0.0f, 0.0f);
+
+		// The ray from the origin has to hit the emitting side of the rectangle, in front of the origin
+		float normal_dot_direction = glm::dot(normal, directions[i]);
+		if (normal_dot_center >= 0.0f || normal_dot_direction >= 0.0f) continue;
+
+		glm::vec3 offset = (normal_dot_center / normal_dot_direction) * directions[i] - center;
+
+		if (abs(glm::dot(offset, axis_u)) <= axis_u_length_squared &&
+			abs(glm::dot(offset, axis_v)) <= axis_v_length_squared) {
+			result[i] = color;
+		}
+	}
+}
@@ -1,6 +1,16 @@
 #include "SHRotation.h"
 
+#include <cstring>
+
+#include <immintrin.h>
+
 #include "SphericalHarmonics.h"
+#include "SIMD.h"
+#include "SIMDLanes.h"
+#include "ThreadPool.h"
+
+// Converts l, m representation into a 1 dimensional index
+#define SH_INDEX(l, m) (l * (l+1) + m)
 
 /*
 	Rotation matrix recurrence relation based on the 1996 paper 
@@ -10,14 +20,18 @@
 
 // Square Matrix of size 2l + 1 for a given l
 // Can be indexed using indices in the range [-l, l]
+// Every element holds one value per SIMD lane, which allows the recurrence relation to build multiple rotation matrices at once
+template<typename Lanes>
 struct Matrix {
 public:
+	typedef typename Lanes::Type Float;
+
 	inline void set_order(int l) {
 		this->l    = l;
 		this->size = 2*l + 1;
 	}
 
-	inline void set(int row, int col, float value) {
+	inline void set(int row, int col, Float value) {
 		row += l;
 		col += l;
 
@@ -27,7 +41,7 @@ public:
 		data[row * size + col] = value;
 	}
 
-	inline float operator()(int row, int col) const {
+	inline Float operator()(int row, int col) const {
 		row += l;
 		col += l;
 		
@@ -40,7 +54,7 @@ public:
 private:
 	int l;
 	int size;
-	float data[4 * SH_NUM_BANDS*SH_NUM_BANDS + 4*SH_NUM_BANDS + 1]; // Upper bound, derived by expanding (2l+1) * (2l+1)
+	Float data[4 * SH_MAX_NUM_BANDS*SH_MAX_NUM_BANDS + 4*SH_MAX_NUM_BANDS + 1]; // Upper bound, derived by expanding (2l+1) * (2l+1)
 };
 
 // Kronecker Delta, 1 if the supplied indices are the same, 0 otherwise
@@ -48,80 +62,121 @@ private:
 
 // Formula for the size of the precalulated arrays for u,v,w
 // Derived by expanding the summation: \sum_{l=0}^{b-1} (2l+1) (2l+1)
-#define SH_ARRAY_COUNT (2*SH_NUM_BANDS * (SH_NUM_BANDS - 1) * (2*SH_NUM_BANDS - 1)) / 3 + 2*SH_NUM_BANDS*SH_NUM_BANDS - SH_NUM_BANDS
-
-// Precalculated arrays to avoid having to calculate the u,v,w functions every time
-float u_array[SH_ARRAY_COUNT];
-float v_array[SH_ARRAY_COUNT];
-float w_array[SH_ARRAY_COUNT];
-
-float u(int l, int m, int n) {
-	if (abs(n) < l) {
-		return sqrt(
-			(float)((l + m) * (l - m)) /
-			(float)((l + n) * (l - n))
-		);
+constexpr int get_rotation_table_size(int b) {
+	return (2*b * (b - 1) * (2*b - 1)) / 3 + 2*b*b - b;
+}
+
+constexpr int abs_constexpr(int x) {
+	return x < 0 ? -x : x;
+}
+
+constexpr float u(int l, int m, int n) {
+	if (abs_constexpr(n) < l) {
+		return float(SH::constexpr_sqrt(
+			(double)((l + m) * (l - m)) /
+			(double)((l + n) * (l - n))
+		));
 	} else {
-		return sqrt(
-			(float)((l + m) * (l - m)) /
-			(float)((2*l) * (2*l - 1))
-		);
+		return float(SH::constexpr_sqrt(
+			(double)((l + m) * (l - m)) /
+			(double)((2*l) * (2*l - 1))
+		));
 	}
 }
 
-float v(int l, int m, int n) {
-	if (abs(n) < l) {
-		return 0.5f * sqrt(
-			(float)((1.0f + DELTA(m, 0)) * (l + abs(m) - 1) * (l + abs(m))) /
-			(float)((l + n) * (l - n))) *
+constexpr float v(int l, int m, int n) {
+	if (abs_constexpr(n) < l) {
+		return 0.5f * float(SH::constexpr_sqrt(
+			(double)((1.0f + DELTA(m, 0)) * (l + abs_constexpr(m) - 1) * (l + abs_constexpr(m))) /
+			(double)((l + n) * (l - n)))) *
 				(1.0f - 2.0f * DELTA(m, 0));
 	} else {
-		return 0.5f * sqrt(
-			(float)((1.0f + DELTA(m, 0)) * (l + abs(m) - 1) * (l + abs(m))) /
-			(float)((2*l) * (2*l - 1))) *
+		return 0.5f * float(SH::constexpr_sqrt(
+			(double)((1.0f + DELTA(m, 0)) * (l + abs_constexpr(m) - 1) * (l + abs_constexpr(m))) /
+			(double)((2*l) * (2*l - 1)))) *
 				(1.0f - 2.0f * DELTA(m, 0));
 	}
 }
 
-float w(int l, int m, int n) {
-	if (abs(n) < l) {
-		return -0.5f * sqrt(
-			(float)((l - abs(m) - 1) * (l - abs(m))) /
-			(float)((l + n) * (l - n))) *
+constexpr float w(int l, int m, int n) {
+	if (abs_constexpr(n) < l) {
+		return -0.5f * float(SH::constexpr_sqrt(
+			(double)((l - abs_constexpr(m) - 1) * (l - abs_constexpr(m))) /
+			(double)((l + n) * (l - n)))) *
 				(1.0f - DELTA(m, 0));
 	} else {
-		return -0.5f * sqrt(
-			(float)((l - abs(m) - 1) * (l - abs(m))) /
-			(float)((2*l) * (2*l - 1))) *
+		return -0.5f * float(SH::constexpr_sqrt(
+			(double)((l - abs_constexpr(m) - 1) * (l - abs_constexpr(m))) /
+			(double)((2*l) * (2*l - 1)))) *
 				(1.0f - DELTA(m, 0));
 	}
 }
 
-float P(const Matrix& R, const Matrix& prev_M, int l, int i, int a, int b) {
+// Precalculated arrays to avoid having to calculate the u,v,w functions every time.
+// Generated at compile time for every number of bands, so there is no global state that needs to be initialized
+template<int NumBands>
+struct RotationTable {
+	float u[get_rotation_table_size(NumBands)] = { };
+	float v[get_rotation_table_size(NumBands)] = { };
+	float w[get_rotation_table_size(NumBands)] = { };
+
+	constexpr RotationTable() {
+		int index = 1;
+
+		for (int l = 1; l < NumBands; l++) {
+			for (int m = -l; m <= l; m++) {
+				for (int n = -l; n <= l; n++) {
+					u[index] = ::u(l, m, n);
+					v[index] = ::v(l, m, n);
+					w[index] = ::w(l, m, n);
+
+					index++;
+				}
+			}
+		}
+	}
+};
+
+template<int NumBands>
+static const RotationTable<NumBands>& get_rotation_table() {
+	// Constant initialized, so no initialization happens at runtime
+	static constexpr RotationTable<NumBands> table;
+
+	return table;
+}
+
+template<typename Lanes>
+static typename Lanes::Type P(const Matrix<Lanes>& R, const Matrix<Lanes>& prev_M, int l, int i, int a, int b) {
 	if (b == l) {
-		return R(i,  1) * prev_M(a,  l - 1) -
-			   R(i, -1) * prev_M(a, -l + 1);
+		return Lanes::sub(
+			Lanes::mul(R(i,  1), prev_M(a,  l - 1)),
+			Lanes::mul(R(i, -1), prev_M(a, -l + 1))
+		);
 	} else if (b == -l) {
-		return R(i,  1) * prev_M(a, -l + 1) +
-			   R(i, -1) * prev_M(a,  l - 1);
+		return Lanes::add(
+			Lanes::mul(R(i,  1), prev_M(a, -l + 1)),
+			Lanes::mul(R(i, -1), prev_M(a,  l - 1))
+		);
 	} else { // If abs(b) < l
-		return R(i,  0) * prev_M(a, b);
+		return Lanes::mul(R(i, 0), prev_M(a, b));
 	}
 }
 
-float U(const Matrix& R, const Matrix& prev_M, int l, int m, int n) {
+template<typename Lanes>
+static typename Lanes::Type U(const Matrix<Lanes>& R, const Matrix<Lanes>& prev_M, int l, int m, int n) {
 	return P(R, prev_M, l, 0, m, n);
 }
 
-float V(const Matrix& R, const Matrix& prev_M, int l, int m, int n) {
+template<typename Lanes>
+static typename Lanes::Type V(const Matrix<Lanes>& R, const Matrix<Lanes>& prev_M, int l, int m, int n) {
 	const float sqrt_2 = 1.41421356237f; // Square root of 2
 
 	if (m > 0) {
 		// Branch because of the kronecker delta in the original formula
 		if (m == 1) {
-			return P(R, prev_M, l,  1,  m - 1, n) * sqrt_2;
+			return Lanes::mul(P(R, prev_M, l,  1,  m - 1, n), Lanes::set(sqrt_2));
 		} else {
-			return P(R, prev_M, l,  1,  m - 1, n) - P(R, prev_M, l, -1, -m + 1, n);
+			return Lanes::sub(P(R, prev_M, l,  1,  m - 1, n), P(R, prev_M, l, -1, -m + 1, n));
 		}
 	} else if (m < 0) {
 		// @NOTE: Both Green's and Ivanic' papers are wrong in this case!
@@ -129,74 +184,82 @@ float V(const Matrix& R, const Matrix& prev_M, int l, int m, int n) {
 
 		// Branch because of the kronecker delta in the original formula
 		if (m == -1) {
-			return P(R, prev_M, l, -1, -m - 1, n) * sqrt_2;
+			return Lanes::mul(P(R, prev_M, l, -1, -m - 1, n), Lanes::set(sqrt_2));
 		} else {
-			return P(R, prev_M, l,  1,  m + 1, n) + P(R, prev_M, l, -1, -m - 1, n);
+			return Lanes::add(P(R, prev_M, l,  1,  m + 1, n), P(R, prev_M, l, -1, -m - 1, n));
 		}
 	} else { // If m == 0
-		return P(R, prev_M, l, 1, 1, n) + P(R, prev_M, l, -1, -1, n);
+		return Lanes::add(P(R, prev_M, l, 1, 1, n), P(R, prev_M, l, -1, -1, n));
 	}
 }
 
-float W(const Matrix& R, const Matrix& prev_M, int l, int m, int n) {
+template<typename Lanes>
+static typename Lanes::Type W(const Matrix<Lanes>& R, const Matrix<Lanes>& prev_M, int l, int m, int n) {
 	assert(m != 0);
 
 	if (m > 0) {
-		return P(R, prev_M, l, 1, m + 1, n) + P(R, prev_M, l, -1, -m - 1, n);
+		return Lanes::add(P(R, prev_M, l, 1, m + 1, n), P(R, prev_M, l, -1, -m - 1, n));
 	} else { // If m < 0
-		return P(R, prev_M, l, 1, m - 1, n) - P(R, prev_M, l, -1, -m + 1, n);
+		return Lanes::sub(P(R, prev_M, l, 1, m - 1, n), P(R, prev_M, l, -1, -m + 1, n));
 	}
 }
 
-void SH::init_rotation() {
-	int index = 1;
-
-	for (int l = 1; l < SH_NUM_BANDS; l++) {
-		for (int m = -l; m <= l; m++) {
-			for (int n = -l; n <= l; n++) {
-				u_array[index] = u(l, m, n);
-				v_array[index] = v(l, m, n);
-				w_array[index] = w(l, m, n);
-
-				index++;
-			}
-		}
-	}
-}
+// Converts Quaternions into Matrix form, using the same operations as glm::mat3_cast.
+// The Rotation Matrix is permuted such that it can be accessed using indices -1, 0, 1
+template<typename Lanes>
+static void init_R(Matrix<Lanes>& R, typename Lanes::Type x, typename Lanes::Type y, typename Lanes::Type z, typename Lanes::Type w) {
+	typedef typename Lanes::Type Float;
+
+	Float qxx = Lanes::mul(x, x);
+	Float qyy = Lanes::mul(y, y);
+	Float qzz = Lanes::mul(z, z);
+	Float qxz = Lanes::mul(x, z);
+	Float qxy = Lanes::mul(x, y);
+	Float qyz = Lanes::mul(y, z);
+	Float qwx = Lanes::mul(w, x);
+	Float qwy = Lanes::mul(w, y);
+	Float qwz = Lanes::mul(w, z);
+
+	Float one = Lanes::set(1.0f);
+	Float two = Lanes::set(2.0f);
 
-void SH::rotate(const glm::quat& rotation, const glm::vec3 coeffs_in[], glm::vec3 coeffs_out[]) {
-	// Make sure the input and ouput arrays are not the same memory location
-	assert(coeffs_in != coeffs_out);
+	R.set_order(1);
+	R.set( 1,  1, Lanes::sub(one, Lanes::mul(two, Lanes::add(qyy, qzz)))); // [0][0]
+	R.set(-1,  1, Lanes::mul(two, Lanes::add(qxy, qwz)));                  // [0][1]
+	R.set( 0,  1, Lanes::mul(two, Lanes::sub(qxz, qwy)));                  // [0][2]
 
-	// Convert the Quaternion into Matrix form
-	glm::mat3 rotation_matrix = glm::mat3_cast(rotation);
+	R.set( 1, -1, Lanes::mul(two, Lanes::sub(qxy, qwz)));                  // [1][0]
+	R.set(-1, -1, Lanes::sub(one, Lanes::mul(two, Lanes::add(qxx, qzz)))); // [1][1]
+	R.set( 0, -1, Lanes::mul(two, Lanes::add(qyz, qwx)));                  // [1][2]
 
-	// Permute the Rotation Matrix and put it into a 3x3 Matrix that we can acces using indices -1, 0, 1
-	Matrix R;
-	R.set_order(1);
-	R.set(-1, -1, rotation_matrix[1][1]); R.set(-1, 0, rotation_matrix[2][1]); R.set(-1, 1, rotation_matrix[0][1]);
-	R.set( 0, -1, rotation_matrix[1][2]); R.set( 0, 0, rotation_matrix[2][2]); R.set( 0, 1, rotation_matrix[0][2]);
-	R.set( 1, -1, rotation_matrix[1][0]); R.set( 1, 0, rotation_matrix[2][0]); R.set( 1, 1, rotation_matrix[0][0]);
+	R.set( 1,  0, Lanes::mul(two, Lanes::add(qxz, qwy)));                  // [2][0]
+	R.set(-1,  0, Lanes::mul(two, Lanes::sub(qyz, qwx)));                  // [2][1]
+	R.set( 0,  0, Lanes::sub(one, Lanes::mul(two, Lanes::add(qxx, qyy)))); // [2][2]
+}
 
-	// First harmonic remains unchanged
-	coeffs_out[0] = coeffs_in[0];
+// Builds the rotation matrices of bands 1 to NumBands - 1 and passes them to callback(l, M) one band at a time.
+// The matrices use basis functions without the Condon-Shortley phase (-1)^m that SH::evaluate includes, the callback has to account for this
+template<typename Lanes, int NumBands, typename Callback>
+static void init_bands(const Matrix<Lanes>& R, Callback callback) {
+	typedef typename Lanes::Type Float;
 
 	// Allocate 2 matrices, one will be used as the current matrix, the other as the previous
 	// In the next iteration these roles switch
-	Matrix matrices[2];
+	Matrix<Lanes> matrices[2];
 	
 	// Initialize first matrix as a 1x1 matrix containing 1
 	matrices[0].set_order(0);
-	matrices[0].set(0, 0, 1.0f);
+	matrices[0].set(0, 0, Lanes::set(1.0f));
 
 	int marix_index    = 1;
 	int previous_index = 0;
 
 	// Index for the precalulated u,v,w arrays
+	const RotationTable<NumBands>& table = get_rotation_table<NumBands>();
 	int index = 1;
 
 	// Iterate over bands
-	for (int l = 1; l < SH_NUM_BANDS; l++) {
+	for (int l = 1; l < NumBands; l++) {
 		marix_index = l & 1; // Modulo 2 by performing a bitwise AND with 1
 		matrices[marix_index].set_order(l);
 
@@ -204,17 +267,24 @@ void SH::rotate(const glm::quat& rotation, const glm::vec3 coeffs_in[], glm::vec
 		for (int m = -l; m <= l; m++) {
 			for (int n = -l; n <= l; n++) {
 				// Look up u,v,w in their precalulated arrays
-				float u_ = u_array[index];
-				float v_ = v_array[index];
-				float w_ = w_array[index];
-
-				float M_mn = 0.0f;
-				// Only calulcate U,V,W if u,v,w are non-zero
-				// Not only is this an optimization, U,V,W will index out of
-				// bounds when they are called for any l,m,n that cause u,v,w to be 0
-				if (u_) M_mn += u_ * U(R, matrices[previous_index], l, m, n);
-				if (v_) M_mn += v_ * V(R, matrices[previous_index], l, m, n);
-				if (w_) M_mn += w_ * W(R, matrices[previous_index], l, m, n);
+				float u_ = table.u[index];
+				float v_ = table.v[index];
+				float w_ = table.w[index];
+
+				Float M_mn = Lanes::set(0.0f);
+
+				if (l == 1) {
+					// The recurrence relation only holds from l = 2 onwards, for l = 1 the P function would count the
+					// single element of the 1x1 matrix twice. Band 1 is rotated by the permuted rotation matrix itself
+					M_mn = R(m, n);
+				} else {
+					// Only calulcate U,V,W if u,v,w are non-zero
+					// Not only is this an optimization, U,V,W will index out of
+					// bounds when they are called for any l,m,n that cause u,v,w to be 0
+					if (u_) M_mn = Lanes::add(M_mn, Lanes::mul(Lanes::set(u_), U(R, matrices[previous_index], l, m, n)));
+					if (v_) M_mn = Lanes::add(M_mn, Lanes::mul(Lanes::set(v_), V(R, matrices[previous_index], l, m, n)));
+					if (w_) M_mn = Lanes::add(M_mn, Lanes::mul(Lanes::set(w_), W(R, matrices[previous_index], l, m, n)));
+				}
 
 				matrices[marix_index].set(m , n, M_mn);
 
@@ -222,20 +292,354 @@ void SH::rotate(const glm::quat& rotation, const glm::vec3 coeffs_in[], glm::vec
 			}
 		}
 
-		// Matrix multiply the newly constructed matrix with the appropriate 
-		// input coeffiecients to obtain the appropriate output coffiecients
-		for (int i = -l; i <= l; i++) {
-			glm::vec3 sum(0.0f, 0.0f, 0.0f);
+		callback(l, matrices[marix_index]);
+
+		previous_index = marix_index;
+	}
+}
 
-			int offset = l*(l+1);
+void SH::RotationMatrix::init(const glm::quat& rotation, int num_bands) {
+	this->num_bands = num_bands;
+
+	Matrix<LanesScalar> R;
+	init_R(R, rotation.x, rotation.y, rotation.z, rotation.w);
+
+	dispatch_num_bands(num_bands, [&](auto bands) {
+		init_bands<LanesScalar, decltype(bands)::value>(R, [&](int l, const Matrix<LanesScalar>& M) {
+			// Store the block column major
+			float * block  = blocks + get_rotation_block_offset(l);
+			int     stride = get_rotation_block_stride(l);
 
 			for (int j = -l; j <= l; j++) {
-				sum += matrices[marix_index](i, j) * coeffs_in[offset + j];
+				float * column = block + (j + l) * stride;
+
+				for (int i = -l; i <= l; i++) {
+					// Account for the Condon-Shortley phase of SH::evaluate
+					column[i + l] = (i + j) & 1 ? -M(i, j) : M(i, j);
+				}
+
+				// Zero the padding, so that the SIMD kernels only calculate zeros there
+				for (int p = 2*l + 1; p < stride; p++) {
+					column[p] = 0.0f;
+				}
 			}
+		});
+	});
+}
 
-			coeffs_out[offset + i] = sum;
+// Scalar kernel, multiplies the 2L+1 rgb triplets of band L by its block, every colour channel separately.
+// Every output is the sum over the columns in increasing order, which is the order used by the SIMD kernels as well
+template<int L>
+static void apply_block_scalar(const float * block, const glm::vec3 in[], glm::vec3 out[]) {
+	const int size   = 2*L + 1;
+	const int stride = SH::get_rotation_block_stride(L);
+
+	for (int i = 0; i < size; i++) {
+		glm::vec3 sum(0.0f, 0.0f, 0.0f);
+
+		for (int j = 0; j < size; j++) {
+			sum += block[j * stride + i] * in[j];
 		}
 
-		previous_index = marix_index;
+		out[i] = sum;
+	}
+}
+
+// SSE kernel, 4 rows at a time. Every column is multiplied by the input coefficient of that column, broadcast for r, g and b separately.
+// The sums are computed per colour channel and interleaved into rgb triplets at the end
+template<int L>
+static void apply_block_sse(const float * block, const glm::vec3 in[], glm::vec3 out[]) {
+	const int size           = 2*L + 1;
+	const int stride         = SH::get_rotation_block_stride(L);
+	const int register_count = (size + 3) / 4;
+
+	__m128 sums_r[register_count];
+	__m128 sums_g[register_count];
+	__m128 sums_b[register_count];
+
+	for (int r = 0; r < register_count; r++) {
+		sums_r[r] = _mm_setzero_ps();
+		sums_g[r] = _mm_setzero_ps();
+		sums_b[r] = _mm_setzero_ps();
+	}
+
+	for (int j = 0; j < size; j++) {
+		__m128 in_r = _mm_set1_ps(in[j].r);
+		__m128 in_g = _mm_set1_ps(in[j].g);
+		__m128 in_b = _mm_set1_ps(in[j].b);
+
+		for (int r = 0; r < register_count; r++) {
+			__m128 column = _mm_loadu_ps(block + j * stride + 4*r);
+
+			sums_r[r] = _mm_add_ps(sums_r[r], _mm_mul_ps(column, in_r));
+			sums_g[r] = _mm_add_ps(sums_g[r], _mm_mul_ps(column, in_g));
+			sums_b[r] = _mm_add_ps(sums_b[r], _mm_mul_ps(column, in_b));
+		}
+	}
+
+	float result_r[4 * register_count];
+	float result_g[4 * register_count];
+	float result_b[4 * register_count];
+
+	for (int r = 0; r < register_count; r++) {
+		_mm_storeu_ps(result_r + 4*r, sums_r[r]);
+		_mm_storeu_ps(result_g + 4*r, sums_g[r]);
+		_mm_storeu_ps(result_b + 4*r, sums_b[r]);
+	}
+
+	for (int i = 0; i < size; i++) {
+		out[i] = glm::vec3(result_r[i], result_g[i], result_b[i]);
+	}
+}
+
+// AVX2 kernel, 8 rows at a time
+template<int L>
+static void apply_block_avx2(const float * block, const glm::vec3 in[], glm::vec3 out[]) {
+	const int size           = 2*L + 1;
+	const int stride         = SH::get_rotation_block_stride(L);
+	const int register_count = (size + 7) / 8;
+
+	__m256 sums_r[register_count];
+	__m256 sums_g[register_count];
+	__m256 sums_b[register_count];
+
+	for (int r = 0; r < register_count; r++) {
+		sums_r[r] = _mm256_setzero_ps();
+		sums_g[r] = _mm256_setzero_ps();
+		sums_b[r] = _mm256_setzero_ps();
+	}
+
+	for (int j = 0; j < size; j++) {
+		__m256 in_r = _mm256_set1_ps(in[j].r);
+		__m256 in_g = _mm256_set1_ps(in[j].g);
+		__m256 in_b = _mm256_set1_ps(in[j].b);
+
+		for (int r = 0; r < register_count; r++) {
+			__m256 column = _mm256_loadu_ps(block + j * stride + 8*r);
+
+			sums_r[r] = _mm256_add_ps(sums_r[r], _mm256_mul_ps(column, in_r));
+			sums_g[r] = _mm256_add_ps(sums_g[r], _mm256_mul_ps(column, in_g));
+			sums_b[r] = _mm256_add_ps(sums_b[r], _mm256_mul_ps(column, in_b));
+		}
+	}
+
+	float result_r[8 * register_count];
+	float result_g[8 * register_count];
+	float result_b[8 * register_count];
+
+	for (int r = 0; r < register_count; r++) {
+		_mm256_storeu_ps(result_r + 8*r, sums_r[r]);
+		_mm256_storeu_ps(result_g + 8*r, sums_g[r]);
+		_mm256_storeu_ps(result_b + 8*r, sums_b[r]);
+	}
+
+	for (int i = 0; i < size; i++) {
+		out[i] = glm::vec3(result_r[i], result_g[i], result_b[i]);
+	}
+}
+
+// Kernel that multiplies the coefficients of a single band by its block
+typedef void (*ApplyBlockKernel)(const float * block, const glm::vec3 in[], glm::vec3 out[]);
+
+// Returns the kernels of the current SIMD level, indexed by band. Band 0 has no block
+static const ApplyBlockKernel * get_apply_block_kernels() {
+	static_assert(SH_MAX_NUM_BANDS <= 6, "Add a kernel for every supported band");
+
+	static const ApplyBlockKernel kernels_scalar[SH_MAX_NUM_BANDS] = { nullptr, apply_block_scalar<1>, apply_block_scalar<2>, apply_block_scalar<3>, apply_block_scalar<4>, apply_block_scalar<5> };
+	static const ApplyBlockKernel kernels_sse   [SH_MAX_NUM_BANDS] = { nullptr, apply_block_sse   <1>, apply_block_sse   <2>, apply_block_sse   <3>, apply_block_sse   <4>, apply_block_sse   <5> };
+	static const ApplyBlockKernel kernels_avx2  [SH_MAX_NUM_BANDS] = { nullptr, apply_block_avx2  <1>, apply_block_avx2  <2>, apply_block_avx2  <3>, apply_block_avx2  <4>, apply_block_avx2  <5> };
+
+	switch (SIMD::get_level()) {
+		case SIMD::Level::SCALAR: return kernels_scalar;
+		case SIMD::Level::SSE:    return kernels_sse;
+		case SIMD::Level::AVX2:   return kernels_avx2;
+
+		default: abort();
+	}
+}
+
+static void apply_bands(const SH::RotationMatrix& matrix, int num_bands, const ApplyBlockKernel kernels[], const glm::vec3 coeffs_in[], glm::vec3 coeffs_out[]) {
+	// Make sure the input and ouput arrays are not the same memory location
+	assert(coeffs_in != coeffs_out);
+	assert(num_bands <= matrix.num_bands);
+
+	// First harmonic remains unchanged
+	coeffs_out[0] = coeffs_in[0];
+
+	for (int l = 1; l < num_bands; l++) {
+		int offset = l*l; // Index of the first coefficient of band l, l*(l+1) - l
+
+		kernels[l](matrix.blocks + SH::get_rotation_block_offset(l), coeffs_in + offset, coeffs_out + offset);
+	}
+}
+
+void SH::RotationMatrix::apply(const glm::vec3 coeffs_in[], glm::vec3 coeffs_out[]) const {
+	apply_bands(*this, num_bands, get_apply_block_kernels(), coeffs_in, coeffs_out);
+}
+
+void SH::RotationMatrix::apply(int count, const glm::vec3 coeffs_in[], glm::vec3 coeffs_out[], int stride) const {
+	const ApplyBlockKernel * kernels = get_apply_block_kernels();
+
+	for (int i = 0; i < count; i++) {
+		apply_bands(*this, num_bands, kernels, coeffs_in + i * stride, coeffs_out + i * stride);
+	}
+}
+
+void SH::rotate(const glm::quat& rotation, const glm::vec3 coeffs_in[], glm::vec3 coeffs_out[], int num_bands) {
+	RotationMatrix matrix;
+	matrix.init(rotation, num_bands);
+	matrix.apply(coeffs_in, coeffs_out);
+}
+
+// Number of groups of Lanes::width sets in a single chunk of the parallel_for
+#define ROTATION_BATCH_CHUNK_SIZE 16
+
+// Rotates the Lanes::width consecutive sets starting at set first, every set uses its own SIMD lane
+template<typename Lanes, int NumBands>
+static void rotate_sets(int first, const glm::quat rotations[], const float coeffs_in[], float coeffs_out[], int stride) {
+	typedef typename Lanes::Type Float;
+
+	// Transpose the Quaternions into Structure of Arrays layout
+	float x[Lanes::width];
+	float y[Lanes::width];
+	float z[Lanes::width];
+	float w[Lanes::width];
+
+	for (int t = 0; t < Lanes::width; t++) {
+		x[t] = rotations[first + t].x;
+		y[t] = rotations[first + t].y;
+		z[t] = rotations[first + t].z;
+		w[t] = rotations[first + t].w;
+	}
+
+	Matrix<Lanes> R;
+	init_R(R, Lanes::load(x), Lanes::load(y), Lanes::load(z), Lanes::load(w));
+
+	const float * in  = coeffs_in  + first;
+	float       * out = coeffs_out + first;
+
+	// First harmonic remains unchanged
+	for (int c = 0; c < 3; c++) {
+		Lanes::store(out + c * stride, Lanes::load(in + c * stride));
+	}
+
+	init_bands<Lanes, NumBands>(R, [&](int l, const Matrix<Lanes>& M) {
+		int offset = l*(l+1);
+
+		for (int i = -l; i <= l; i++) {
+			for (int c = 0; c < 3; c++) {
+				Float sum = Lanes::set(0.0f);
+
+				for (int j = -l; j <= l; j++) {
+					Float product = Lanes::mul(M(i, j), Lanes::load(in + (3*(offset + j) + c) * stride));
+
+					// Account for the Condon-Shortley phase of SH::evaluate, subtracting gives the same result as negating the matrix element
+					sum = (i + j) & 1 ? Lanes::sub(sum, product) : Lanes::add(sum, product);
+				}
+
+				Lanes::store(out + (3*(offset + i) + c) * stride, sum);
+			}
+		}
+	});
+}
+
+template<typename Lanes, int NumBands>
+static void rotate_batch(ThreadPool& thread_pool, int count, const glm::quat rotations[], const float coeffs_in[], float coeffs_out[], int stride) {
+	// Sets that do not fill up a complete group are rotated one at a time
+	int group_count = count / Lanes::width;
+	int job_count   = group_count + count % Lanes::width;
+
+	thread_pool.parallel_for(job_count, ROTATION_BATCH_CHUNK_SIZE, [&](int job, int /*thread_index*/) {
+		if (job < group_count) {
+			rotate_sets<Lanes, NumBands>(job * Lanes::width, rotations, coeffs_in, coeffs_out, stride);
+		} else {
+			rotate_sets<LanesScalar, NumBands>(group_count * Lanes::width + job - group_count, rotations, coeffs_in, coeffs_out, stride);
+		}
+	});
+}
+
+void SH::rotate(ThreadPool& thread_pool, int count, const glm::quat rotations[], const float coeffs_in[], float coeffs_out[], int stride, int num_bands) {
+	// Make sure the input and ouput arrays are not the same memory location
+	assert(coeffs_in != coeffs_out);
+	assert(stride >= count);
+
+	dispatch_num_bands(num_bands, [&](auto bands) {
+		const int NumBands = decltype(bands)::value;
+
+		switch (SIMD::get_level()) {
+			case SIMD::Level::SCALAR: rotate_batch<LanesScalar, NumBands>(thread_pool, count, rotations, coeffs_in, coeffs_out, stride); break;
+			case SIMD::Level::SSE:    rotate_batch<LanesSSE,    NumBands>(thread_pool, count, rotations, coeffs_in, coeffs_out, stride); break;
+			case SIMD::Level::AVX2:   rotate_batch<LanesAVX2,   NumBands>(thread_pool, count, rotations, coeffs_in, coeffs_out, stride); break;
+
+			default: abort();
+		}
+	});
+}
+
+// Rotates around the z axis, which only mixes the coefficients m and -m of every band.
+// cos(m angle) and sin(m angle) are obtained by repeatedly multiplying by cos(angle) + i sin(angle)
+static void rotate_z(float angle, const glm::vec3 coeffs_in[], glm::vec3 coeffs_out[], int num_bands) {
+	float cos_angle = cos(angle);
+	float sin_angle = sin(angle);
+
+	for (int l = 0; l < num_bands; l++) {
+		coeffs_out[SH_INDEX(l, 0)] = coeffs_in[SH_INDEX(l, 0)];
+
+		float c = 1.0f;
+		float s = 0.0f;
+
+		for (int m = 1; m <= l; m++) {
+			float c_next = c * cos_angle - s * sin_angle;
+			float s_next = s * cos_angle + c * sin_angle;
+			c = c_next;
+			s = s_next;
+
+			glm::vec3 coeff_pos = coeffs_in[SH_INDEX(l,  m)];
+			glm::vec3 coeff_neg = coeffs_in[SH_INDEX(l, -m)];
+
+			coeffs_out[SH_INDEX(l,  m)] = c * coeff_pos - s * coeff_neg;
+			coeffs_out[SH_INDEX(l, -m)] = c * coeff_neg + s * coeff_pos;
+		}
+	}
+}
+
+void SH::rotate_zyz(float alpha, float beta, float gamma, const glm::vec3 coeffs_in[], glm::vec3 coeffs_out[], int num_bands) {
+	// A rotation around y is a rotation around z in a frame that is rotated 90 degrees around x.
+	// These matrices are built once, on first use, which is thread safe
+	static const RotationMatrix x_minus_90 = [] {
+		RotationMatrix matrix;
+		matrix.init(glm::angleAxis(DEG_TO_RAD(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f)));
+		return matrix;
+	}();
+	static const RotationMatrix x_plus_90 = [] {
+		RotationMatrix matrix;
+		matrix.init(glm::angleAxis(DEG_TO_RAD(+90.0f), glm::vec3(1.0f, 0.0f, 0.0f)));
+		return matrix;
+	}();
+
+	const ApplyBlockKernel * kernels = get_apply_block_kernels();
+
+	glm::vec3 temp[SH_MAX_COEFFICIENT_COUNT];
+
+	// Rotating by a * b means rotating by b first, then by a.
+	// The rotation around y is angleAxis(-90, x) * angleAxis(beta, z) * angleAxis(90, x)
+	rotate_z(gamma, coeffs_in, coeffs_out, num_bands);
+	apply_bands(x_plus_90, num_bands, kernels, coeffs_out, temp);
+	rotate_z(beta, temp, coeffs_out, num_bands);
+	apply_bands(x_minus_90, num_bands, kernels, coeffs_out, temp);
+	rotate_z(alpha, temp, coeffs_out, num_bands);
+}
+
+void SH::rotate_zonal(const glm::vec3& direction, const glm::vec3 zonal_coeffs[], glm::vec3 coeffs_out[], int num_bands) {
+	float basis[SH_MAX_COEFFICIENT_COUNT];
+	evaluate(direction, basis, num_bands);
+
+	// The rotated coefficients are the zonal coefficients scaled by the basis functions in the direction of the axis
+	for (int l = 0; l < num_bands; l++) {
+		glm::vec3 scale = float(constexpr_sqrt(4.0 * PI / (2.0 * l + 1.0))) * zonal_coeffs[l];
+
+		for (int m = -l; m <= l; m++) {
+			coeffs_out[SH_INDEX(l, m)] = scale * basis[SH_INDEX(l, m)];
+		}
 	}
 }
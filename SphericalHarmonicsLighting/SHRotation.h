@@ -1,8 +1,56 @@
 #pragma once
 #include <glm/gtc/quaternion.hpp>
 
+#include "SphericalHarmonics.h"
+
+struct ThreadPool; // Forward Declaration, defined in ThreadPool.h
+
 namespace SH {
-	void init_rotation();
+	// Number of floats that store a single column of the block of band l of a RotationMatrix, padded to a whole number of AVX registers
+	constexpr int get_rotation_block_stride(int l) {
+		return (2*l + 1 + 7) & ~7;
+	}
+
+	// Offset of the block of band l in RotationMatrix::blocks, band 0 is not stored since it is always 1
+	constexpr int get_rotation_block_offset(int l) {
+		return l <= 1 ? 0 : get_rotation_block_offset(l - 1) + (2*l - 1) * get_rotation_block_stride(l - 1);
+	}
+
+	// Block diagonal rotation matrix for SH coefficients, band l is rotated by its own (2l+1) x (2l+1) block.
+	// Building the matrix is the expensive part of a rotation, so it is built once per rotation and can then be applied to any number of coefficient vectors.
+	// The blocks are stored column major, so that the SIMD kernels can multiply a whole column by a single input coefficient
+	struct RotationMatrix {
+		int num_bands;
+
+		float blocks[get_rotation_block_offset(SH_MAX_NUM_BANDS)];
+
+		// Builds the blocks of the first num_bands bands using the recurrence relation of Ivanic et al
+		void init(const glm::quat& rotation, int num_bands = SH_MAX_NUM_BANDS);
+
+		// Rotates get_coefficient_count(num_bands) coefficients
+		void apply(const glm::vec3 coeffs_in[], glm::vec3 coeffs_out[]) const;
+
+		// Rotates count coefficient vectors, vector i starts at coeffs_in[i * stride] and is written to coeffs_out[i * stride].
+		// The SIMD kernel is selected at runtime based on SIMD::get_level(), all kernels produce identical results
+		void apply(int count, const glm::vec3 coeffs_in[], glm::vec3 coeffs_out[], int stride) const;
+	};
+
+	// Rotates the coefficients of the first num_bands bands
+	void rotate(const glm::quat& rotation, const glm::vec3 coeffs_in[], glm::vec3 coeffs_out[], int num_bands = SH_MAX_NUM_BANDS);
+
+	// Rotates count sets of coefficients, for example the lighting of many instances that each have their own orientation. Set i is rotated by rotations[i].
+	// The sets are stored in Structure of Arrays layout: channel c of coefficient k of set i is found at coeffs[(3*k + c) * stride + i], with stride >= count.
+	// The rotation matrices of 4 (SSE) or 8 (AVX2) sets are built at the same time, one set per SIMD lane, and the groups of sets are divided over the threads of the ThreadPool.
+	// The result is identical to rotating every set separately using SH::rotate
+	void rotate(ThreadPool& thread_pool, int count, const glm::quat rotations[], const float coeffs_in[], float coeffs_out[], int stride, int num_bands = SH_MAX_NUM_BANDS);
+
+	// Rotates the coefficients of the first num_bands bands by the ZYZ Euler angles alpha, beta and gamma,
+	// which is the rotation glm::angleAxis(alpha, z) * glm::angleAxis(beta, y) * glm::angleAxis(gamma, z).
+	// Rotations around the z axis only mix the pairs m and -m, the rotation around the y axis uses two fixed rotations of 90 degrees around the x axis.
+	// No matrix has to be built, which makes this faster when every rotation is only applied once
+	void rotate_zyz(float alpha, float beta, float gamma, const glm::vec3 coeffs_in[], glm::vec3 coeffs_out[], int num_bands = SH_MAX_NUM_BANDS);
 
-	void rotate(const glm::quat& rotation, const glm::vec3 coeffs_in[], glm::vec3 coeffs_out[]);
+	// Rotates a zonal harmonic, a function that is rotationally symmetric around the z axis and is described by one coefficient per band,
+	// such that its axis points in the given direction of unit length. Writes get_coefficient_count(num_bands) coefficients
+	void rotate_zonal(const glm::vec3& direction, const glm::vec3 zonal_coeffs[], glm::vec3 coeffs_out[], int num_bands = SH_MAX_NUM_BANDS);
 }
@@ -0,0 +1,52 @@
+#include "SIMD.h"
+
+#include <intrin.h>
+#include <immintrin.h>
+
+#include "Util.h"
+
+// Queries the CPU for the widest Level that can be used
+static SIMD::Level detect_level() {
+	int info[4];
+
+	__cpuid(info, 0);
+	int max_function_id = info[0];
+
+	__cpuid(info, 1);
+	bool has_osxsave = (info[2] & (1 << 27)) != 0;
+	bool has_avx     = (info[2] & (1 << 28)) != 0;
+
+	// AVX2 requires both CPU support and OS support for saving the YMM registers on a context switch
+	if (max_function_id >= 7 && has_osxsave && has_avx) {
+		bool os_saves_ymm = (_xgetbv(0) & 0x6) == 0x6;
+
+		__cpuidex(info, 7, 0);
+		bool has_avx2 = (info[1] & (1 << 5)) != 0;
+
+		if (os_saves_ymm && has_avx2) return SIMD::Level::AVX2;
+	}
+
+	// SSE2 is part of the baseline of every x64 CPU and is the default target of MSVC for x86
+	return SIMD::Level::SSE;
+}
+
+static SIMD::Level supported_level = detect_level();
+static SIMD::Level current_level   = supported_level;
+
+SIMD::Level SIMD::get_level() {
+	return current_level;
+}
+
+void SIMD::set_level(Level level) {
+	current_level = level <= supported_level ? level : supported_level;
+}
+
+const char * SIMD::get_level_name(Level level) {
+	switch (level) {
+		case Level::SCALAR: return "Scalar";
+		case Level::SSE:    return "SSE";
+		case Level::AVX2:   return "AVX2";
+
+		default: abort();
+	}
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+namespace SIMD {
+	// Instruction set extensions that are used by the SIMD kernels, in increasing order of width
+	enum class Level {
+		SCALAR, // Plain C++, no intrinsics
+		SSE,    // 4 floats wide
+		AVX2    // 8 floats wide
+	};
+
+	// Returns the Level used by the SIMD kernels.
+	// On first use this is the widest Level supported by the CPU and the OS
+	Level get_level();
+
+	// Overrides the Level used by the SIMD kernels, for example to compare them against each other.
+	// Requesting a Level that is not supported by the CPU falls back to the widest supported Level
+	void set_level(Level level);
+
+	const char * get_level_name(Level level);
+}
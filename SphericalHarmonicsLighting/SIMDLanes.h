@@ -0,0 +1,83 @@
+#pragma once
+#include <immintrin.h>
+
+// Kernels that are written once and instantiated for every SIMD width are templated on a Lanes type.
+// Every Lanes type provides the same arithmetic operations, so all instantiations perform them in the same order and produce identical results
+struct LanesScalar {
+	typedef float Type;
+
+	static const int width = 1;
+
+	static inline Type set  (float value)           { return value; }
+	static inline Type load (const float * address) { return *address; }
+	static inline void store(float * address, Type value) { *address = value; }
+
+	static inline Type add(Type a, Type b) { return a + b; }
+	static inline Type sub(Type a, Type b) { return a - b; }
+	static inline Type mul(Type a, Type b) { return a * b; }
+};
+
+struct LanesSSE {
+	typedef __m128 Type;
+
+	static const int width = 4;
+
+	static inline Type set  (float value)           { return _mm_set1_ps(value); }
+	static inline Type load (const float * address) { return _mm_loadu_ps(address); }
+	static inline void store(float * address, Type value) { _mm_storeu_ps(address, value); }
+
+	static inline Type add(Type a, Type b) { return _mm_add_ps(a, b); }
+	static inline Type sub(Type a, Type b) { return _mm_sub_ps(a, b); }
+	static inline Type mul(Type a, Type b) { return _mm_mul_ps(a, b); }
+};
+
+struct LanesAVX2 {
+	typedef __m256 Type;
+
+	static const int width = 8;
+
+	static inline Type set  (float value)           { return _mm256_set1_ps(value); }
+	static inline Type load (const float * address) { return _mm256_loadu_ps(address); }
+	static inline void store(float * address, Type value) { _mm256_storeu_ps(address, value); }
+
+	static inline Type add(Type a, Type b) { return _mm256_add_ps(a, b); }
+	static inline Type sub(Type a, Type b) { return _mm256_sub_ps(a, b); }
+	static inline Type mul(Type a, Type b) { return _mm256_mul_ps(a, b); }
+};
+
+// Number of partial sums used by dot. Every Lanes type keeps them in its lanes, which makes all of them add the same numbers in the same order
+#define LANES_PARTIAL_SUM_COUNT 8
+
+// Dot product of two arrays whose length is a multiple of LANES_PARTIAL_SUM_COUNT.
+// Element i is added to partial sum i % LANES_PARTIAL_SUM_COUNT, the partial sums are then added pairwise in a fixed order
+template<typename Lanes>
+inline float dot(int count, const float a[], const float b[]) {
+	static_assert(LANES_PARTIAL_SUM_COUNT % Lanes::width == 0, "Partial sums should fill whole SIMD registers");
+	const int register_count = LANES_PARTIAL_SUM_COUNT / Lanes::width;
+
+	typename Lanes::Type partial_sums[register_count];
+	for (int r = 0; r < register_count; r++) {
+		partial_sums[r] = Lanes::set(0.0f);
+	}
+
+	for (int i = 0; i < count; i += LANES_PARTIAL_SUM_COUNT) {
+		for (int r = 0; r < register_count; r++) {
+			int offset = i + r * Lanes::width;
+
+			partial_sums[r] = Lanes::add(partial_sums[r], Lanes::mul(Lanes::load(a + offset), Lanes::load(b + offset)));
+		}
+	}
+
+	float partial_sums_stored[LANES_PARTIAL_SUM_COUNT];
+	for (int r = 0; r < register_count; r++) {
+		Lanes::store(partial_sums_stored + r * Lanes::width, partial_sums[r]);
+	}
+
+	for (int width = LANES_PARTIAL_SUM_COUNT / 2; width > 0; width /= 2) {
+		for (int j = 0; j < width; j++) {
+			partial_sums_stored[j] += partial_sums_stored[j + width];
+		}
+	}
+
+	return partial_sums_stored[0];
+}
@@ -1,124 +1,346 @@
 #include "Scene.h"
 
+#include <algorithm>
+#include <random>
+
 #include <SDL2/SDL.h>
 
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "VectorMath.h"
-#include "SHRotation.h"
+#include "LightProbe.h"
 
 #include "ScopedTimer.h"
+#include "Benchmark.h"
 
 #include "Util.h"
 
-Scene::Scene() : shader_diffuse(), shader_glossy(), angle(0) {
+Scene::Scene() : scene_coeffs(NULL), refinement(NULL), angle(0) {
+	for (int i = 0; i < SH_MAX_NUM_BANDS; i++) {
+		shaders_diffuse[i] = NULL;
+		shaders_glossy [i] = NULL;
+	}
+
 	mesh_count = 3;
 	meshes = ALLOC_ARRAY(Mesh, mesh_count);
-	Mesh * monkey = new(&meshes[0]) Mesh(DATA_PATH("Models/MonkeySubdivided2.obj"), shader_diffuse);
-	Mesh * plane  = new(&meshes[1]) Mesh(DATA_PATH("Models/Plane.obj"),             shader_diffuse);
-	Mesh * test   = new(&meshes[2]) Mesh(DATA_PATH("Models/Test.obj"),              shader_diffuse);
+	Mesh * monkey = new(&meshes[0]) Mesh(DATA_PATH("Models/MonkeySubdivided2.obj"), get_shader_diffuse(SH_DEFAULT_NUM_BANDS));
+	Mesh * plane  = new(&meshes[1]) Mesh(DATA_PATH("Models/Plane.obj"),             get_shader_diffuse(SH_DEFAULT_NUM_BANDS));
+	Mesh * test   = new(&meshes[2]) Mesh(DATA_PATH("Models/Test.obj"),              get_shader_diffuse(SH_DEFAULT_NUM_BANDS));
 	
 	plane->material.albedo = glm::vec3(1.0f, 0.0f, 0.0f);
 	test->material.albedo  = glm::vec3(0.0f, 1.0f, 0.0f);
 
+	num_bands = 0;
+	for (int i = 0; i < mesh_count; i++) {
+		num_bands = std::max(num_bands, meshes[i].num_bands);
+	}
+
+	thread_pool             = new ThreadPool(BAKE_THREAD_COUNT);
+	light_mixer_thread_pool = new ThreadPool(LIGHT_MIXER_THREAD_COUNT);
+
 	// @TODO: maybe make the Light a user choice?
 	light_count = 1;
 	lights = ALLOC_ARRAY(Light *, light_count);
 	lights[0] = new DirectionalLight();
-	//lights[0] = new HDRProbeLight(DATA_PATH("Light Probes/grace_probe.float"), 1000);
+	//lights[0] = new HDRProbeLight(DATA_PATH("Light Probes/grace_probe.float"), 1000, thread_pool);
+	//lights[0] = new ProbeLight(DATA_PATH("Light Probes/grace_probe.float"), *thread_pool);
 
 	camera.position    = glm::vec3(0.0f, 0.0f, 10.0f);
 	camera.orientation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
 	camera.projection  = glm::perspective(DEG_TO_RAD(45.0f), 1600.0f / 900.0f, 0.1f, 100.0f);
+
+	light_mixer.init(light_count);
+
+	MeshInstance * instances = new MeshInstance[mesh_count];
+	for (int i = 0; i < mesh_count; i++) {
+		instances[i].init(&meshes[i]);
+	}
+
+	tlas.build(mesh_count, instances);
+
+	delete[] instances;
 }
 
 Scene::~Scene() {
+	// A progressive bake that is still running stops after its current pass
+	if (refinement) {
+		refinement->cancelled = true;
+		wait_for_bake();
+
+		delete refinement;
+	}
+
+	delete[] scene_coeffs;
+
 	free(meshes);
 	free(lights);
+
+	light_mixer.free();
+
+	LightProbe::free_tables();
+
+	delete thread_pool;
+	delete light_mixer_thread_pool;
+
+	tlas.free();
+
+	for (int i = 0; i < SH_MAX_NUM_BANDS; i++) {
+		delete shaders_diffuse[i];
+		delete shaders_glossy [i];
+	}
 }
 
-void Scene::init() {
-	SH::init_rotation();
+const DiffuseShader& Scene::get_shader_diffuse(int num_bands) {
+	assert(num_bands >= 1 && num_bands <= SH_MAX_NUM_BANDS);
 
-	SH::Sample* samples = new SH::Sample[SAMPLE_COUNT];
-	SH::init_samples(samples);
+	if (shaders_diffuse[num_bands - 1] == NULL) {
+		shaders_diffuse[num_bands - 1] = new DiffuseShader(num_bands);
+	}
 
-	bool all_meshes_loaded = true;
-	int scene_coeff_count = 0;
-	
-	glm::vec3 * bounces_scene_coeffs[NUM_BOUNCES + 1];
+	return *shaders_diffuse[num_bands - 1];
+}
+
+const GlossyShader& Scene::get_shader_glossy(int num_bands) {
+	assert(num_bands >= 1 && num_bands <= SH_MAX_NUM_BANDS);
+
+	if (shaders_glossy[num_bands - 1] == NULL) {
+		shaders_glossy[num_bands - 1] = new GlossyShader(num_bands);
+	}
+
+	return *shaders_glossy[num_bands - 1];
+}
+
+void Scene::init(const BakeSettings& settings) {
+#if BENCHMARK
+	Benchmark::bvh_traversal();
+	Benchmark::bvh_width();
+	Benchmark::sh_rotation();
+	Benchmark::sh_sampling();
+	Benchmark::light_projection();
+	Benchmark::analytic_lights();
+	Benchmark::light_mixer();
+#endif
+
+	bake_settings = settings;
+
+	// The passes of a progressive bake continue the same sample sequence, so a random seed is only chosen once
+	if (bake_settings.sample_settings.seed == SH_RANDOM_SEED) {
+		std::random_device random_device;
+
+		while (bake_settings.sample_settings.seed == SH_RANDOM_SEED) {
+			bake_settings.sample_settings.seed = random_device();
+		}
+	}
+
+	// The Materials and Lights are projected once, using as many samples as a single pass
+	int projection_sample_count = std::min(bake_settings.sample_count, VISIBILITY_MAX_SAMPLE_COUNT);
+
+	SH::Sample* samples = new SH::Sample[projection_sample_count];
+	SH::init_samples(samples, projection_sample_count, bake_settings.sample_settings);
+
+	scene_coeff_count = 0;
 
 	for (int m = 0; m < mesh_count; m++) {		
 		meshes[m].transfer_coeffs_scene_offset = scene_coeff_count;
 		scene_coeff_count += meshes[m].vertex_count * meshes[m].transfer_coeff_count;
 	}
 	
-	bounces_scene_coeffs[0] = new glm::vec3[scene_coeff_count];
-	memset(bounces_scene_coeffs[0], 0, scene_coeff_count * sizeof(glm::vec3));
+	scene_coeffs = new glm::vec3[scene_coeff_count];
+	memset(scene_coeffs, 0, scene_coeff_count * sizeof(glm::vec3));
+
+	// Try to load transfer coefficients for all Meshes and record if any Mesh failed to load.
+	// Light bounces between the Meshes, so the cache can only be used if all Meshes were baked with the same number of samples
+	bool all_meshes_loaded = true;
+	baked_sample_count = INVALID;
 
-	// Try to load transfer coefficients for all Meshes and record if any Mesh failed to load
 	for (int m = 0; m < mesh_count; m++) {
-		bool was_loaded = meshes[m].try_to_load_transfer_coeffs(bounces_scene_coeffs[0] + meshes[m].transfer_coeffs_scene_offset);
-		all_meshes_loaded &= was_loaded;
+		int  mesh_sample_count = INVALID;
+		bool was_loaded = meshes[m].try_to_load_transfer_coeffs(scene_coeffs + meshes[m].transfer_coeffs_scene_offset, mesh_sample_count);
+
+		// Files that were saved before the number of samples was stored are treated as fully baked
+		if (mesh_sample_count == INVALID) mesh_sample_count = bake_settings.sample_count;
 
-		meshes[m].init_material(samples);
+		if (baked_sample_count == INVALID) baked_sample_count = mesh_sample_count;
+
+		all_meshes_loaded &= was_loaded && mesh_sample_count == baked_sample_count;
+
+		meshes[m].init_material(samples, projection_sample_count);
 	}
 
 	if (!all_meshes_loaded) {	
 		printf("No cached transfer coefficients found. These will need to be regenerated by raytracing, this may take a while...\n");
 
-		for (int b = 1; b <= NUM_BOUNCES; b++) {
-			bounces_scene_coeffs[b] = new glm::vec3[scene_coeff_count];
-			memset(bounces_scene_coeffs[b], 0, scene_coeff_count * sizeof(glm::vec3));
-		}
+		baked_sample_count = 0;
+		memset(scene_coeffs, 0, scene_coeff_count * sizeof(glm::vec3));
+	} else if (baked_sample_count < bake_settings.sample_count) {
+		printf("Cached transfer coefficients use %i of %i samples, the bake continues from there\n", baked_sample_count, bake_settings.sample_count);
+	}
 
-		// First do direct lighting pass
-		for (int m = 0; m < mesh_count; m++) {
-			meshes[m].init_light_direct(*this, samples, bounces_scene_coeffs[0] + meshes[m].transfer_coeffs_scene_offset);
-		}
+	// Without usable cached coefficients the first pass always runs right away, a progressive bake does the remaining passes in the background
+	while (baked_sample_count < bake_settings.sample_count && !(bake_settings.progressive && baked_sample_count > 0)) {
+		bake_pass();
+	}
 
-		// Then do subsequent bounce passes
-		for (int b = 1; b <= NUM_BOUNCES; b++) {
-			ScopedTimer timer("Bounce");
+	for (int m = 0; m < mesh_count; m++) {
+		meshes[m].init_shader(scene_coeffs + meshes[m].transfer_coeffs_scene_offset);
+	}
 
-			for (int m = 0; m < mesh_count; m++) {
-				meshes[m].init_light_bounce(*this, samples, bounces_scene_coeffs[b - 1], bounces_scene_coeffs[b] + meshes[m].transfer_coeffs_scene_offset);
-			}
-		}
+	for (int i = 0; i < light_count; i++) {
+		lights[i]->init(samples, projection_sample_count);
+
+		light_mixer.add(*lights[i]);
+	}
+
+	delete[] samples;
 
-		// Sum all bounces of self transferred light back into sh_coeff
-		for (int b = 1; b <= NUM_BOUNCES; b++) {
-			for (int m = 0; m < mesh_count; m++) {
-				glm::vec3       * transfer_coeffs = bounces_scene_coeffs[0] + meshes[m].transfer_coeffs_scene_offset;
-				glm::vec3 const * bounce_coeffs   = bounces_scene_coeffs[b] + meshes[m].transfer_coeffs_scene_offset;
+	if (baked_sample_count < bake_settings.sample_count) {
+		refinement = new BakeRefinement();
+		refinement->cancelled  = false;
+		refinement->has_update = false;
 
-				for (int i = 0; i < meshes[m].vertex_count * meshes[m].transfer_coeff_count; i++) {
-					transfer_coeffs[i] += bounce_coeffs[i];
-				}
+		// update uploads the refined coefficients on the main thread, which owns the OpenGL context
+		refinement->thread = std::thread([this]() {
+			while (!refinement->cancelled && baked_sample_count < bake_settings.sample_count) {
+				bake_pass();
+
+				refinement->has_update = true;
 			}
+		});
+	}
+}
+
+void Scene::wait_for_bake() {
+	if (refinement && refinement->thread.joinable()) {
+		refinement->thread.join();
+	}
+}
+
+void Scene::bake_pass() {
+	// A progressive bake starts small and then doubles the number of samples with every pass, otherwise all remaining samples are used at once
+	int sample_count = bake_settings.sample_count - baked_sample_count;
+
+	if (bake_settings.progressive) {
+		sample_count = std::min(sample_count, baked_sample_count > 0 ? baked_sample_count : bake_settings.progressive_first_sample_count);
+	}
+
+	sample_count = std::min(sample_count, VISIBILITY_MAX_SAMPLE_COUNT);
+
+	printf("Baking %i samples (%i of %i) using %i thread(s), %s%s\n", sample_count, baked_sample_count + sample_count, bake_settings.sample_count, thread_pool->get_thread_count(), bake_settings.use_ray_packets ? "tracing Ray packets" : "tracing single Rays", bake_settings.store_occluder_records ? ", caching closest hits for the bounce passes" : "");
+
+	ScopedTimer timer("Bake Pass");
+
+	// Every pass uses a new batch of samples
+	SH::Sample* samples = new SH::Sample[sample_count];
+	SH::init_samples(samples, sample_count, bake_settings.sample_settings, baked_sample_count);
+
+	glm::vec3 * bounces_scene_coeffs[NUM_BOUNCES + 1];
+
+	for (int b = 0; b <= NUM_BOUNCES; b++) {
+		bounces_scene_coeffs[b] = new glm::vec3[scene_coeff_count];
+		memset(bounces_scene_coeffs[b], 0, scene_coeff_count * sizeof(glm::vec3));
+	}
 
-			delete[] bounces_scene_coeffs[b];
+	// First do direct lighting pass
+	for (int m = 0; m < mesh_count; m++) {
+		meshes[m].init_light_direct(*this, bake_settings, *thread_pool, samples, sample_count, bounces_scene_coeffs[0] + meshes[m].transfer_coeffs_scene_offset);
+	}
+
+	// Report how much memory is used to remember the occluded samples until the bounce passes
+	{
+		size_t visibility_memory_usage = 0;
+		size_t bool_memory_usage       = 0;
+		size_t record_memory_usage     = 0;
+
+		for (int m = 0; m < mesh_count; m++) {
+			visibility_memory_usage += meshes[m].get_visibility_memory_usage();
+			bool_memory_usage       += size_t(meshes[m].vertex_count) * sample_count * sizeof(bool);
+			record_memory_usage     += meshes[m].get_occluder_record_memory_usage();
 		}
 
-		// Save transfer coefficients to disk
+		printf("Visibility uses %.2f MB (%.2f MB as one bool per sample)\n", float(visibility_memory_usage) / float(MEGA_BYTE(1)), float(bool_memory_usage) / float(MEGA_BYTE(1)));
+
+		if (bake_settings.store_occluder_records) {
+			printf("Occluder records use %.2f MB\n", float(record_memory_usage) / float(MEGA_BYTE(1)));
+		}
+	}
+
+	// Visibility and hit points are the same for every bounce, so the diffuse bounces can be precomputed as a sparse matrix
+	{
+		size_t transport_memory_usage = 0;
+
 		for (int m = 0; m < mesh_count; m++) {
-			meshes[m].save_transfer_coeffs(bounces_scene_coeffs[0] + meshes[m].transfer_coeffs_scene_offset);
+			meshes[m].init_transport(*this, *thread_pool, samples, sample_count);
+
+			transport_memory_usage += meshes[m].get_transport_memory_usage();
 		}
 
-		printf("Transfer coefficients were saved to disk!\n");
+		printf("Transport matrix uses %.2f MB\n", float(transport_memory_usage) / float(MEGA_BYTE(1)));
 	}
 
+	// Then do subsequent bounce passes.
+	// The vertices of all Meshes in the Scene are treated as one flat list of jobs,
+	// scene_vertex_offsets[m] contains the index of the first vertex of Mesh m in this list
+	Array<int> scene_vertex_offsets(mesh_count + 1);
+	scene_vertex_offsets[0] = 0;
+
 	for (int m = 0; m < mesh_count; m++) {
-		meshes[m].init_shader(samples, bounces_scene_coeffs[0] + meshes[m].transfer_coeffs_scene_offset);
+		scene_vertex_offsets[m + 1] = scene_vertex_offsets[m] + meshes[m].vertex_count;
 	}
 
-	delete[] bounces_scene_coeffs[0];
+	int scene_vertex_count = scene_vertex_offsets[mesh_count];
 
-	for (int i = 0; i < light_count; i++) {
-		lights[i]->init(samples);
+	for (int b = 1; b <= NUM_BOUNCES; b++) {
+		ScopedTimer timer("Bounce");
+
+		const glm::vec3 * previous_bounce_coeffs = bounces_scene_coeffs[b - 1];
+		glm::vec3       * bounce_coeffs          = bounces_scene_coeffs[b];
+
+		// Every bounce reads the result of the previous bounce, parallel_for returning acts as the barrier between bounces
+		thread_pool->parallel_for(scene_vertex_count, BAKE_CHUNK_SIZE, [&](int scene_vertex, int /*thread_index*/) {
+			// Find the Mesh that this vertex belongs to
+			int m = int(std::upper_bound(scene_vertex_offsets.begin(), scene_vertex_offsets.end(), scene_vertex) - scene_vertex_offsets.begin()) - 1;
+
+			meshes[m].init_light_bounce_vertex(*this, samples, sample_count, scene_vertex - scene_vertex_offsets[m], previous_bounce_coeffs, bounce_coeffs + meshes[m].transfer_coeffs_scene_offset);
+		}, "Bounce");
+	}
+
+	for (int m = 0; m < mesh_count; m++) {
+		meshes[m].free_bake_data();
+	}
+
+	// Sum all bounces of self transferred light back into sh_coeff
+	for (int b = 1; b <= NUM_BOUNCES; b++) {
+		for (int i = 0; i < scene_coeff_count; i++) {
+			bounces_scene_coeffs[0][i] += bounces_scene_coeffs[b][i];
+		}
+
+		delete[] bounces_scene_coeffs[b];
 	}
 
+	// Refine the coefficients in place, the result of this pass is weighted by its share of the samples.
+	// The first pass has a weight of one and simply replaces the coefficients
+	{
+		std::unique_lock<std::mutex> lock;
+		if (refinement) lock = std::unique_lock<std::mutex>(refinement->mutex);
+
+		float weight = float(sample_count) / float(baked_sample_count + sample_count);
+
+		for (int i = 0; i < scene_coeff_count; i++) {
+			scene_coeffs[i] += (bounces_scene_coeffs[0][i] - scene_coeffs[i]) * weight;
+		}
+
+		baked_sample_count += sample_count;
+	}
+
+	delete[] bounces_scene_coeffs[0];
 	delete[] samples;
+
+	// Save transfer coefficients to disk, only the refinement thread writes scene_coeffs so it can be read without holding the lock
+	for (int m = 0; m < mesh_count; m++) {
+		meshes[m].save_transfer_coeffs(scene_coeffs + meshes[m].transfer_coeffs_scene_offset, baked_sample_count);
+	}
+
+	printf("Transfer coefficients were saved to disk! (%i of %i samples)\n", baked_sample_count, bake_settings.sample_count);
 }
 
 void Scene::update(float delta, const u8 * keys) {
@@ -150,18 +372,40 @@ void Scene::update(float delta, const u8 * keys) {
 		glm::angleAxis(angle,             glm::vec3(0.0f, 1.0f, 0.0f)) * 
 		glm::angleAxis(DEG_TO_RAD(45.0f), glm::vec3(1.0f, 0.0f, 0.0f));
 
-	glm::vec3 light_coeffs_rotated[SH_COEFFICIENT_COUNT];
-	SH::rotate(rotation, lights[0]->coefficients, light_coeffs_rotated);
+	// Upload the refined coefficients of a progressive bake as soon as a pass has finished
+	if (refinement && refinement->has_update.exchange(false)) {
+		std::lock_guard<std::mutex> lock(refinement->mutex);
+
+		for (int m = 0; m < mesh_count; m++) {
+			meshes[m].update_shader(scene_coeffs + meshes[m].transfer_coeffs_scene_offset);
+		}
+	}
+
+	// Every Light has its own rotation in the mixer, they currently all follow the same animation
+	for (int i = 0; i < light_mixer.light_count; i++) {
+		light_mixer.set_rotation(i, rotation);
+	}
 
-	shader_diffuse.bind();
-	shader_diffuse.set_light_coeffs(light_coeffs_rotated);
-	shader_diffuse.set_view_projection(camera.view_projection);
+	glm::vec3 light_coeffs_rotated[SH_MAX_COEFFICIENT_COUNT];
+	light_mixer.mix(*light_mixer_thread_pool, light_coeffs_rotated, num_bands);
 
-	shader_glossy.bind();
-	shader_glossy.set_light_coeffs(light_coeffs_rotated);
-	shader_glossy.set_view_projection(camera.view_projection);
-	shader_glossy.set_camera_position(camera.position);
-	shader_glossy.unbind();
+	// Shaders with fewer bands only use the first coefficients of the mixed Lights
+	for (int i = 0; i < SH_MAX_NUM_BANDS; i++) {
+		if (shaders_diffuse[i]) {
+			shaders_diffuse[i]->bind();
+			shaders_diffuse[i]->set_light_coeffs(light_coeffs_rotated);
+			shaders_diffuse[i]->set_view_projection(camera.view_projection);
+			shaders_diffuse[i]->unbind();
+		}
+
+		if (shaders_glossy[i]) {
+			shaders_glossy[i]->bind();
+			shaders_glossy[i]->set_light_coeffs(light_coeffs_rotated);
+			shaders_glossy[i]->set_view_projection(camera.view_projection);
+			shaders_glossy[i]->set_camera_position(camera.position);
+			shaders_glossy[i]->unbind();
+		}
+	}
 }
 
 void Scene::render() const {
@@ -179,34 +423,17 @@ void Scene::debug(GLuint uni_debug_view_projection) const {
 }
 
 bool Scene::intersects(const Ray & ray) const {
-	for (int i = 0; i < mesh_count; i++) {
-		if (meshes[i].intersects(ray)) {
-			return true;
-		}
-	}
-
-	return false;
+	return tlas.intersects(ray);
 }
 
-float Scene::trace(const Ray & ray, int indices[3], float & u, float & v, const Mesh *& mesh) const {
-	float min_distance = INFINITY;
-
-	int   current_indices[3];
-	float current_u;
-	float current_v;
-
-	for (int m = 0; m < mesh_count; m++) {
-		float distance = meshes[m].trace(ray, current_indices, current_u, current_v);
-		if (distance < min_distance) {
-			min_distance = distance;
-
-			memcpy(indices, current_indices, 3 * sizeof(int));
-			u = current_u;
-			v = current_v;
+void Scene::intersects(const RayPacket& packet, RayPacketMask& hits) const {
+	tlas.intersects(packet, hits);
+}
 
-			mesh = &meshes[m];
-		}
-	}
+float Scene::trace(const Ray & ray, int& triangle_index, float & u, float & v, const Mesh *& mesh) const {
+	return tlas.trace(ray, triangle_index, u, v, mesh);
+}
 
-	return min_distance;
+void Scene::trace(const RayPacket& packet, RayPacketHits& hits, const Mesh * meshes[RAY_PACKET_MAX_SIZE]) const {
+	tlas.trace(packet, hits, meshes);
 }
@@ -1,6 +1,10 @@
 #pragma once
 #include <GL/glew.h>
 
+#include <atomic>
+#include <thread>
+#include <mutex>
+
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 
@@ -8,25 +12,58 @@
 
 #include "Ray.h"
 #include "BVH.h"
+#include "WideBVH.h"
+#include "TLAS.h"
+#include "Visibility.h"
+#include "TransportMatrix.h"
 
 #include "Light.h"
+#include "LightMixer.h"
 
 #include "MeshShaders.h"
 
+#include "ThreadPool.h"
+
 #define NUM_BOUNCES 3
 
+// Defaults of the BakeSettings that are used when Scene::init is called without any
+#define BAKE_SAMPLE_COUNT                   2500
+#define BAKE_PROGRESSIVE                    0
+#define BAKE_PROGRESSIVE_FIRST_SAMPLE_COUNT 256
+
+// Generator of the Monte Carlo sample directions, see SH::SampleSettings
+#define BAKE_SAMPLE_GENERATOR SH::SampleSettings::Generator::FIBONACCI
+// With a fixed seed every bake produces the same transfer coefficients, SH_RANDOM_SEED uses different samples on every run
+#define BAKE_SAMPLE_SEED 1
+
+// Number of threads used while raytracing the transfer coefficients
+// 0 uses one thread per hardware thread, 1 bakes serially on the calling thread
+#define BAKE_THREAD_COUNT 0
+// Number of consecutive vertices that are handed to a thread at once
+#define BAKE_CHUNK_SIZE 16
+// Defaults of BakeSettings::use_ray_packets and BakeSettings::store_occluder_records
+#define BAKE_USE_RAY_PACKETS        1
+#define BAKE_STORE_OCCLUDER_RECORDS 0
+// Maximum number of shadow Rays that are traced through the BVHs together if BakeSettings::use_ray_packets is enabled
+#define BAKE_RAY_PACKET_SIZE RAY_PACKET_MAX_SIZE
+
+// Number of threads that rotate the Lights every frame, including the main thread.
+// These are separate from the bake threads, which may still be refining the transfer coefficients in the background
+#define LIGHT_MIXER_THREAD_COUNT 1
+
 struct Material {
 	const MeshShader& shader;
 
 	float     specular_power = 1.0f;
 	glm::vec3 albedo         = glm::vec3(1.0f, 1.0f, 1.0f);
 
-	glm::vec3 brdf_coeffs[SH_NUM_BANDS]; // NOTE: only used by GLOSSY shader
+	glm::vec3 brdf_coeffs[SH_MAX_NUM_BANDS]; // NOTE: only used by GLOSSY shader, only the first num_bands of the Mesh are used
 
 	inline Material(const MeshShader& shader) : shader(shader) { };
 };
 
 class Scene; // Forward Declaration needed by Mesh
+struct BakeSettings; // Forward Declaration needed by Mesh
 
 struct Mesh {
 private:
@@ -35,44 +72,114 @@ private:
 	
 	char * transfer_coeffs_file_name;
 
-	BVHNode const * bvh;
-	BVHDebugger     bvh_debugger;
+	// Only the BVH that matches bvh_width is initialized
+	int         bvh_width;
+	FlatBVH     bvh;
+	BVH4        bvh4;
+	BVH8        bvh8;
+	BVHDebugger bvh_debugger;
 	
 	GLuint vbo;
 	GLuint ibo;
 	GLuint tbo;
 	GLuint tbo_tex;
 
-	bool * hits; // @TODO: OPTIMIZE!!!
+	VisibilityStore visibility; // Occluded samples of every vertex, filled by the direct lighting pass and used by the bounce passes
+
+	// Only initialized for DIFFUSE Meshes, replaces the visibility once it is built.
+	// transports[b] contains the light reflected by DIFFUSE Meshes with b + 1 bands
+	TransportMatrix transports[SH_MAX_NUM_BANDS];
+
+	void init_light_direct_vertex(const Scene& scene, const BakeSettings& settings, const SH::Sample samples[], int sample_count, int v, glm::vec3 transfer_coeffs[]);
+
+	template<int NumBands>
+	void accumulate_light_direct_vertex(const SH::Sample samples[], int sample_count, int v, glm::vec3 transfer_coeffs[]) const;
+
+	template<int NumBands>
+	void init_light_bounce_vertex_glossy(const Scene& scene, const SH::Sample samples[], int sample_count, int v, const glm::vec3 previous_bounce_transfer_coeffs[], glm::vec3 bounce_transfer_coeffs[]) const;
+
+	template<typename Callback>
+	void for_each_occluder(const Scene& scene, const SH::Sample samples[], int sample_count, int v, Callback callback) const;
 
 public:
 	int        triangle_count;
 	Triangle * triangles;
+
+	AABB aabb; // Bounds of all Triangles, used by the TLAS
 	
 	int vertex_count;
-	int transfer_coeff_count; // Either SH_COEFFICIENT_COUNT or SH_COEFFICIENT_COUNT^2, depending on DIFFUSE / GLOSSY Shader
+	int num_bands;            // Number of SH bands the Mesh is baked with, determined by its MeshShader
+	int transfer_coeff_count; // Either num_bands^2 or num_bands^4, depending on DIFFUSE / GLOSSY Shader
 	int transfer_coeffs_scene_offset;
 
 	Material material;
 
-	Mesh(const char* file_name, const MeshShader& shader);
+	Mesh(const char* file_name, const MeshShader& shader, const BVHBuildSettings& bvh_settings = BVHBuildSettings());
 
-	bool try_to_load_transfer_coeffs(glm::vec3 transfer_coeffs[]) const;
-	void        save_transfer_coeffs(glm::vec3 transfer_coeffs[]) const;
+	bool try_to_load_transfer_coeffs(      glm::vec3 transfer_coeffs[], int& sample_count) const;
+	void        save_transfer_coeffs(const glm::vec3 transfer_coeffs[], int  sample_count) const;
 
-	void init_material(const SH::Sample[SAMPLE_COUNT]);
-	void init_light_direct(const Scene& scene, const SH::Sample[SAMPLE_COUNT], glm::vec3 transfer_coeffs[]);
-	void init_light_bounce(const Scene& scene, const SH::Sample[SAMPLE_COUNT], const glm::vec3 previous_bounce_transfer_coeffs[], glm::vec3 bounce_transfer_coeffs[]) const;
-	void init_shader(const SH::Sample[SAMPLE_COUNT], glm::vec3 transfer_coeffs[]);
+	void init_material(const SH::Sample[], int sample_count);
+	void init_light_direct(const Scene& scene, const BakeSettings& settings, ThreadPool& thread_pool, const SH::Sample[], int sample_count, glm::vec3 transfer_coeffs[]);
+	void init_transport(const Scene& scene, ThreadPool& thread_pool, const SH::Sample[], int sample_count);
+	void init_light_bounce_vertex(const Scene& scene, const SH::Sample[], int sample_count, int v, const glm::vec3 previous_bounce_transfer_coeffs[], glm::vec3 bounce_transfer_coeffs[]) const;
+	void init_shader(const glm::vec3 transfer_coeffs[]);
+	void update_shader(const glm::vec3 transfer_coeffs[]); // Uploads new transfer coefficients to the existing TBO
+
+	size_t get_visibility_memory_usage() const;
+	size_t get_occluder_record_memory_usage() const;
+	size_t get_transport_memory_usage() const;
+	void   free_bake_data();
 
 	bool  intersects(const Ray& ray) const;
-	float trace     (const Ray& ray, int indices[3], float& u, float& v) const;
+	void  intersects(const RayPacket& packet, RayPacketMask& hits) const;
+	float trace     (const Ray& ray, int& triangle_index, float& u, float& v, float max_distance = INFINITY) const;
+	void  trace     (const RayPacket& packet, const RayPacketMask& active, RayPacketHits& hits) const;
+
+	// The BVHs reorder the Triangles, so the triangle_index reported by trace refers to this Triangle rather than to triangles[triangle_index]
+	const Triangle& get_bvh_triangle(int triangle_index) const;
 
 	void render() const;
 
 	void debug() const;
 };
 
+// Settings of the precomputation of the transfer coefficients, chosen at runtime when the Scene is initialized
+struct BakeSettings {
+	// Total number of Monte Carlo samples per vertex.
+	// A single pass uses at most VISIBILITY_MAX_SAMPLE_COUNT samples, larger amounts are divided over multiple passes
+	int sample_count = BAKE_SAMPLE_COUNT;
+
+	// A progressive bake starts with a pass of only progressive_first_sample_count samples, whose result is saved and shown right away.
+	// The remaining passes run on a background thread while the Scene is rendered, every pass adds as many new samples as all previous passes combined.
+	// After every pass the coefficients are refined in place by a running average weighted by sample count, after which they are saved and uploaded again.
+	// The background thread competes with rendering and the Scene waits for its current pass when it is destroyed, so this is opt-in.
+	// If disabled, all passes are done before Scene::init returns
+	bool progressive                    = BAKE_PROGRESSIVE;
+	int  progressive_first_sample_count = BAKE_PROGRESSIVE_FIRST_SAMPLE_COUNT;
+
+	SH::SampleSettings sample_settings = { BAKE_SAMPLE_GENERATOR, BAKE_SAMPLE_SEED };
+
+	// If enabled, the shadow Rays of a vertex are traced through the BVHs together in packets of up to BAKE_RAY_PACKET_SIZE Rays.
+	// If disabled, every Ray traverses the BVHs on its own. Both modes produce exactly the same occlusion results
+	bool use_ray_packets = BAKE_USE_RAY_PACKETS;
+
+	// If enabled, the direct lighting pass stores where every occluded Ray hit the Scene, so that the bounce passes only have to accumulate SH coefficients.
+	// This requires closest hit queries instead of any hit queries, which are traced in packets as well if use_ray_packets is enabled.
+	// Every occluded sample costs a 12 byte OccluderRecord on top of its visibility bit, for large Meshes that is many times the size of the visibility,
+	// so this is off by default. If disabled, every bounce pass traces the occluded Rays again
+	bool store_occluder_records = BAKE_STORE_OCCLUDER_RECORDS;
+};
+
+// Background thread that runs the remaining passes of a progressive bake
+struct BakeRefinement {
+	std::thread thread;
+	std::mutex  mutex; // Held while the Scene wide coefficients are refined or uploaded
+
+	std::atomic<bool> cancelled;  // Set by the Scene to stop refining after the current pass
+	std::atomic<bool> has_update; // Set after every pass, cleared once the refined coefficients are uploaded
+};
+
 struct Camera {
 	glm::vec3 position;
 	glm::quat orientation;
@@ -87,7 +194,10 @@ public:
 	Scene();
 	~Scene();
 
-	void init();
+	void init(const BakeSettings& settings = BakeSettings());
+
+	// Blocks until a progressive bake has used all of its samples
+	void wait_for_bake();
 
 	void update(float delta, const u8 * keys);
 
@@ -96,18 +206,49 @@ public:
 	void debug(GLuint uni_debug_view_projection) const;
 
 	bool  intersects(const Ray & ray) const;
-	float trace     (const Ray & ray, int indices[3], float& u, float& v, const Mesh *& mesh) const;
+	void  intersects(const RayPacket& packet, RayPacketMask& hits) const;
+	float trace     (const Ray & ray, int& triangle_index, float& u, float& v, const Mesh *& mesh) const;
+	void  trace     (const RayPacket& packet, RayPacketHits& hits, const Mesh * meshes[RAY_PACKET_MAX_SIZE]) const;
+
+	inline const Mesh * get_mesh      (int index)         const { return &meshes[index]; }
+	inline int          get_mesh_index(const Mesh * mesh) const { return int(mesh - meshes); }
 
 private:
-	const DiffuseShader shader_diffuse;
-	const GlossyShader  shader_glossy;
+	// MeshShaders are compiled on first use for every number of bands, indexed by the number of bands minus one
+	DiffuseShader * shaders_diffuse[SH_MAX_NUM_BANDS];
+	GlossyShader  * shaders_glossy [SH_MAX_NUM_BANDS];
+
+	const DiffuseShader& get_shader_diffuse(int num_bands);
+	const GlossyShader&  get_shader_glossy (int num_bands);
+
+	int num_bands; // Highest number of bands of any Mesh, the Lights are mixed using this many bands
+
+	BakeSettings bake_settings;
+
+	// Transfer coefficients of all Meshes in one contiguous array, kept after initialization so that a progressive bake can refine them
+	glm::vec3 * scene_coeffs;
+	int         scene_coeff_count;
+	int         baked_sample_count; // Number of samples per vertex that scene_coeffs has been averaged over
+
+	BakeRefinement * refinement; // NULL unless a progressive bake had passes left after Scene::init
+
+	// Raytraces the direct lighting and bounces of all Meshes using the next batch of samples, and refines scene_coeffs with the result
+	void bake_pass();
 
 	Mesh * meshes;
 	int    mesh_count;
 
+	// Acceleration structure over all Meshes, every Mesh currently has a single instance
+	TLAS tlas;
+
 	Light ** lights;
 	int      light_count;
 
+	LightMixer light_mixer; // Combines the rotated Lights into the coefficients that are uploaded every frame
+
+	ThreadPool * thread_pool;
+	ThreadPool * light_mixer_thread_pool;
+
 	Camera camera;
 
 	float angle;
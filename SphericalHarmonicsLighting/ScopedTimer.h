@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdio>
 #include <chrono>
 
 #include "Types.h"
@@ -6,10 +7,14 @@
 struct ScopedTimer {
 private:
 	const char* name;
+	const char* item_name;
 	std::chrono::high_resolution_clock::time_point start_time;
 
 public:
-	inline ScopedTimer(const char* name) : name(name) {
+	// If an item name is provided the throughput (item_count per second) is reported as well
+	u128 item_count = 0;
+
+	inline ScopedTimer(const char* name, const char* item_name = nullptr) : name(name), item_name(item_name) {
 		start_time = std::chrono::high_resolution_clock::now();
 	}
 
@@ -17,12 +22,19 @@ public:
 		auto stop_time = std::chrono::high_resolution_clock::now();
 		u128 duration  = std::chrono::duration_cast<std::chrono::microseconds>(stop_time - start_time).count();
 
+		char throughput[128] = "";
+		if (item_name) {
+			double items_per_second = duration > 0 ? (double)item_count * 1000000.0 / (double)duration : 0.0;
+
+			sprintf_s(throughput, ", %llu %s (%.0f %s/s)", item_count, item_name, items_per_second, item_name);
+		}
+
 		if (duration >= 1000000) {
-			printf("%s took: %llu us (%llu s)\n", name, duration, duration / 1000000);
+			printf("%s took: %llu us (%llu s)%s\n", name, duration, duration / 1000000, throughput);
 		} else if (duration >= 1000) {
-			printf("%s took: %llu us (%llu ms)\n", name, duration, duration / 1000);
+			printf("%s took: %llu us (%llu ms)%s\n", name, duration, duration / 1000, throughput);
 		} else {
-			printf("%s took: %llu us\n", name, duration);
+			printf("%s took: %llu us%s\n", name, duration, throughput);
 		}
 	}
 };
@@ -0,0 +1,28 @@
+#include "Light.h"
+
+#include "SHRotation.h"
+#include "Util.h"
+
+void SkyLight::update() {
+	// The sky is a + b cos(theta) around the up vector, with a the average color and b half the difference.
+	// Projected onto Y_00 = 1 / sqrt(4 PI) and Y_10 = sqrt(3 / 4 PI) cos(theta), all higher bands are zero
+	glm::vec3 average    = 0.5f * (sky_color + ground_color);
+	glm::vec3 difference = 0.5f * (sky_color - ground_color);
+
+	float band_0_factor = sqrt(4.0f * PI);
+	float band_1_factor = sqrt(4.0f * PI / 3.0f);
+
+	glm::vec3 zonal_coeffs[SH_MAX_NUM_BANDS] = { };
+	zonal_coeffs[0] = average    * band_0_factor;
+	zonal_coeffs[1] = difference * band_1_factor;
+
+	SH::rotate_zonal(up, zonal_coeffs, coefficients);
+}
+
+void SkyLight::get_light(int count, const glm::vec3 directions[], glm::vec3 result[]) const {
+	for (int i = 0; i < count; i++) {
+		float t = 0.5f + 0.5f * glm::dot(directions[i], up);
+
+		result[i] = ground_color + t * (sky_color - ground_color);
+	}
+}
@@ -0,0 +1,32 @@
+#include "Light.h"
+
+#include "Util.h"
+
+// Cosine of the angle between the center of the sphere and its silhouette, as seen from the origin. Returns -1 if the origin is inside the sphere
+static float get_cos_cap_angle(const glm::vec3& position, float radius) {
+	float distance_squared = glm::dot(position, position);
+
+	if (distance_squared <= radius * radius) return -1.0f;
+
+	return sqrt(1.0f - (radius * radius) / distance_squared);
+}
+
+void SphereLight::update() {
+	float cos_cap_angle = get_cos_cap_angle(position, radius);
+
+	// If the origin is inside the sphere the Light covers all directions, which makes its direction irrelevant
+	glm::vec3 direction = cos_cap_angle > -1.0f ? glm::normalize(position) : glm::vec3(0.0f, 0.0f, 1.0f);
+
+	project_cap(direction, cos_cap_angle, color);
+}
+
+void SphereLight::get_light(int count, const glm::vec3 directions[], glm::vec3 result[]) const {
+	float cos_cap_angle = get_cos_cap_angle(position, radius);
+	float distance      = glm::length(position);
+
+	for (int i = 0; i < count; i++) {
+		result[i] = (glm::dot(directions[i], position) >= cos_cap_angle * distance)
+			? color
+			: glm::vec3(0.0f, 0.0f, 0.0f);
+	}
+}
@@ -2,11 +2,14 @@
 
 #include <random>
 
+#include "SIMD.h"
+#include "SIMDLanes.h"
+
 // Converts l, m representation into a 1 dimensional index
 #define SH_INDEX(l, m) (l * (l+1) + m)
 
 // Precalculated factorial table, starts at 0! and goes up to 33!
-float factorial[34] = {
+static constexpr float factorial[34] = {
 	1.0f,  
 	1.0f,
 	2.0f,
@@ -43,19 +46,29 @@ float factorial[34] = {
 	8683317618811886495518194401280000000.0f
 };
 
-float K[SH_COEFFICIENT_COUNT];
-
 // Renormalisation constant for SH function
-void init_K() {
-	for (int l = 0; l < SH_NUM_BANDS; l++) {
-		for (int m = -l; m <= l; m++) {
-			K[l*(l+1) + m] = sqrt(
-				((2.0f * l + 1.0f) * factorial[l - m]) / 
-				(4.0f * PI * factorial[l + m])
-			);
+static constexpr float calc_K(int l, int m) {
+	return float(SH::constexpr_sqrt(
+		((2.0 * l + 1.0) * factorial[l - m]) / 
+		(4.0 * PI * factorial[l + m])
+	));
+}
+
+// Renormalisation constants for all bands, indexed by SH_INDEX(l, m) with m >= 0.
+// Generated at compile time, so the table lives in read only memory and needs no initialization
+struct NormalizationTable {
+	float K[SH_MAX_COEFFICIENT_COUNT] = { };
+
+	constexpr NormalizationTable() {
+		for (int l = 0; l < SH_MAX_NUM_BANDS; l++) {
+			for (int m = 0; m <= l; m++) {
+				K[SH_INDEX(l, m)] = calc_K(l, m);
+			}
 		}
 	}
-}
+};
+
+static constexpr NormalizationTable normalization_table;
 
 // Evaluates the Associated Legendre Polynomial P(l,m,x) at x
 float P(int l, int m, float x) {	
@@ -91,70 +104,556 @@ float P(int l, int m, float x) {
 
 float SH::evaluate(int l, int m, float theta, float phi) {
 	if (m == 0) {
-		return K[l*(l + 1)] * P(l, m, cos(theta));
+		return normalization_table.K[l*(l + 1)] * P(l, m, cos(theta));
 	} else if(m > 0) {
-		return sqrt(2.0f) * K[l*(l+1) + m] * cos( m * phi) * P(l,  m, cos(theta));
+		return sqrt(2.0f) * normalization_table.K[l*(l+1) + m] * cos( m * phi) * P(l,  m, cos(theta));
 	} else {
-		return sqrt(2.0f) * K[l*(l+1) - m] * sin(-m * phi) * P(l, -m, cos(theta));
+		return sqrt(2.0f) * normalization_table.K[l*(l+1) - m] * sin(-m * phi) * P(l, -m, cos(theta));
 	}
 } 
 
-void SH::init_samples(Sample samples[SAMPLE_COUNT]) {
-	const float inv_sqrt_n_samples = 1.0f / (float)SQRT_SAMPLE_COUNT;
+// Constants for the evaluation of the basis functions in Cartesian coordinates.
+// For m > 0 a basis function can be written as N * P_l^m(z) / sin^m(theta) * sin^m(theta) cos(m phi), (or sin(m phi) for m < 0).
+// The first part is a polynomial in z that follows the same recurrence as P(l, m, x), the second part is the real (or imaginary) part of (x + iy)^m
+// Generated at compile time for every number of bands, so every instantiation of the kernel has a table of exactly the right size
+template<int NumBands>
+struct BasisTable {
+	float normalization[NumBands * NumBands] = { }; // K, including the factor sqrt(2) for m != 0
 
-	std::random_device random_device;
-	std::mt19937 gen(random_device());
-	std::uniform_real_distribution<float> U01(0.0f, 1.0f);
+	float pmm  [NumBands] = { }; // P_m^m / sin^m(theta) = (-1)^m (2m - 1)!!
+	float pmmp1[NumBands] = { }; // P_m+1^m / sin^m(theta) = z * pmmp1[m]
+
+	// Rule 1 of P(l, m, x): P_l^m = a z P_l-1^m - b P_l-2^m, indexed by SH_INDEX(l, m) for m >= 0
+	float a[NumBands * NumBands] = { };
+	float b[NumBands * NumBands] = { };
 
-	init_K();
+	constexpr BasisTable() {
+		for (int m = 0; m < NumBands; m++) {
+			// Apply rule 2 without the factor sin^m(theta)
+			float pmm  = 1.0f;
+			float fact = 1.0f;
 
-	for (int i = 0; i < SQRT_SAMPLE_COUNT; i++) {
-		for (int j = 0; j < SQRT_SAMPLE_COUNT; j++) {
-			// Generate unbiased distribution of spherical coords
-			float x = ((float)i + U01(gen)) * inv_sqrt_n_samples;
-			float y = ((float)j + U01(gen)) * inv_sqrt_n_samples;
+			for (int i = 1; i <= m; i++) {
+				pmm  *= -fact;
+				fact += 2.0f;
+			}
 
-			// Convert x and y to Spherical Coordinates
-			float theta = 2.0f * acos(sqrt(1.0f - x));
-			float phi   = 2.0f * PI * y;
-			
-			int index = i * SQRT_SAMPLE_COUNT + j;
+			this->pmm  [m] = pmm;
+			this->pmmp1[m] = (2.0f * m + 1.0f) * pmm;
 
-			// Store polar coords
-			samples[index].theta = theta;
-			samples[index].phi   = phi;
+			for (int l = m; l < NumBands; l++) {
+				float k = m == 0 ? calc_K(l, m) : float(SH::constexpr_sqrt(2.0)) * calc_K(l, m);
 
-			// Convert spherical coords to unit vector
-			samples[index].direction = glm::vec3(sin(theta) * cos(phi), sin(theta) * sin(phi), cos(theta));
+				normalization[SH_INDEX(l,  m)] = k;
+				normalization[SH_INDEX(l, -m)] = k;
 
-			// Precompute all SH coefficients for this sample
-			for (int l = 0; l < SH_NUM_BANDS; l++) {
-				for (int m = -l; m <= l; m++) {
-					samples[index].coeffs[SH_INDEX(l, m)] = evaluate(l, m, theta, phi);
+				// Rule 1 is only used for l > m + 1
+				if (l > m + 1) {
+					a[SH_INDEX(l, m)] = (2.0f * l - 1.0f) / float(l - m);
+					b[SH_INDEX(l, m)] = (l + m - 1.0f)    / float(l - m);
 				}
 			}
 		}
 	}
+};
+
+template<int NumBands>
+static const BasisTable<NumBands>& get_basis_table() {
+	// Constant initialized, so no initialization happens at runtime
+	static constexpr BasisTable<NumBands> table;
+
+	return table;
+}
+
+// Evaluates the basis functions of the first NumBands bands for as many directions as fit in a Lanes::Type
+template<typename Lanes, int NumBands>
+static inline void evaluate_lanes(const BasisTable<NumBands>& table, const float x[], const float y[], const float z[], float result[], int result_stride) {
+	typedef typename Lanes::Type Float;
+
+	Float dir_x = Lanes::load(x);
+	Float dir_y = Lanes::load(y);
+	Float dir_z = Lanes::load(z);
+
+	// sin^m(theta) cos(m phi) and sin^m(theta) sin(m phi), starting at m = 0
+	Float c = Lanes::set(1.0f);
+	Float s = Lanes::set(0.0f);
+
+	for (int m = 0; m < NumBands; m++) {
+		Float p_prev = Lanes::set(0.0f);
+		Float p      = Lanes::set(table.pmm[m]);
+
+		for (int l = m; l < NumBands; l++) {
+			if (l == m + 1) {
+				// Rule 3
+				p_prev = p;
+				p      = Lanes::mul(dir_z, Lanes::set(table.pmmp1[m]));
+			} else if (l > m + 1) {
+				// Rule 1
+				Float p_next = Lanes::sub(
+					Lanes::mul(Lanes::mul(Lanes::set(table.a[SH_INDEX(l, m)]), dir_z), p),
+					Lanes::mul(Lanes::set(table.b[SH_INDEX(l, m)]), p_prev)
+				);
+				p_prev = p;
+				p      = p_next;
+			}
+
+			Float np = Lanes::mul(Lanes::set(table.normalization[SH_INDEX(l, m)]), p);
+
+			if (m == 0) {
+				Lanes::store(result + SH_INDEX(l, 0) * result_stride, np);
+			} else {
+				Lanes::store(result + SH_INDEX(l,  m) * result_stride, Lanes::mul(np, c));
+				Lanes::store(result + SH_INDEX(l, -m) * result_stride, Lanes::mul(np, s));
+			}
+		}
+
+		// Multiply by x + iy to go from m to m + 1
+		Float c_next = Lanes::sub(Lanes::mul(dir_x, c), Lanes::mul(dir_y, s));
+		Float s_next = Lanes::add(Lanes::mul(dir_x, s), Lanes::mul(dir_y, c));
+		c = c_next;
+		s = s_next;
+	}
+}
+
+void SH::evaluate(const glm::vec3& direction, float result[], int num_bands) {
+	dispatch_num_bands(num_bands, [&](auto bands) {
+		const int NumBands = decltype(bands)::value;
+
+		evaluate_lanes<LanesScalar, NumBands>(get_basis_table<NumBands>(), &direction.x, &direction.y, &direction.z, result, 1);
+	});
+}
+
+template<int NumBands>
+static void evaluate_batch(const BasisTable<NumBands>& table, int count, const float x[], const float y[], const float z[], float result[], int result_stride) {
+	int i = 0;
+
+	switch (SIMD::get_level()) {
+		case SIMD::Level::SCALAR: break;
+		case SIMD::Level::SSE: {
+			for (; i + 4 <= count; i += 4) {
+				evaluate_lanes<LanesSSE, NumBands>(table, x + i, y + i, z + i, result + i, result_stride);
+			}
+		} break;
+		case SIMD::Level::AVX2: {
+			for (; i + 8 <= count; i += 8) {
+				evaluate_lanes<LanesAVX2, NumBands>(table, x + i, y + i, z + i, result + i, result_stride);
+			}
+		} break;
+
+		default: abort();
+	}
+
+	// Remaining directions that do not fill up a complete SIMD register
+	for (; i < count; i++) {
+		evaluate_lanes<LanesScalar, NumBands>(table, x + i, y + i, z + i, result + i, result_stride);
+	}
+}
+
+void SH::evaluate(int count, const float x[], const float y[], const float z[], float result[], int result_stride, int num_bands) {
+	dispatch_num_bands(num_bands, [&](auto bands) {
+		const int NumBands = decltype(bands)::value;
+
+		evaluate_batch<NumBands>(get_basis_table<NumBands>(), count, x, y, z, result, result_stride);
+	});
+}
+
+// Radical inverse in base 2, mirrors the bits of i around the binary point
+static u32 radical_inverse(u32 i) {
+	i = (i << 16) | (i >> 16);
+	i = ((i & 0x00ff00ff) << 8) | ((i & 0xff00ff00) >> 8);
+	i = ((i & 0x0f0f0f0f) << 4) | ((i & 0xf0f0f0f0) >> 4);
+	i = ((i & 0x33333333) << 2) | ((i & 0xcccccccc) >> 2);
+	i = ((i & 0x55555555) << 1) | ((i & 0xaaaaaaaa) >> 1);
+
+	return i;
+}
+
+// Second dimension of the Sobol sequence, the first dimension is the radical inverse.
+// The direction numbers of this dimension follow from its primitive polynomial x + 1, every direction number is the previous one xor'ed with itself shifted right by one
+static u32 sobol_second_dimension(u32 i) {
+	u32 result = 0;
+
+	for (u32 direction = 1u << 31; i; i >>= 1, direction ^= direction >> 1) {
+		if (i & 1) result ^= direction;
+	}
+
+	return result;
+}
+
+// Maps a 32 bit fixed point number to the range [0, 1), only the upper 24 bits are used so that the result is exactly representable and never rounds up to 1
+static float fixed_point_to_float(u32 x) {
+	return float(x >> 8) * (1.0f / 16777216.0f);
+}
+
+void SH::init_samples(Sample samples[], int sample_count, const SampleSettings& settings, int first_sample) {
+	u32 seed = settings.seed;
+	if (seed == SH_RANDOM_SEED) {
+		std::random_device random_device;
+		seed = random_device();
+	}
+
+	std::mt19937 gen(seed);
+
+	// Sobol keeps the random shifts of the first batch so that the batches together form a prefix of the same shifted sequence,
+	// the other generators need new random numbers for every batch
+	if (first_sample > 0 && settings.generator != SampleSettings::Generator::SOBOL) {
+		std::seed_seq seed_sequence = { seed, u32(first_sample) };
+		gen.seed(seed_sequence);
+	}
+
+	std::uniform_real_distribution<float> U01(0.0f, 1.0f);
+
+	// Generate points in the unit square, their distribution carries over to the sphere because the mapping below preserves area
+	float * points_x = new float[sample_count];
+	float * points_y = new float[sample_count];
+
+	switch (settings.generator) {
+		case SampleSettings::Generator::JITTERED: {
+			const int sqrt_sample_count = int(sqrt(float(sample_count)));
+			const int grid_sample_count = sqrt_sample_count * sqrt_sample_count;
+
+			const float inv_sqrt_n_samples = 1.0f / (float)sqrt_sample_count;
+
+			for (int i = 0; i < sqrt_sample_count; i++) {
+				for (int j = 0; j < sqrt_sample_count; j++) {
+					int index = i * sqrt_sample_count + j;
+
+					points_x[index] = ((float)i + U01(gen)) * inv_sqrt_n_samples;
+					points_y[index] = ((float)j + U01(gen)) * inv_sqrt_n_samples;
+				}
+			}
+
+			// Samples that do not fit in the grid are not stratified
+			for (int s = grid_sample_count; s < sample_count; s++) {
+				points_x[s] = U01(gen);
+				points_y[s] = U01(gen);
+			}
+		} break;
+
+		// The random shifts keep the stratification of the point sets intact: a toroidal shift of x moves every point by the same amount,
+		// xor'ing the bits of y with a random number (a digital shift) maps every elementary interval onto another elementary interval
+		case SampleSettings::Generator::HAMMERSLEY: {
+			float shift_x = U01(gen);
+			u32   shift_y = gen();
+
+			for (int s = 0; s < sample_count; s++) {
+				float x = ((float)s + 0.5f) / (float)sample_count + shift_x;
+
+				points_x[s] = x < 1.0f ? x : x - 1.0f;
+				points_y[s] = fixed_point_to_float(radical_inverse(s) ^ shift_y);
+			}
+		} break;
+
+		case SampleSettings::Generator::SOBOL: {
+			u32 shift_x = gen();
+			u32 shift_y = gen();
+
+			for (int s = 0; s < sample_count; s++) {
+				u32 index = u32(first_sample + s);
+
+				points_x[s] = fixed_point_to_float(radical_inverse(index)        ^ shift_x);
+				points_y[s] = fixed_point_to_float(sobol_second_dimension(index) ^ shift_y);
+			}
+		} break;
+
+		// Equally spaced in z, which makes every sample cover the same area, while every next sample is rotated around the z axis by the golden angle
+		case SampleSettings::Generator::FIBONACCI: {
+			const double inv_golden_ratio = 0.5 * (sqrt(5.0) - 1.0);
+
+			double offset = U01(gen);
+
+			for (int s = 0; s < sample_count; s++) {
+				double y = double(s) * inv_golden_ratio + offset;
+
+				points_x[s] = ((float)s + 0.5f) / (float)sample_count;
+				points_y[s] = float(y - floor(y));
+			}
+		} break;
+
+		default: abort();
+	}
+
+	for (int s = 0; s < sample_count; s++) {
+		// Convert x and y to Spherical Coordinates
+		float theta = 2.0f * acos(sqrt(1.0f - points_x[s]));
+		float phi   = 2.0f * PI * points_y[s];
+
+		// Store polar coords
+		samples[s].theta = theta;
+		samples[s].phi   = phi;
+
+		// Convert spherical coords to unit vector
+		samples[s].direction = glm::vec3(sin(theta) * cos(phi), sin(theta) * sin(phi), cos(theta));
+	}
+
+	delete[] points_x;
+	delete[] points_y;
+
+	// Precompute all SH coefficients, the batch evaluation works on Structure of Arrays layout
+	float * directions_x = new float[sample_count];
+	float * directions_y = new float[sample_count];
+	float * directions_z = new float[sample_count];
+	float * coeffs       = new float[SH_MAX_COEFFICIENT_COUNT * sample_count];
+
+	for (int s = 0; s < sample_count; s++) {
+		directions_x[s] = samples[s].direction.x;
+		directions_y[s] = samples[s].direction.y;
+		directions_z[s] = samples[s].direction.z;
+	}
+
+	evaluate(sample_count, directions_x, directions_y, directions_z, coeffs, sample_count);
+
+	for (int s = 0; s < sample_count; s++) {
+		for (int c = 0; c < SH_MAX_COEFFICIENT_COUNT; c++) {
+			samples[s].coeffs[c] = coeffs[c * sample_count + s];
+		}
+	}
+
+	delete[] directions_x;
+	delete[] directions_y;
+	delete[] directions_z;
+	delete[] coeffs;
 }
 
-void SH::calc_phong_lobe_coeffs(float result[SH_NUM_BANDS]) {
-	assert(SH_NUM_BANDS > 0);
+void SH::calc_phong_lobe_coeffs(float result[SH_MAX_NUM_BANDS]) {
+	assert(SH_MAX_NUM_BANDS > 0);
 
 	result[0] = PI;
 
-	if (SH_NUM_BANDS == 1) return;
+	if (SH_MAX_NUM_BANDS == 1) return;
 
 	result[1] = (2.0f * PI) / 3.0f;
 
 	// Even bands have a formula
-	for (int l = 2; l < SH_NUM_BANDS; l += 2) {
+	for (int l = 2; l < SH_MAX_NUM_BANDS; l += 2) {
 		result[l] = 2.0f * PI * 
 			(pow(-1.0f, (l >> 1) - 1) / (float)((l + 2) * (l - 1))) *
 			((factorial[l]) / ((float)(1 << l) * factorial[l >> 1] * factorial[l >> 1]));
 	}
 
 	// Odd bands (> 1) are zero
-	for (int l = 3; l < SH_NUM_BANDS; l += 2) {
+	for (int l = 3; l < SH_MAX_NUM_BANDS; l += 2) {
 		result[l] = 0.0f;
 	}
 }
+
+void SH::calc_cap_coeffs(float cos_cap_angle, float result[], int num_bands) {
+	// Legendre polynomials P_0 .. P_num_bands evaluated at the edge of the cap, using Bonnet's recursion
+	double legendre[SH_MAX_NUM_BANDS + 1];
+	legendre[0] = 1.0;
+	legendre[1] = cos_cap_angle;
+
+	for (int l = 1; l < num_bands; l++) {
+		legendre[l + 1] = ((2*l + 1) * cos_cap_angle * legendre[l] - l * legendre[l - 1]) / (l + 1);
+	}
+
+	// Y_l0 is P_l scaled by sqrt((2l + 1) / 4 PI), integrating over phi gives a factor 2 PI.
+	// The integral of P_l from cos_cap_angle to 1 is 1 - cos_cap_angle for l = 0, and (P_l-1 - P_l+1) / (2l + 1) for l > 0
+	result[0] = float(2.0 * PI * sqrt(1.0 / (4.0 * PI)) * (1.0 - cos_cap_angle));
+
+	for (int l = 1; l < num_bands; l++) {
+		result[l] = float(2.0 * PI * sqrt((2*l + 1) / (4.0 * PI)) * (legendre[l - 1] - legendre[l + 1]) / (2*l + 1));
+	}
+}
+
+// Number of lobe directions used by SH::project_polygon. Band l needs at least 2l + 1 of them, but with exactly that many
+// the symmetry of the Fibonacci lattice makes the system of the last band singular, so a few more are used and every band is solved in the least squares sense
+#define POLYGON_LOBE_COUNT (2 * SH_MAX_NUM_BANDS + 1)
+
+// Tables used by SH::project_polygon, they only depend on SH_MAX_NUM_BANDS and are built on first use
+struct PolygonTable {
+	glm::dvec3 lobe_directions[POLYGON_LOBE_COUNT];
+
+	// Monomial coefficients of the derivatives of the Legendre polynomials, P_l'(x) = sum_k legendre_derivatives[l][k] * x^k
+	double legendre_derivatives[SH_MAX_NUM_BANDS][SH_MAX_NUM_BANDS];
+
+	// Coefficient m of band l is sum_j solve[l][l + m][j] * S_lj, where S_lj is the integral of P_l(lobe_j . w) over the polygon
+	double solve[SH_MAX_NUM_BANDS][2 * SH_MAX_NUM_BANDS - 1][POLYGON_LOBE_COUNT];
+
+	PolygonTable() {
+		// Spread the lobes evenly over the sphere using a spherical Fibonacci lattice
+		for (int j = 0; j < POLYGON_LOBE_COUNT; j++) {
+			double z   = 1.0 - 2.0 * (j + 0.5) / POLYGON_LOBE_COUNT;
+			double r   = sqrt(1.0 - z*z);
+			double phi = j * PI * (3.0 - sqrt(5.0));
+
+			lobe_directions[j] = glm::dvec3(r * cos(phi), r * sin(phi), z);
+		}
+
+		// Monomial coefficients of the Legendre polynomials, using Bonnet's recursion
+		double legendre[SH_MAX_NUM_BANDS + 1][SH_MAX_NUM_BANDS + 1] = { };
+		legendre[0][0] = 1.0;
+		legendre[1][1] = 1.0;
+
+		for (int l = 1; l < SH_MAX_NUM_BANDS; l++) {
+			for (int k = 0; k <= l + 1; k++) {
+				legendre[l + 1][k] = ((2*l + 1) * (k > 0 ? legendre[l][k - 1] : 0.0) - l * legendre[l - 1][k]) / (l + 1);
+			}
+		}
+
+		for (int l = 0; l < SH_MAX_NUM_BANDS; l++) {
+			for (int k = 0; k < SH_MAX_NUM_BANDS; k++) {
+				legendre_derivatives[l][k] = (k + 1) * legendre[l][k + 1];
+			}
+		}
+
+		float basis[POLYGON_LOBE_COUNT][SH_MAX_COEFFICIENT_COUNT];
+		for (int j = 0; j < POLYGON_LOBE_COUNT; j++) {
+			SH::evaluate(glm::vec3(lobe_directions[j]), basis[j]);
+		}
+
+		// By the addition theorem P_l(lobe_j . w) = 4 PI / (2l + 1) * sum_m Y_lm(lobe_j) Y_lm(w), so with M_jm = Y_lm(lobe_j) the coefficients c of band l
+		// satisfy S = 4 PI / (2l + 1) * M c. The system is overdetermined, but consistent, so it is solved exactly by the pseudo-inverse of M:
+		// c = (2l + 1) / (4 PI) * (M^T M)^-1 M^T S. M^T M is symmetric positive definite, so Gauss-Jordan elimination does not need pivoting
+		for (int l = 0; l < SH_MAX_NUM_BANDS; l++) {
+			const int n = 2*l + 1;
+
+			double system[2 * SH_MAX_NUM_BANDS - 1][2 * SH_MAX_NUM_BANDS - 1 + POLYGON_LOBE_COUNT];
+
+			for (int a = 0; a < n; a++) {
+				for (int b = 0; b < n; b++) {
+					double sum = 0.0;
+					for (int j = 0; j < POLYGON_LOBE_COUNT; j++) {
+						sum += double(basis[j][l*l + a]) * double(basis[j][l*l + b]);
+					}
+					system[a][b] = sum;
+				}
+
+				for (int j = 0; j < POLYGON_LOBE_COUNT; j++) {
+					system[a][n + j] = basis[j][l*l + a];
+				}
+			}
+
+			for (int col = 0; col < n; col++) {
+				double one_over_pivot = 1.0 / system[col][col];
+				for (int k = 0; k < n + POLYGON_LOBE_COUNT; k++) {
+					system[col][k] *= one_over_pivot;
+				}
+
+				for (int row = 0; row < n; row++) {
+					if (row == col) continue;
+
+					double factor = system[row][col];
+					for (int k = 0; k < n + POLYGON_LOBE_COUNT; k++) {
+						system[row][k] -= factor * system[col][k];
+					}
+				}
+			}
+
+			for (int a = 0; a < n; a++) {
+				for (int j = 0; j < POLYGON_LOBE_COUNT; j++) {
+					solve[l][a][j] = (2*l + 1) / (4.0 * PI) * system[a][n + j];
+				}
+			}
+		}
+	}
+};
+
+void SH::project_polygon(int vertex_count, const glm::vec3 vertices[], float result[], int num_bands) {
+	static const PolygonTable table;
+
+	const int coefficient_count = get_coefficient_count(num_bands);
+
+	for (int n = 0; n < coefficient_count; n++) {
+		result[n] = 0.0f;
+	}
+
+	if (vertex_count < 3) return;
+
+	// Solid angle of the polygon, as a fan of triangles around the first vertex using the formula of Van Oosterom and Strackee.
+	// It is positive if the vertices are in counter clockwise order when seen from outside the sphere
+	double solid_angle = 0.0;
+
+	for (int i = 1; i + 1 < vertex_count; i++) {
+		glm::dvec3 a(vertices[0]);
+		glm::dvec3 b(vertices[i]);
+		glm::dvec3 c(vertices[i + 1]);
+
+		solid_angle += 2.0 * atan2(glm::dot(a, glm::cross(b, c)), 1.0 + glm::dot(a, b) + glm::dot(b, c) + glm::dot(c, a));
+	}
+
+	// Integrals of P_l(lobe_j . w) over the polygon. The integral of P_0 is the solid angle, for any lobe
+	double lobe_integrals[SH_MAX_NUM_BANDS][POLYGON_LOBE_COUNT] = { };
+
+	for (int i = 0; i < vertex_count; i++) {
+		glm::dvec3 a(vertices[i]);
+		glm::dvec3 b(vertices[(i + 1) % vertex_count]);
+
+		// The edge is the great arc w(s) = a cos(s) + t sin(s) for s in [0, arc_angle], where t is the tangent at a. The plane of the arc has normal n
+		glm::dvec3 n = glm::cross(a, b);
+		double n_length = glm::length(n);
+
+		if (n_length == 0.0) continue;
+
+		n /= n_length;
+		glm::dvec3 t = glm::cross(n, a);
+
+		double arc_angle = atan2(n_length, glm::dot(a, b));
+		double cos_arc   = cos(arc_angle);
+		double sin_arc   = sin(arc_angle);
+
+		for (int j = 0; j < POLYGON_LOBE_COUNT; j++) {
+			const glm::dvec3& lobe = table.lobe_directions[j];
+
+			// Along the edge x(s) = lobe . w(s) = alpha cos(s) + beta sin(s), so x'' = -x and x^2 + x'^2 = alpha^2 + beta^2.
+			// This gives a recursion for the integrals of the powers of x along the edge: k D_k = (k - 1) (alpha^2 + beta^2) D_k-2 - [x^(k-1) x'] from 0 to arc_angle
+			double alpha = glm::dot(lobe, a);
+			double beta  = glm::dot(lobe, t);
+
+			double x_begin  = alpha;
+			double x_end    = alpha * cos_arc + beta * sin_arc;
+			double dx_begin = beta;
+			double dx_end   = beta * cos_arc - alpha * sin_arc;
+
+			double power_integrals[SH_MAX_NUM_BANDS];
+			power_integrals[0] = arc_angle;
+
+			double x_begin_power = 1.0;
+			double x_end_power   = 1.0;
+
+			for (int k = 1; k < num_bands - 1; k++) {
+				double previous = k > 1 ? (k - 1) * (alpha*alpha + beta*beta) * power_integrals[k - 2] : 0.0;
+
+				power_integrals[k] = (previous - (x_end_power * dx_end - x_begin_power * dx_begin)) / k;
+
+				x_begin_power *= x_begin;
+				x_end_power   *= x_end;
+			}
+
+			// The divergence theorem on the sphere, together with Legendre's differential equation, turns the integral of P_l over the polygon
+			// into -1 / (l (l + 1)) times the integral along the boundary of P_l' times the outward normal of the boundary, which is -n for this edge
+			double normal = glm::dot(lobe, n);
+
+			for (int l = 1; l < num_bands; l++) {
+				double edge_integral = 0.0;
+				for (int k = 0; k < l; k++) {
+					edge_integral += table.legendre_derivatives[l][k] * power_integrals[k];
+				}
+
+				lobe_integrals[l][j] += normal * edge_integral;
+			}
+		}
+	}
+
+	// Flip the signs if the vertices were given in clockwise order
+	double winding = solid_angle < 0.0 ? -1.0 : 1.0;
+
+	for (int j = 0; j < POLYGON_LOBE_COUNT; j++) {
+		lobe_integrals[0][j] = winding * solid_angle;
+
+		for (int l = 1; l < num_bands; l++) {
+			lobe_integrals[l][j] *= winding / (l * (l + 1));
+		}
+	}
+
+	for (int l = 0; l < num_bands; l++) {
+		for (int a = 0; a < 2*l + 1; a++) {
+			double sum = 0.0;
+			for (int j = 0; j < POLYGON_LOBE_COUNT; j++) {
+				sum += table.solve[l][a][j] * lobe_integrals[l][j];
+			}
+
+			result[l*l + a] = float(sum);
+		}
+	}
+}
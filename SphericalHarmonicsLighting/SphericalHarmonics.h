@@ -1,15 +1,22 @@
 #pragma once
+#include <cstdlib>
+#include <type_traits>
+
 #include <glm/glm.hpp>
 
+#include "Types.h"
 #include "Util.h"
 
-// Number of Spherical Harmonic bands, commonly referred to with the letter l
-#define SH_NUM_BANDS 5
-#define SH_COEFFICIENT_COUNT (SH_NUM_BANDS * SH_NUM_BANDS)
+// Maximum number of Spherical Harmonic bands, commonly referred to with the letter l.
+// Every Mesh chooses its own number of bands in the range [1..SH_MAX_NUM_BANDS], arrays that are shared between Meshes are sized for the maximum
+#define SH_MAX_NUM_BANDS 6
+#define SH_MAX_COEFFICIENT_COUNT (SH_MAX_NUM_BANDS * SH_MAX_NUM_BANDS)
+
+// Number of bands used by Meshes that do not ask for a specific number
+#define SH_DEFAULT_NUM_BANDS 5
 
-// Amount of samples used for Monte Carlo integration
-#define SQRT_SAMPLE_COUNT 50
-#define SAMPLE_COUNT (SQRT_SAMPLE_COUNT * SQRT_SAMPLE_COUNT)
+// Seed that makes SH::init_samples seed its random numbers using std::random_device, which gives different samples on every run
+#define SH_RANDOM_SEED 0
 
 namespace SH {
 	// Spherical Harmonics Sample
@@ -19,43 +26,127 @@ namespace SH {
 		float phi;
 		glm::vec3 direction;
 
-		// SH coefficients that make up the sample
-		float coeffs[SH_COEFFICIENT_COUNT];
+		// SH coefficients that make up the sample, for all SH_MAX_NUM_BANDS bands.
+		// The coefficients of the first n bands are the same regardless of the number of bands, so fewer bands simply use a prefix of this array
+		float coeffs[SH_MAX_COEFFICIENT_COUNT];
 	};
 
+	// Controls how SH::init_samples distributes the sample directions over the unit sphere.
+	// Every generator produces points in the unit square that are mapped onto the sphere while preserving area
+	struct SampleSettings {
+		enum class Generator {
+			JITTERED,   // One random point in every cell of a sqrt(n) x sqrt(n) grid, if n is not a square the remaining points are uniformly random
+			HAMMERSLEY, // Hammersley point set, (i + 0.5) / n paired with the base 2 radical inverse of i
+			SOBOL,      // First two dimensions of the Sobol sequence, stratifies best when the number of samples is a power of two
+			FIBONACCI   // Spherical Fibonacci lattice, equally spaced in z with every next sample rotated around the z axis by the golden angle
+		} generator = Generator::FIBONACCI;
+
+		// Seed of the random numbers used by the generator. The jittered grid uses them for the positions inside the cells,
+		// the other generators use them to randomly shift the entire point set, which keeps its structure intact.
+		// A fixed seed always produces the same samples, SH_RANDOM_SEED gives different samples on every run
+		u32 seed = 1;
+	};
+
+	constexpr int get_coefficient_count(int num_bands) {
+		return num_bands * num_bands;
+	}
+
+	// Square root that can be evaluated at compile time, used to generate the constant tables of the SH functions and their rotations.
+	// Newton's method converges monotonically from above, so the iteration stops as soon as the estimate no longer decreases
+	constexpr double constexpr_sqrt(double x) {
+		if (x <= 0.0) return 0.0;
+
+		double estimate = x > 1.0 ? x : 1.0;
+
+		while (true) {
+			double next = 0.5 * (estimate + x / estimate);
+			if (next >= estimate) return estimate;
+
+			estimate = next;
+		}
+	}
+
+	// Calls callback with a std::integral_constant<int, num_bands>, which allows the callback to instantiate kernels that are templated on the number of bands.
+	// This way the loops over the coefficients have a trip count known at compile time, while the number of bands is still chosen at runtime
+	template<typename Callback>
+	inline void dispatch_num_bands(int num_bands, Callback callback) {
+		static_assert(SH_MAX_NUM_BANDS <= 6, "Add a case for every supported number of bands");
+
+		switch (num_bands) {
+			case 1: callback(std::integral_constant<int, 1>()); break;
+			case 2: callback(std::integral_constant<int, 2>()); break;
+			case 3: callback(std::integral_constant<int, 3>()); break;
+			case 4: callback(std::integral_constant<int, 4>()); break;
+			case 5: callback(std::integral_constant<int, 5>()); break;
+			case 6: callback(std::integral_constant<int, 6>()); break;
+
+			default: abort();
+		}
+	}
+
 	// Returns a point sample of a Spherical Harmonic basis function
 	// l is the band, range [0..N]
 	// m in the range [-l..l]
 	// theta in the range [0..Pi]
 	// phi in the range [0..2*Pi]
 	float evaluate(int l, int m, float theta, float phi);
+
+	// Evaluates the basis functions of the first num_bands bands for a direction of unit length.
+	// Uses the polynomial form of the basis functions in Cartesian coordinates, which avoids the trigonometry of the polar version
+	void evaluate(const glm::vec3& direction, float result[], int num_bands = SH_MAX_NUM_BANDS);
+
+	// Evaluates the basis functions of the first num_bands bands for count directions of unit length, given in Structure of Arrays layout.
+	// The result is stored in Structure of Arrays layout as well: basis function k of direction i is written to result[k * result_stride + i].
+	// Directions are processed 4 (SSE) or 8 (AVX2) at a time based on SIMD::get_level(), all kernels produce identical results
+	void evaluate(int count, const float x[], const float y[], const float z[], float result[], int result_stride, int num_bands = SH_MAX_NUM_BANDS);
 	
-	// Fills the sample array with uniformly distributed SH samples across the unit sphere, using jittered stratification
-	void init_samples(Sample samples[SAMPLE_COUNT]);
+	// Fills the sample array with sample_count uniformly distributed SH samples across the unit sphere, using the generator and seed of the SampleSettings.
+	// Progressive bakes request their samples in batches, first_sample is the number of samples that were requested before this batch.
+	// The Sobol generator continues its sequence, the other generators produce a new independent point set for every batch
+	void init_samples(Sample samples[], int sample_count, const SampleSettings& settings = SampleSettings(), int first_sample = 0);
+
+	// Projects a given polar function into Spherical Harmonic coefficients, for NumBands bands.
+	// This is done using Monte Carlo integration, using the sample_count samples provided in the samples array
+	template<int NumBands, typename PolarFunction>
+	void project_polar_function(PolarFunction& polar_function, const Sample samples[], int sample_count, glm::vec3 result[]) {
+		const int coefficient_count = get_coefficient_count(NumBands);
 
-	// Projects a given polar function into Spherical Harmonic coefficients.
-	// This is done using Monte Carlo integration, using the samples provided in the samples array
-	template<typename PolarFunction>
-	void project_polar_function(PolarFunction& polar_function, const Sample samples[SAMPLE_COUNT], glm::vec3 result[]) {
 		// For each sample
-		for (int s = 0; s < SAMPLE_COUNT; s++) {
-			float theta = samples[s].theta;
-			float phi   = samples[s].phi;
+		for (int s = 0; s < sample_count; s++) {
+			glm::vec3 value = polar_function(samples[s].theta, samples[s].phi);
 
 			// For each SH coefficient
-			for (int c = 0; c < SH_COEFFICIENT_COUNT; c++) {
-				result[c] += polar_function(theta, phi) * samples[s].coeffs[c];
+			for (int c = 0; c < coefficient_count; c++) {
+				result[c] += value * samples[s].coeffs[c];
 			}
 		}
 
 		//  Weighted by the surface area of a 3D unit sphere, divided by the number of samples
-		const float factor = 4.0f * PI / SAMPLE_COUNT;
-		for (int c = 0; c < SH_COEFFICIENT_COUNT; c++) {
+		const float factor = 4.0f * PI / sample_count;
+		for (int c = 0; c < coefficient_count; c++) {
 			result[c] *= factor;
 		}
 	}
+
+	template<typename PolarFunction>
+	void project_polar_function(PolarFunction& polar_function, const Sample samples[], int sample_count, glm::vec3 result[], int num_bands = SH_MAX_NUM_BANDS) {
+		dispatch_num_bands(num_bands, [&](auto bands) {
+			project_polar_function<decltype(bands)::value>(polar_function, samples, sample_count, result);
+		});
+	}
 	
 	// Calulates phong lobe SH coefficients using an analytical approxiamation
 	// Formula from the paper "An Efficient Representation for Irradiance Environment Maps" by Ramamoorthi and Hanrahan
-	void calc_phong_lobe_coeffs(float result[SH_NUM_BANDS]);
+	void calc_phong_lobe_coeffs(float result[SH_MAX_NUM_BANDS]);
+
+	// Calculates the zonal coefficients of a spherical cap around the z axis that has a value of one inside and zero outside of the cap.
+	// cos_cap_angle is the cosine of the angle between the z axis and the edge of the cap. The integral of every Legendre polynomial over the cap has a closed form
+	void calc_cap_coeffs(float cos_cap_angle, float result[], int num_bands = SH_MAX_NUM_BANDS);
+
+	// Projects a spherical polygon that has a value of one inside and zero outside of the polygon into get_coefficient_count(num_bands) coefficients.
+	// The polygon is given by vertex_count directions of unit length, its edges are great arcs. It should be convex, the winding order does not matter.
+	// The integral of a zonal harmonic over the polygon is reduced to integrals over its edges, which have a closed form.
+	// Every band is then solved from the zonal harmonics of a fixed set of lobe directions, using the method from the paper
+	// "Analytic Spherical Harmonic Coefficients for Polygonal Area Lights" by Wang and Ramamoorthi
+	void project_polygon(int vertex_count, const glm::vec3 vertices[], float result[], int num_bands = SH_MAX_NUM_BANDS);
 }
@@ -0,0 +1,368 @@
+#include "TLAS.h"
+
+#include <algorithm>
+
+#include "Scene.h"
+
+#include "Util.h"
+
+void MeshInstance::init(const Mesh * mesh) {
+	this->mesh = mesh;
+}
+
+// Recursively builds the subtree over the instances in the range [first, first + count) by splitting the
+// longest axis of their centers at the median. Returns the index of the node, nodes are stored in depth-first order.
+// Median splits keep the tree balanced, so its depth is at most ceil(log2(count)), which is always within BVH_MAX_DEPTH
+static int build_node(TLAS& tlas, Array<FlatBVHNode>& nodes, int first, int count) {
+	int index = int(nodes.size());
+	nodes.emplace_back();
+
+	AABB aabb;
+	aabb.min = glm::vec3(+INFINITY);
+	aabb.max = glm::vec3(-INFINITY);
+
+	AABB center_bounds = aabb;
+
+	for (int i = first; i < first + count; i++) {
+		aabb.expand(tlas.instances[i].aabb);
+
+		glm::vec3 center = 0.5f * (tlas.instances[i].aabb.min + tlas.instances[i].aabb.max);
+		AABB center_aabb = { center, center };
+		center_bounds.expand(center_aabb);
+	}
+
+	nodes[index].aabb = aabb;
+
+	if (count == 1) {
+		nodes[index].right_or_first = first;
+		nodes[index].triangle_count = 1; // Number of instances in the leaf
+
+		return index;
+	}
+
+	glm::vec3 size = center_bounds.max - center_bounds.min;
+
+	int axis = 0;
+	if (size.y > size[axis]) axis = 1;
+	if (size.z > size[axis]) axis = 2;
+
+	// Partition around the median, this always results in a balanced tree even if many instances share the same center
+	int half = count / 2;
+	std::nth_element(tlas.instances + first, tlas.instances + first + half, tlas.instances + first + count, [axis](const MeshInstance& a, const MeshInstance& b) {
+		return a.aabb.min[axis] + a.aabb.max[axis] < b.aabb.min[axis] + b.aabb.max[axis];
+	});
+
+	// NOTE: nodes can be reallocated by the recursive calls, so the node is only accessed through its index
+	nodes[index].triangle_count = 0;
+
+	build_node(tlas, nodes, first, half);
+	int right = build_node(tlas, nodes, first + half, count - half);
+
+	nodes[index].right_or_first = right;
+
+	return index;
+}
+
+void TLAS::build(int instance_count, const MeshInstance instances[]) {
+	this->instance_count = instance_count;
+	this->instances      = new MeshInstance[instance_count];
+
+	for (int i = 0; i < instance_count; i++) {
+		this->instances[i]      = instances[i];
+		this->instances[i].aabb = instances[i].mesh->aabb;
+	}
+
+	if (instance_count == 0) {
+		node_count = 0;
+		nodes      = NULL;
+
+		return;
+	}
+
+	Array<FlatBVHNode> node_array;
+	node_array.reserve(2 * instance_count - 1);
+
+	build_node(*this, node_array, 0, instance_count);
+
+	node_count = int(node_array.size());
+	nodes      = new FlatBVHNode[node_count];
+	memcpy(nodes, node_array.data(), node_count * sizeof(FlatBVHNode));
+}
+
+void TLAS::free() {
+	delete[] nodes;
+	delete[] instances;
+}
+
+bool TLAS::intersects(const Ray& _ray) const {
+	if (node_count == 0) return false;
+
+	const TraversalRay ray(_ray);
+
+	if (ray.trace(nodes[0].aabb) == INFINITY) return false;
+
+	int stack[BVH_STACK_SIZE];
+	int stack_size = 1;
+	stack[0] = 0;
+
+	while (stack_size > 0) {
+		int node_index = stack[--stack_size];
+		const FlatBVHNode& node = nodes[node_index];
+
+		if (node.is_leaf()) {
+			const MeshInstance& instance = instances[node.right_or_first];
+
+			if (instance.mesh->intersects(_ray)) {
+				return true;
+			}
+		} else {
+			int child_near = node_index + 1;
+			int child_far  = node.right_or_first;
+
+			float distance_near = ray.trace(nodes[child_near].aabb);
+			float distance_far  = ray.trace(nodes[child_far ].aabb);
+
+			if (distance_far < distance_near) {
+				std::swap(child_near,    child_far);
+				std::swap(distance_near, distance_far);
+			}
+
+			assert(stack_size + 2 <= BVH_STACK_SIZE);
+
+			if (distance_far  != INFINITY) stack[stack_size++] = child_far;
+			if (distance_near != INFINITY) stack[stack_size++] = child_near;
+		}
+	}
+
+	return false;
+}
+
+// Traces the Rays of the packet that are set in mask through the Mesh of the instance, hits are added to the hits mask
+static void intersects_instance(const MeshInstance& instance, const RayPacket& packet, const RayPacketMask& mask, RayPacketMask& hits) {
+	// Rays that are not in the mask are marked as hit for the Mesh, so that it skips them
+	RayPacketMask mesh_hits;
+	for (int i = 0; i < RAY_PACKET_MASK_SIZE; i++) {
+		mesh_hits.bits[i] = ~mask.bits[i];
+	}
+
+	instance.mesh->intersects(packet, mesh_hits);
+
+	for (int i = 0; i < RAY_PACKET_MASK_SIZE; i++) {
+		hits.bits[i] |= mesh_hits.bits[i] & mask.bits[i];
+	}
+}
+
+void TLAS::intersects(const RayPacket& packet, RayPacketMask& hits) const {
+	if (node_count == 0) return;
+
+	RayPacketMask active;
+	for (int i = 0; i < RAY_PACKET_MASK_SIZE; i++) {
+		active.bits[i] = ~hits.bits[i];
+	}
+
+	for (int i = packet.ray_count; i < RAY_PACKET_MAX_SIZE; i++) {
+		active.clear(i);
+	}
+
+	struct StackEntry {
+		int           node_index;
+		RayPacketMask mask;
+	} stack[BVH_STACK_SIZE];
+	int stack_size = 1;
+
+	stack[0].node_index = 0;
+	if (!packet.intersects(nodes[0].aabb, active, stack[0].mask)) return;
+
+	while (stack_size > 0) {
+		const StackEntry& entry = stack[--stack_size];
+
+		int node_index = entry.node_index;
+
+		// Rays that already hit another instance no longer need to be traced
+		RayPacketMask mask;
+		bool any_active = false;
+
+		for (int i = 0; i < RAY_PACKET_MASK_SIZE; i++) {
+			mask.bits[i] = entry.mask.bits[i] & active.bits[i];
+			any_active |= mask.bits[i] != 0;
+		}
+
+		if (!any_active) continue;
+
+		const FlatBVHNode& node = nodes[node_index];
+
+		if (node.is_leaf()) {
+			intersects_instance(instances[node.right_or_first], packet, mask, hits);
+
+			for (int i = 0; i < RAY_PACKET_MASK_SIZE; i++) {
+				active.bits[i] &= ~hits.bits[i];
+			}
+		} else {
+			int child_near = node_index + 1;
+			int child_far  = node.right_or_first;
+
+			glm::vec3 to_near = 0.5f * (nodes[child_near].aabb.min + nodes[child_near].aabb.max) - packet.origin;
+			glm::vec3 to_far  = 0.5f * (nodes[child_far ].aabb.min + nodes[child_far ].aabb.max) - packet.origin;
+
+			if (glm::dot(to_far, to_far) < glm::dot(to_near, to_near)) {
+				std::swap(child_near, child_far);
+			}
+
+			assert(stack_size + 2 <= BVH_STACK_SIZE);
+
+			if (packet.intersects(nodes[child_far].aabb, mask, stack[stack_size].mask)) {
+				stack[stack_size].node_index = child_far;
+				stack_size++;
+			}
+
+			if (packet.intersects(nodes[child_near].aabb, mask, stack[stack_size].mask)) {
+				stack[stack_size].node_index = child_near;
+				stack_size++;
+			}
+		}
+	}
+}
+
+float TLAS::trace(const Ray& _ray, int& triangle_index, float& u, float& v, const Mesh *& mesh) const {
+	if (node_count == 0) return INFINITY;
+
+	const TraversalRay ray(_ray);
+
+	float min_distance = INFINITY;
+
+	struct StackEntry {
+		int   node_index;
+		float distance;
+	} stack[BVH_STACK_SIZE];
+	int stack_size = 1;
+
+	stack[0].node_index = 0;
+	stack[0].distance   = ray.trace(nodes[0].aabb);
+
+	if (stack[0].distance == INFINITY) return INFINITY;
+
+	int   current_triangle_index;
+	float current_u;
+	float current_v;
+
+	while (stack_size > 0) {
+		const StackEntry& entry = stack[--stack_size];
+
+		if (entry.distance > min_distance) continue;
+
+		int node_index = entry.node_index;
+		const FlatBVHNode& node = nodes[node_index];
+
+		if (node.is_leaf()) {
+			const MeshInstance& instance = instances[node.right_or_first];
+
+			// Only hits closer than the closest hit in the previous instances are of interest
+			float distance = instance.mesh->trace(_ray, current_triangle_index, current_u, current_v, min_distance);
+			if (distance < min_distance) {
+				min_distance = distance;
+
+				triangle_index = current_triangle_index;
+				u = current_u;
+				v = current_v;
+
+				mesh = instance.mesh;
+			}
+		} else {
+			int child_near = node_index + 1;
+			int child_far  = node.right_or_first;
+
+			float distance_near = ray.trace(nodes[child_near].aabb, min_distance);
+			float distance_far  = ray.trace(nodes[child_far ].aabb, min_distance);
+
+			if (distance_far < distance_near) {
+				std::swap(child_near,    child_far);
+				std::swap(distance_near, distance_far);
+			}
+
+			assert(stack_size + 2 <= BVH_STACK_SIZE);
+
+			if (distance_far != INFINITY) {
+				stack[stack_size].node_index = child_far;
+				stack[stack_size].distance   = distance_far;
+				stack_size++;
+			}
+
+			if (distance_near != INFINITY) {
+				stack[stack_size].node_index = child_near;
+				stack[stack_size].distance   = distance_near;
+				stack_size++;
+			}
+		}
+	}
+
+	return min_distance;
+}
+
+// Finds the closest hits of the Rays of the packet that are set in mask in the Mesh of the instance
+static void trace_instance(const MeshInstance& instance, const RayPacket& packet, const RayPacketMask& mask, RayPacketHits& hits, const Mesh * meshes[]) {
+	// Used to find out which Rays found a closer hit in this instance
+	float previous_distances[RAY_PACKET_MAX_SIZE];
+	memcpy(previous_distances, hits.distances, packet.ray_count * sizeof(float));
+
+	instance.mesh->trace(packet, mask, hits);
+
+	for (int i = 0; i < packet.ray_count; i++) {
+		if (hits.distances[i] < previous_distances[i]) {
+			meshes[i] = instance.mesh;
+		}
+	}
+}
+
+void TLAS::trace(const RayPacket& packet, RayPacketHits& hits, const Mesh * meshes[RAY_PACKET_MAX_SIZE]) const {
+	if (node_count == 0) return;
+
+	RayPacketMask active = { };
+	for (int i = 0; i < packet.ray_count; i++) {
+		active.set(i);
+	}
+
+	struct StackEntry {
+		int           node_index;
+		RayPacketMask mask;
+	} stack[BVH_STACK_SIZE];
+	int stack_size = 1;
+
+	stack[0].node_index = 0;
+	if (!packet.intersects(nodes[0].aabb, active, hits.distances, stack[0].mask)) return;
+
+	while (stack_size > 0) {
+		const StackEntry& entry = stack[--stack_size];
+
+		int           node_index = entry.node_index;
+		RayPacketMask mask       = entry.mask;
+
+		const FlatBVHNode& node = nodes[node_index];
+
+		if (node.is_leaf()) {
+			trace_instance(instances[node.right_or_first], packet, mask, hits, meshes);
+		} else {
+			int child_near = node_index + 1;
+			int child_far  = node.right_or_first;
+
+			glm::vec3 to_near = 0.5f * (nodes[child_near].aabb.min + nodes[child_near].aabb.max) - packet.origin;
+			glm::vec3 to_far  = 0.5f * (nodes[child_far ].aabb.min + nodes[child_far ].aabb.max) - packet.origin;
+
+			if (glm::dot(to_far, to_far) < glm::dot(to_near, to_near)) {
+				std::swap(child_near, child_far);
+			}
+
+			assert(stack_size + 2 <= BVH_STACK_SIZE);
+
+			// Instances that start beyond the closest hit found so far are culled per Ray
+			if (packet.intersects(nodes[child_far].aabb, mask, hits.distances, stack[stack_size].mask)) {
+				stack[stack_size].node_index = child_far;
+				stack_size++;
+			}
+
+			if (packet.intersects(nodes[child_near].aabb, mask, hits.distances, stack[stack_size].mask)) {
+				stack[stack_size].node_index = child_near;
+				stack_size++;
+			}
+		}
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include "BVH.h"
+#include "RayPacket.h"
+
+struct Mesh; // Forward Declaration, defined in Scene.h
+
+// Placement of a Mesh in the Scene. Instances do not have a transform yet, the bake assumes that Meshes are already in world space:
+// shadow Rays start at the untransformed vertices, and OccluderRecords store the hit Mesh rather than the hit instance
+struct MeshInstance {
+	const Mesh * mesh;
+
+	AABB aabb; // World space bounds, calculated by TLAS::build
+
+	void init(const Mesh * mesh);
+};
+
+// Top Level Acceleration Structure, a BVH over MeshInstances that dispatches Rays into the BVHs of the Meshes.
+// Rays only visit the Meshes whose bounds they hit, so the cost grows logarithmically instead of linearly with the number of Meshes.
+// The nodes use the same layout as FlatBVH, every leaf contains a single MeshInstance
+struct TLAS {
+	int           node_count;
+	FlatBVHNode * nodes;
+
+	int            instance_count;
+	MeshInstance * instances; // Reordered such that the instance of every leaf is found at index right_or_first
+
+	// Copies and reorders the instances. Has to be called after the BVHs of the Meshes have been built
+	void build(int instance_count, const MeshInstance instances[]);
+	void free();
+
+	bool intersects(const Ray& ray) const;
+
+	// Same contract as FlatBVH::intersects(const RayPacket&, RayPacketMask&), but for all instances in the Scene
+	void intersects(const RayPacket& packet, RayPacketMask& hits) const;
+
+	// Returns the distance to the closest Triangle in the Scene, or INFINITY if nothing is hit.
+	// If a Triangle is hit, mesh is set to the Mesh that was hit and triangle_index refers to Mesh::get_bvh_triangle of that Mesh
+	float trace(const Ray& ray, int& triangle_index, float& u, float& v, const Mesh *& mesh) const;
+
+	// Same contract as FlatBVH::trace(const RayPacket&, const RayPacketMask&, RayPacketHits&) for all Rays of the packet,
+	// but for all instances in the Scene. For every Ray whose hit is updated, meshes[i] is set to the Mesh that was hit
+	void trace(const RayPacket& packet, RayPacketHits& hits, const Mesh * meshes[RAY_PACKET_MAX_SIZE]) const;
+};
@@ -0,0 +1,104 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int thread_count) : task(nullptr), generation(0), workers_busy(0), shutting_down(false) {
+	if (thread_count <= 0) {
+		thread_count = std::thread::hardware_concurrency();
+
+		// hardware_concurrency is allowed to return 0 if the value is not computable
+		if (thread_count <= 0) thread_count = 1;
+	}
+
+	this->thread_count = thread_count;
+
+	work_ranges = new WorkRange[thread_count];
+
+	// The calling thread acts as thread 0, so only thread_count - 1 worker threads need to be spawned
+	for (int i = 1; i < thread_count; i++) {
+		workers.emplace_back(&ThreadPool::worker_loop, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		shutting_down = true;
+	}
+	condition_start.notify_all();
+
+	for (int i = 0; i < int(workers.size()); i++) {
+		workers[i].join();
+	}
+
+	delete[] work_ranges;
+}
+
+void ThreadPool::worker_loop(int thread_index) {
+	u128 last_generation = 0;
+
+	while (true) {
+		const std::function<void(int)> * current_task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition_start.wait(lock, [&]() { return shutting_down || generation != last_generation; });
+
+			if (shutting_down) return;
+
+			last_generation = generation;
+			current_task    = task;
+		}
+
+		(*current_task)(thread_index);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			workers_busy--;
+
+			if (workers_busy == 0) {
+				condition_done.notify_one();
+			}
+		}
+	}
+}
+
+void ThreadPool::run(const std::function<void(int)>& task) {
+	// Without workers there is no need for any synchronization
+	if (thread_count == 1) {
+		task(0);
+
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		this->task   = &task;
+		workers_busy = thread_count - 1;
+		generation++;
+	}
+	condition_start.notify_all();
+
+	// The calling thread does its share of the work as well
+	task(0);
+
+	// Wait until all workers are done, this acts as a barrier
+	std::unique_lock<std::mutex> lock(mutex);
+	condition_done.wait(lock, [&]() { return workers_busy == 0; });
+
+	this->task = nullptr;
+}
+
+bool ThreadPool::next_chunk(int thread_index, int& chunk) {
+	// Try the range owned by this thread first, then try to steal from the other threads
+	for (int i = 0; i < thread_count; i++) {
+		WorkRange& range = work_ranges[(thread_index + i) % thread_count];
+
+		// Check before incrementing, to avoid hammering the atomics of ranges that are already exhausted
+		if (range.next.load(std::memory_order_relaxed) < range.end) {
+			chunk = range.next.fetch_add(1, std::memory_order_relaxed);
+
+			if (chunk < range.end) return true;
+		}
+	}
+
+	return false;
+}
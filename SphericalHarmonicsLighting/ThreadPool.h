@@ -0,0 +1,108 @@
+#pragma once
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include "Types.h"
+#include "Util.h"
+
+#include "ScopedTimer.h"
+
+// Pool of persistent worker threads used to parallelize embarrassingly parallel loops, such as the raytracing bake.
+// The thread that calls parallel_for participates as thread 0, a pool with a thread count of 1 therefore runs serially.
+// NOTE: parallel_for is not reentrant, it should not be called from within a job
+struct ThreadPool {
+private:
+	// Every thread starts out with its own contiguous range of chunks [next, end).
+	// When a thread runs out of chunks it steals chunks from the ranges of other threads,
+	// this way dense and sparse regions of the input are balanced automatically.
+	struct WorkRange {
+		std::atomic<int> next;
+		int              end;
+
+		char padding[64 - sizeof(std::atomic<int>) - sizeof(int)]; // Avoid false sharing between threads
+	};
+
+	int thread_count;
+
+	Array<std::thread> workers;
+	WorkRange *        work_ranges;
+
+	std::mutex              mutex;
+	std::condition_variable condition_start;
+	std::condition_variable condition_done;
+
+	const std::function<void(int)> * task;
+
+	u128 generation; // Incremented every time a new task is submitted, workers use this to detect new work
+	int  workers_busy;
+	bool shutting_down;
+
+	void worker_loop(int thread_index);
+
+	// Runs task(thread_index) on every thread in the pool and blocks until all threads are done
+	void run(const std::function<void(int)>& task);
+
+	// Obtains the next chunk index for the given thread, stealing from other threads if needed.
+	// Returns false when there are no chunks left anywhere
+	bool next_chunk(int thread_index, int& chunk);
+
+public:
+	// A thread count of 0 creates one thread per hardware thread
+	ThreadPool(int thread_count = 0);
+	~ThreadPool();
+
+	inline int get_thread_count() const {
+		return thread_count;
+	}
+
+	// Calls job(index, thread_index) for every index in the range [0, count).
+	// Indices are handed out in chunks of chunk_size consecutive indices.
+	// If a name is provided every thread reports the time it spent and its throughput using a ScopedTimer
+	template<typename Job>
+	void parallel_for(int count, int chunk_size, const Job& job, const char * name = nullptr) {
+		assert(chunk_size > 0);
+
+		if (count <= 0) return;
+
+		int chunk_count = (count + chunk_size - 1) / chunk_size;
+
+		// Divide the chunks evenly over the threads
+		for (int t = 0; t < thread_count; t++) {
+			work_ranges[t].next = (int)((s128)chunk_count *  t      / thread_count);
+			work_ranges[t].end  = (int)((s128)chunk_count * (t + 1) / thread_count);
+		}
+
+		auto execute = [&](int thread_index) {
+			int job_count = 0;
+
+			int chunk;
+			while (next_chunk(thread_index, chunk)) {
+				int start = chunk * chunk_size;
+				int end   = start + chunk_size < count ? start + chunk_size : count;
+
+				for (int i = start; i < end; i++) {
+					job(i, thread_index);
+				}
+
+				job_count += end - start;
+			}
+
+			return job_count;
+		};
+
+		run([&](int thread_index) {
+			if (name) {
+				char timer_name[128];
+				sprintf_s(timer_name, "%s [Thread %i]", name, thread_index);
+
+				ScopedTimer timer(timer_name, "items");
+				timer.item_count = execute(thread_index);
+			} else {
+				execute(thread_index);
+			}
+		});
+	}
+};
@@ -0,0 +1,140 @@
+#include "TransportMatrix.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <immintrin.h>
+
+#include "SIMD.h"
+
+void TransportMatrix::init(int coefficient_count, int row_count, const Array<TransportEntry> rows[]) {
+	this->coefficient_count = coefficient_count;
+	this->row_count         = row_count;
+
+	row_offsets = new int[row_count + 1];
+	row_offsets[0] = 0;
+
+	for (int r = 0; r < row_count; r++) {
+		row_offsets[r + 1] = row_offsets[r] + int(rows[r].size());
+	}
+
+	entry_count = row_offsets[row_count];
+	entries     = new TransportEntry[entry_count];
+
+	for (int r = 0; r < row_count; r++) {
+		if (rows[r].size() > 0) {
+			memcpy(entries + row_offsets[r], rows[r].data(), rows[r].size() * sizeof(TransportEntry));
+		}
+	}
+}
+
+void TransportMatrix::free() {
+	delete[] row_offsets;
+	delete[] entries;
+}
+
+void TransportMatrix::compact_row(Array<TransportEntry>& row) {
+	// A stable sort makes sure entries with the same column are always summed in the same order
+	std::stable_sort(row.begin(), row.end(), [](const TransportEntry& a, const TransportEntry& b) {
+		return a.column < b.column;
+	});
+
+	int count = 0;
+
+	for (int i = 0; i < int(row.size()); i++) {
+		if (count > 0 && row[count - 1].column == row[i].column) {
+			row[count - 1].weight += row[i].weight;
+		} else {
+			row[count++] = row[i];
+		}
+	}
+
+	row.resize(count);
+}
+
+size_t TransportMatrix::get_memory_usage() const {
+	return size_t(row_count + 1) * sizeof(int) + size_t(entry_count) * sizeof(TransportEntry);
+}
+
+// Scalar kernel, adds the transfer coefficients in the range [first_coefficient, coefficient_count) of a single row to out.
+// Also used by the SIMD kernels for the coefficients that do not fill up a complete SIMD register
+static void multiply_row_scalar(const TransportEntry * first, const TransportEntry * last, int first_coefficient, int coefficient_count, const glm::vec3 in[], glm::vec3 out[]) {
+	for (int i = first_coefficient; i < coefficient_count; i++) {
+		glm::vec3 sum(0.0f, 0.0f, 0.0f);
+
+		for (const TransportEntry * entry = first; entry < last; entry++) {
+			sum += entry->weight * in[entry->column + i];
+		}
+
+		out[i] += sum;
+	}
+}
+
+// SSE kernel, 4 coefficients at a time. The coefficients of a vertex are stored as consecutive rgb triplets, so 4 coefficients fill exactly 3 registers.
+// The weight is rotated such that every float is multiplied by the weight of its own colour channel
+static void multiply_row_sse(const TransportEntry * first, const TransportEntry * last, int coefficient_count, const glm::vec3 in[], glm::vec3 out[]) {
+	int block_end = coefficient_count & ~3;
+
+	for (int i = 0; i < block_end; i += 4) {
+		__m128 sum0 = _mm_setzero_ps();
+		__m128 sum1 = _mm_setzero_ps();
+		__m128 sum2 = _mm_setzero_ps();
+
+		for (const TransportEntry * entry = first; entry < last; entry++) {
+			const glm::vec3& w = entry->weight;
+			const float    * x = &in[entry->column + i].x;
+
+			sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_setr_ps(w.r, w.g, w.b, w.r), _mm_loadu_ps(x)));
+			sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_setr_ps(w.g, w.b, w.r, w.g), _mm_loadu_ps(x + 4)));
+			sum2 = _mm_add_ps(sum2, _mm_mul_ps(_mm_setr_ps(w.b, w.r, w.g, w.b), _mm_loadu_ps(x + 8)));
+		}
+
+		float * y = &out[i].x;
+		_mm_storeu_ps(y,     _mm_add_ps(_mm_loadu_ps(y),     sum0));
+		_mm_storeu_ps(y + 4, _mm_add_ps(_mm_loadu_ps(y + 4), sum1));
+		_mm_storeu_ps(y + 8, _mm_add_ps(_mm_loadu_ps(y + 8), sum2));
+	}
+
+	multiply_row_scalar(first, last, block_end, coefficient_count, in, out);
+}
+
+// AVX2 kernel, 8 coefficients (24 floats) at a time
+static void multiply_row_avx2(const TransportEntry * first, const TransportEntry * last, int coefficient_count, const glm::vec3 in[], glm::vec3 out[]) {
+	int block_end = coefficient_count & ~7;
+
+	for (int i = 0; i < block_end; i += 8) {
+		__m256 sum0 = _mm256_setzero_ps();
+		__m256 sum1 = _mm256_setzero_ps();
+		__m256 sum2 = _mm256_setzero_ps();
+
+		for (const TransportEntry * entry = first; entry < last; entry++) {
+			const glm::vec3& w = entry->weight;
+			const float    * x = &in[entry->column + i].x;
+
+			sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_setr_ps(w.r, w.g, w.b, w.r, w.g, w.b, w.r, w.g), _mm256_loadu_ps(x)));
+			sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_setr_ps(w.b, w.r, w.g, w.b, w.r, w.g, w.b, w.r), _mm256_loadu_ps(x + 8)));
+			sum2 = _mm256_add_ps(sum2, _mm256_mul_ps(_mm256_setr_ps(w.g, w.b, w.r, w.g, w.b, w.r, w.g, w.b), _mm256_loadu_ps(x + 16)));
+		}
+
+		float * y = &out[i].x;
+		_mm256_storeu_ps(y,      _mm256_add_ps(_mm256_loadu_ps(y),      sum0));
+		_mm256_storeu_ps(y + 8,  _mm256_add_ps(_mm256_loadu_ps(y + 8),  sum1));
+		_mm256_storeu_ps(y + 16, _mm256_add_ps(_mm256_loadu_ps(y + 16), sum2));
+	}
+
+	multiply_row_scalar(first, last, block_end, coefficient_count, in, out);
+}
+
+// Uses the kernel of the current SIMD level
+void TransportMatrix::multiply_row(int row, const glm::vec3 in[], glm::vec3 out[]) const {
+	const TransportEntry * first = entries + row_offsets[row];
+	const TransportEntry * last  = entries + row_offsets[row + 1];
+
+	switch (SIMD::get_level()) {
+		case SIMD::Level::SCALAR: multiply_row_scalar(first, last, 0, coefficient_count, in, out); break;
+		case SIMD::Level::SSE:    multiply_row_sse   (first, last,    coefficient_count, in, out); break;
+		case SIMD::Level::AVX2:   multiply_row_avx2  (first, last,    coefficient_count, in, out); break;
+
+		default: abort();
+	}
+}
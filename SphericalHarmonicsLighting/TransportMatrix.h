@@ -0,0 +1,39 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include "Types.h"
+
+// Single non-zero element of a TransportMatrix
+struct TransportEntry {
+	int       column; // Index of the first transfer coefficient of the hit vertex in the Scene wide coefficient array
+	glm::vec3 weight; // Combines the albedo, the cosine term, the barycentric weight of the hit vertex and the Monte Carlo normalization
+};
+
+// Sparse matrix that maps the diffuse transfer coefficients of the previous bounce onto the diffuse transfer coefficients of the next bounce.
+// Visibility and hit points do not change between bounces, so every bounce applies the same linear map.
+// Every row belongs to a vertex and contains one entry per vertex of the Scene whose light reaches it, stored in Compressed Sparse Row format.
+// The SIMD kernel used by multiply_row is selected at runtime based on SIMD::get_level()
+struct TransportMatrix {
+	int coefficient_count; // Number of transfer coefficients per vertex that are transported, the same for every row and column
+
+	int row_count;
+	int entry_count;
+
+	int            * row_offsets; // row_count + 1 offsets, the entries of row r are found in [row_offsets[r], row_offsets[r + 1])
+	TransportEntry * entries;
+
+	// Packs the rows into a single allocation. The rows are expected to be compacted using compact_row
+	void init(int coefficient_count, int row_count, const Array<TransportEntry> rows[]);
+	void free();
+
+	// Sorts the entries of a row by column and merges entries that refer to the same column
+	static void compact_row(Array<TransportEntry>& row);
+
+	// Calculates the first coefficient_count transfer coefficients of the given row, which are added to out[0..coefficient_count).
+	// Adding allows the contributions of multiple matrices to be combined into the same vertex.
+	// All kernels perform the same operations in the same order, so they produce identical results
+	void multiply_row(int row, const glm::vec3 in[], glm::vec3 out[]) const;
+
+	// Returns the number of bytes allocated by the matrix
+	size_t get_memory_usage() const;
+};
@@ -0,0 +1,357 @@
+#include "TriangleSoA.h"
+
+#include <immintrin.h>
+
+#include "SIMD.h"
+
+#include "Util.h"
+
+void TriangleSoA::init(int triangle_count, const Triangle triangles[]) {
+	count = triangle_count;
+
+	int padded_count = triangle_count + TRIANGLE_SOA_PADDING;
+
+	// The padding is zero initialized, which results in degenerate Triangles.
+	// The kernels mask out lanes past the end of a leaf anyway, so these are never reported as hits
+	data = new float[9 * padded_count]();
+
+	position0_x = data;
+	position0_y = data + 1 * padded_count;
+	position0_z = data + 2 * padded_count;
+	edge0_x     = data + 3 * padded_count;
+	edge0_y     = data + 4 * padded_count;
+	edge0_z     = data + 5 * padded_count;
+	edge1_x     = data + 6 * padded_count;
+	edge1_y     = data + 7 * padded_count;
+	edge1_z     = data + 8 * padded_count;
+
+	for (int i = 0; i < triangle_count; i++) {
+		// Edges are calculated the same way as in Ray::trace, so that all kernels produce the same results
+		glm::vec3 edge0 = triangles[i].vertices[1] - triangles[i].vertices[0];
+		glm::vec3 edge1 = triangles[i].vertices[2] - triangles[i].vertices[0];
+
+		position0_x[i] = triangles[i].vertices[0].x;
+		position0_y[i] = triangles[i].vertices[0].y;
+		position0_z[i] = triangles[i].vertices[0].z;
+
+		edge0_x[i] = edge0.x;
+		edge0_y[i] = edge0.y;
+		edge0_z[i] = edge0.z;
+
+		edge1_x[i] = edge1.x;
+		edge1_y[i] = edge1.y;
+		edge1_z[i] = edge1.z;
+	}
+}
+
+void TriangleSoA::free() {
+	delete[] data;
+}
+
+// Scalar kernel, Moller-Trumbore test of a single Triangle.
+// The SIMD kernels perform exactly the same operations in the same order, so all kernels produce identical results
+static inline bool test_scalar(const TriangleSoA& soa, const Ray& ray, int i, float& t, float& u, float& v) {
+	const glm::vec3& d = ray.direction;
+
+	float e0_x = soa.edge0_x[i], e0_y = soa.edge0_y[i], e0_z = soa.edge0_z[i];
+	float e1_x = soa.edge1_x[i], e1_y = soa.edge1_y[i], e1_z = soa.edge1_z[i];
+
+	// h = cross(direction, edge1)
+	float h_x = d.y * e1_z - e1_y * d.z;
+	float h_y = d.z * e1_x - e1_z * d.x;
+	float h_z = d.x * e1_y - e1_x * d.y;
+
+	float a = e0_x * h_x + e0_y * h_y + e0_z * h_z;
+	float f = 1.0f / a;
+
+	float s_x = ray.origin.x - soa.position0_x[i];
+	float s_y = ray.origin.y - soa.position0_y[i];
+	float s_z = ray.origin.z - soa.position0_z[i];
+
+	u = f * (s_x * h_x + s_y * h_y + s_z * h_z);
+
+	// q = cross(s, edge0)
+	float q_x = s_y * e0_z - e0_y * s_z;
+	float q_y = s_z * e0_x - e0_z * s_x;
+	float q_z = s_x * e0_y - e0_x * s_y;
+
+	v = f * (d.x * q_x + d.y * q_y + d.z * q_z);
+	t = f * (e1_x * q_x + e1_y * q_y + e1_z * q_z);
+
+	// Written as positive conditions, so that NaNs (caused by Rays parallel to the Triangle) are rejected
+	return u >= 0.0f && u <= 1.0f && v >= 0.0f && u + v <= 1.0f && t > EPSILON;
+}
+
+static bool intersects_scalar(const TriangleSoA& soa, const Ray& ray, int first, int triangle_count) {
+	float t, u, v;
+
+	for (int i = first; i < first + triangle_count; i++) {
+		if (test_scalar(soa, ray, i, t, u, v)) return true;
+	}
+
+	return false;
+}
+
+static int trace_scalar(const TriangleSoA& soa, const Ray& ray, int first, int triangle_count, float& distance, float& u, float& v) {
+	int result = INVALID;
+
+	float t, _u, _v;
+
+	for (int i = first; i < first + triangle_count; i++) {
+		if (test_scalar(soa, ray, i, t, _u, _v) && t < distance) {
+			result   = i;
+			distance = t;
+			u        = _u;
+			v        = _v;
+		}
+	}
+
+	return result;
+}
+
+// SSE kernel, performs the Moller-Trumbore test on the 4 Triangles starting at index i.
+// Returns a mask that has all bits set for the lanes that were hit
+static inline __m128 test_sse(const TriangleSoA& soa, const Ray& ray, int i, __m128& t, __m128& u, __m128& v) {
+	const __m128 d_x = _mm_set1_ps(ray.direction.x);
+	const __m128 d_y = _mm_set1_ps(ray.direction.y);
+	const __m128 d_z = _mm_set1_ps(ray.direction.z);
+
+	__m128 e0_x = _mm_loadu_ps(soa.edge0_x + i), e0_y = _mm_loadu_ps(soa.edge0_y + i), e0_z = _mm_loadu_ps(soa.edge0_z + i);
+	__m128 e1_x = _mm_loadu_ps(soa.edge1_x + i), e1_y = _mm_loadu_ps(soa.edge1_y + i), e1_z = _mm_loadu_ps(soa.edge1_z + i);
+
+	__m128 h_x = _mm_sub_ps(_mm_mul_ps(d_y, e1_z), _mm_mul_ps(e1_y, d_z));
+	__m128 h_y = _mm_sub_ps(_mm_mul_ps(d_z, e1_x), _mm_mul_ps(e1_z, d_x));
+	__m128 h_z = _mm_sub_ps(_mm_mul_ps(d_x, e1_y), _mm_mul_ps(e1_x, d_y));
+
+	__m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e0_x, h_x), _mm_mul_ps(e0_y, h_y)), _mm_mul_ps(e0_z, h_z));
+	__m128 f = _mm_div_ps(_mm_set1_ps(1.0f), a);
+
+	__m128 s_x = _mm_sub_ps(_mm_set1_ps(ray.origin.x), _mm_loadu_ps(soa.position0_x + i));
+	__m128 s_y = _mm_sub_ps(_mm_set1_ps(ray.origin.y), _mm_loadu_ps(soa.position0_y + i));
+	__m128 s_z = _mm_sub_ps(_mm_set1_ps(ray.origin.z), _mm_loadu_ps(soa.position0_z + i));
+
+	u = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(s_x, h_x), _mm_mul_ps(s_y, h_y)), _mm_mul_ps(s_z, h_z)));
+
+	__m128 q_x = _mm_sub_ps(_mm_mul_ps(s_y, e0_z), _mm_mul_ps(e0_y, s_z));
+	__m128 q_y = _mm_sub_ps(_mm_mul_ps(s_z, e0_x), _mm_mul_ps(e0_z, s_x));
+	__m128 q_z = _mm_sub_ps(_mm_mul_ps(s_x, e0_y), _mm_mul_ps(e0_x, s_y));
+
+	v = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(d_x,  q_x), _mm_mul_ps(d_y,  q_y)), _mm_mul_ps(d_z,  q_z)));
+	t = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1_x, q_x), _mm_mul_ps(e1_y, q_y)), _mm_mul_ps(e1_z, q_z)));
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one  = _mm_set1_ps(1.0f);
+
+	__m128 mask = _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one));
+	mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+	mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), one));
+	mask = _mm_and_ps(mask, _mm_cmpgt_ps(t, _mm_set1_ps(EPSILON)));
+
+	return mask;
+}
+
+// Mask with all bits set for the lanes that contain a Triangle index smaller than end
+static inline __m128 lane_mask_sse(int i, int end) {
+	__m128i index = _mm_add_epi32(_mm_set1_epi32(i), _mm_setr_epi32(0, 1, 2, 3));
+
+	return _mm_castsi128_ps(_mm_cmplt_epi32(index, _mm_set1_epi32(end)));
+}
+
+// Selects a where mask is set, b otherwise. SSE2 does not have a blend instruction
+static inline __m128 select_sse(__m128 mask, __m128 a, __m128 b) {
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static bool intersects_sse(const TriangleSoA& soa, const Ray& ray, int first, int triangle_count) {
+	int end = first + triangle_count;
+
+	for (int i = first; i < end; i += 4) {
+		__m128 t, u, v;
+		__m128 mask = _mm_and_ps(test_sse(soa, ray, i, t, u, v), lane_mask_sse(i, end));
+
+		if (_mm_movemask_ps(mask)) return true;
+	}
+
+	return false;
+}
+
+static int trace_sse(const TriangleSoA& soa, const Ray& ray, int first, int triangle_count, float& distance, float& u, float& v) {
+	int end = first + triangle_count;
+
+	__m128  best_t     = _mm_set1_ps(distance);
+	__m128  best_u     = _mm_setzero_ps();
+	__m128  best_v     = _mm_setzero_ps();
+	__m128i best_index = _mm_set1_epi32(INVALID);
+
+	for (int i = first; i < end; i += 4) {
+		__m128 t, _u, _v;
+		__m128 mask = _mm_and_ps(test_sse(soa, ray, i, t, _u, _v), lane_mask_sse(i, end));
+
+		// Every lane keeps track of its own closest hit
+		mask = _mm_and_ps(mask, _mm_cmplt_ps(t, best_t));
+
+		best_t     = select_sse(mask, t,  best_t);
+		best_u     = select_sse(mask, _u, best_u);
+		best_v     = select_sse(mask, _v, best_v);
+		best_index = _mm_castps_si128(select_sse(mask, _mm_castsi128_ps(_mm_add_epi32(_mm_set1_epi32(i), _mm_setr_epi32(0, 1, 2, 3))), _mm_castsi128_ps(best_index)));
+	}
+
+	alignas(16) float lane_t[4];
+	alignas(16) float lane_u[4];
+	alignas(16) float lane_v[4];
+	alignas(16) int   lane_index[4];
+
+	_mm_store_ps(lane_t, best_t);
+	_mm_store_ps(lane_u, best_u);
+	_mm_store_ps(lane_v, best_v);
+	_mm_store_si128(reinterpret_cast<__m128i *>(lane_index), best_index);
+
+	// Reduce the lanes, ties are resolved in favour of the lowest Triangle index
+	int result = INVALID;
+
+	for (int lane = 0; lane < 4; lane++) {
+		if (lane_index[lane] == INVALID) continue;
+
+		if (lane_t[lane] < distance || (lane_t[lane] == distance && lane_index[lane] < result)) {
+			result   = lane_index[lane];
+			distance = lane_t[lane];
+			u        = lane_u[lane];
+			v        = lane_v[lane];
+		}
+	}
+
+	return result;
+}
+
+// AVX2 kernel, performs the Moller-Trumbore test on the 8 Triangles starting at index i.
+// Returns a mask that has all bits set for the lanes that were hit
+static inline __m256 test_avx2(const TriangleSoA& soa, const Ray& ray, int i, __m256& t, __m256& u, __m256& v) {
+	const __m256 d_x = _mm256_set1_ps(ray.direction.x);
+	const __m256 d_y = _mm256_set1_ps(ray.direction.y);
+	const __m256 d_z = _mm256_set1_ps(ray.direction.z);
+
+	__m256 e0_x = _mm256_loadu_ps(soa.edge0_x + i), e0_y = _mm256_loadu_ps(soa.edge0_y + i), e0_z = _mm256_loadu_ps(soa.edge0_z + i);
+	__m256 e1_x = _mm256_loadu_ps(soa.edge1_x + i), e1_y = _mm256_loadu_ps(soa.edge1_y + i), e1_z = _mm256_loadu_ps(soa.edge1_z + i);
+
+	// NOTE: FMA is deliberately not used, so that the results match the scalar and SSE kernels exactly
+	__m256 h_x = _mm256_sub_ps(_mm256_mul_ps(d_y, e1_z), _mm256_mul_ps(e1_y, d_z));
+	__m256 h_y = _mm256_sub_ps(_mm256_mul_ps(d_z, e1_x), _mm256_mul_ps(e1_z, d_x));
+	__m256 h_z = _mm256_sub_ps(_mm256_mul_ps(d_x, e1_y), _mm256_mul_ps(e1_x, d_y));
+
+	__m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e0_x, h_x), _mm256_mul_ps(e0_y, h_y)), _mm256_mul_ps(e0_z, h_z));
+	__m256 f = _mm256_div_ps(_mm256_set1_ps(1.0f), a);
+
+	__m256 s_x = _mm256_sub_ps(_mm256_set1_ps(ray.origin.x), _mm256_loadu_ps(soa.position0_x + i));
+	__m256 s_y = _mm256_sub_ps(_mm256_set1_ps(ray.origin.y), _mm256_loadu_ps(soa.position0_y + i));
+	__m256 s_z = _mm256_sub_ps(_mm256_set1_ps(ray.origin.z), _mm256_loadu_ps(soa.position0_z + i));
+
+	u = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(s_x, h_x), _mm256_mul_ps(s_y, h_y)), _mm256_mul_ps(s_z, h_z)));
+
+	__m256 q_x = _mm256_sub_ps(_mm256_mul_ps(s_y, e0_z), _mm256_mul_ps(e0_y, s_z));
+	__m256 q_y = _mm256_sub_ps(_mm256_mul_ps(s_z, e0_x), _mm256_mul_ps(e0_z, s_x));
+	__m256 q_z = _mm256_sub_ps(_mm256_mul_ps(s_x, e0_y), _mm256_mul_ps(e0_x, s_y));
+
+	v = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(d_x,  q_x), _mm256_mul_ps(d_y,  q_y)), _mm256_mul_ps(d_z,  q_z)));
+	t = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1_x, q_x), _mm256_mul_ps(e1_y, q_y)), _mm256_mul_ps(e1_z, q_z)));
+
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one  = _mm256_set1_ps(1.0f);
+
+	__m256 mask = _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+	mask = _mm256_and_ps(mask, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+	mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+	mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, _mm256_set1_ps(EPSILON), _CMP_GT_OQ));
+
+	return mask;
+}
+
+static inline __m256i lane_indices_avx2(int i) {
+	return _mm256_add_epi32(_mm256_set1_epi32(i), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+// Mask with all bits set for the lanes that contain a Triangle index smaller than end
+static inline __m256 lane_mask_avx2(int i, int end) {
+	return _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(end), lane_indices_avx2(i)));
+}
+
+static bool intersects_avx2(const TriangleSoA& soa, const Ray& ray, int first, int triangle_count) {
+	int end = first + triangle_count;
+
+	for (int i = first; i < end; i += 8) {
+		__m256 t, u, v;
+		__m256 mask = _mm256_and_ps(test_avx2(soa, ray, i, t, u, v), lane_mask_avx2(i, end));
+
+		if (_mm256_movemask_ps(mask)) return true;
+	}
+
+	return false;
+}
+
+static int trace_avx2(const TriangleSoA& soa, const Ray& ray, int first, int triangle_count, float& distance, float& u, float& v) {
+	int end = first + triangle_count;
+
+	__m256  best_t     = _mm256_set1_ps(distance);
+	__m256  best_u     = _mm256_setzero_ps();
+	__m256  best_v     = _mm256_setzero_ps();
+	__m256i best_index = _mm256_set1_epi32(INVALID);
+
+	for (int i = first; i < end; i += 8) {
+		__m256 t, _u, _v;
+		__m256 mask = _mm256_and_ps(test_avx2(soa, ray, i, t, _u, _v), lane_mask_avx2(i, end));
+
+		// Every lane keeps track of its own closest hit
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, best_t, _CMP_LT_OQ));
+
+		best_t     = _mm256_blendv_ps(best_t, t,  mask);
+		best_u     = _mm256_blendv_ps(best_u, _u, mask);
+		best_v     = _mm256_blendv_ps(best_v, _v, mask);
+		best_index = _mm256_blendv_epi8(best_index, lane_indices_avx2(i), _mm256_castps_si256(mask));
+	}
+
+	alignas(32) float lane_t[8];
+	alignas(32) float lane_u[8];
+	alignas(32) float lane_v[8];
+	alignas(32) int   lane_index[8];
+
+	_mm256_store_ps(lane_t, best_t);
+	_mm256_store_ps(lane_u, best_u);
+	_mm256_store_ps(lane_v, best_v);
+	_mm256_store_si256(reinterpret_cast<__m256i *>(lane_index), best_index);
+
+	// Reduce the lanes, ties are resolved in favour of the lowest Triangle index
+	int result = INVALID;
+
+	for (int lane = 0; lane < 8; lane++) {
+		if (lane_index[lane] == INVALID) continue;
+
+		if (lane_t[lane] < distance || (lane_t[lane] == distance && lane_index[lane] < result)) {
+			result   = lane_index[lane];
+			distance = lane_t[lane];
+			u        = lane_u[lane];
+			v        = lane_v[lane];
+		}
+	}
+
+	return result;
+}
+
+// Both queries use the kernels of the current SIMD level
+bool TriangleSoA::intersects(const Ray& ray, int first, int triangle_count) const {
+	switch (SIMD::get_level()) {
+		case SIMD::Level::SCALAR: return intersects_scalar(*this, ray, first, triangle_count);
+		case SIMD::Level::SSE:    return intersects_sse   (*this, ray, first, triangle_count);
+		case SIMD::Level::AVX2:   return intersects_avx2  (*this, ray, first, triangle_count);
+
+		default: abort();
+	}
+}
+
+int TriangleSoA::trace(const Ray& ray, int first, int triangle_count, float& distance, float& u, float& v) const {
+	switch (SIMD::get_level()) {
+		case SIMD::Level::SCALAR: return trace_scalar(*this, ray, first, triangle_count, distance, u, v);
+		case SIMD::Level::SSE:    return trace_sse   (*this, ray, first, triangle_count, distance, u, v);
+		case SIMD::Level::AVX2:   return trace_avx2  (*this, ray, first, triangle_count, distance, u, v);
+
+		default: abort();
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "Ray.h"
+
+// Number of floats that every array of a TriangleSoA is padded with, which is the width of the widest SIMD kernel.
+// This allows the kernels to always load full SIMD registers, even past the end of the last leaf
+#define TRIANGLE_SOA_PADDING 8
+
+// Stores Triangles in Structure of Arrays layout, every Triangle is represented by its first vertex and two edges.
+// This allows the Moller-Trumbore intersection test to be performed on 4 (SSE) or 8 (AVX2) Triangles at once.
+// The SIMD kernel is selected at runtime based on SIMD::get_level()
+struct TriangleSoA {
+private:
+	float * data; // Single allocation that contains all arrays below
+
+public:
+	int count;
+
+	float * position0_x;
+	float * position0_y;
+	float * position0_z;
+
+	float * edge0_x;
+	float * edge0_y;
+	float * edge0_z;
+
+	float * edge1_x;
+	float * edge1_y;
+	float * edge1_z;
+
+	void init(int triangle_count, const Triangle triangles[]);
+	void free();
+
+	// Returns true if the Ray hits any of the Triangles in the range [first, first + triangle_count)
+	bool intersects(const Ray& ray, int first, int triangle_count) const;
+
+	// Finds the closest Triangle in the range [first, first + triangle_count) that is hit closer than the given distance.
+	// If such a Triangle exists, its index is returned and distance, u and v are updated with the hit distance and barycentric coordinates.
+	// If multiple Triangles are hit at the same distance the one with the lowest index is returned, just like a sequential search would.
+	// Returns INVALID if there is no such Triangle
+	int trace(const Ray& ray, int first, int triangle_count, float& distance, float& u, float& v) const;
+};
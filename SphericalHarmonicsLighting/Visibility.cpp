@@ -0,0 +1,79 @@
+#include "Visibility.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include "Util.h"
+
+void VisibilityStore::init(int vertex_count, int sample_count, bool store_records) {
+	assert(sample_count <= VISIBILITY_MAX_SAMPLE_COUNT);
+
+	this->vertex_count     = vertex_count;
+	this->words_per_vertex = (sample_count + 31) / 32;
+	this->store_records    = store_records;
+
+	// The number of words does not fit in an int for large Meshes
+	assert(size_t(vertex_count) <= SIZE_MAX / sizeof(u32) / size_t(words_per_vertex));
+
+	size_t word_count = size_t(vertex_count) * size_t(words_per_vertex);
+
+	occluded_bits = new u32[word_count];
+	memset(occluded_bits, 0, word_count * sizeof(u32));
+
+	if (store_records) {
+		records       = new OccluderRecord * [vertex_count];
+		record_counts = new int              [vertex_count];
+
+		for (int i = 0; i < vertex_count; i++) {
+			records      [i] = NULL;
+			record_counts[i] = 0;
+		}
+	} else {
+		records       = NULL;
+		record_counts = NULL;
+	}
+}
+
+void VisibilityStore::free() {
+	delete[] occluded_bits;
+
+	if (store_records) {
+		for (int i = 0; i < vertex_count; i++) {
+			delete[] records[i];
+		}
+
+		delete[] records;
+		delete[] record_counts;
+	}
+}
+
+void VisibilityStore::set_records(int vertex, const OccluderRecord vertex_records[], int record_count) {
+	assert(store_records);
+
+	delete[] records[vertex];
+
+	if (record_count > 0) {
+		records[vertex] = new OccluderRecord[record_count];
+		memcpy(records[vertex], vertex_records, record_count * sizeof(OccluderRecord));
+	} else {
+		records[vertex] = NULL;
+	}
+
+	record_counts[vertex] = record_count;
+}
+
+size_t VisibilityStore::get_memory_usage() const {
+	return size_t(vertex_count) * size_t(words_per_vertex) * sizeof(u32);
+}
+
+size_t VisibilityStore::get_record_memory_usage() const {
+	if (!store_records) return 0;
+
+	size_t memory_usage = size_t(vertex_count) * (sizeof(OccluderRecord *) + sizeof(int));
+
+	for (int i = 0; i < vertex_count; i++) {
+		memory_usage += record_counts[i] * sizeof(OccluderRecord);
+	}
+
+	return memory_usage;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include "SphericalHarmonics.h"
+
+#include "Types.h"
+
+// Maximum number of samples per vertex, OccluderRecord stores the sample index in 16 bits
+#define VISIBILITY_MAX_SAMPLE_COUNT 65536
+
+// Describes where the Ray of an occluded sample hit the Scene.
+// Geometry and sample directions do not change between bounces, so the bounce passes can use this instead of tracing the Ray again.
+// Every occluded sample gets a record, so they are kept small: the vertex indices are looked up in the hit Mesh,
+// and the barycentric coordinates are quantized to 16 bits, which gives a precision of about 1.5e-5
+struct OccluderRecord {
+	u16 sample_index;
+	u16 mesh_index;     // Index of the Mesh that was hit in the Scene
+	u32 triangle_index; // Index of the Triangle that was hit, see Mesh::get_bvh_triangle
+	u16 u, v;           // Quantized barycentric coordinates of the hit point
+
+	inline void init(int sample_index, int mesh_index, int triangle_index, float u, float v) {
+		this->sample_index   = u16(sample_index);
+		this->mesh_index     = u16(mesh_index);
+		this->triangle_index = u32(triangle_index);
+		this->u = u16(glm::clamp(u, 0.0f, 1.0f) * 65535.0f + 0.5f);
+		this->v = u16(glm::clamp(v, 0.0f, 1.0f) * 65535.0f + 0.5f);
+	}
+
+	inline float get_u() const { return float(u) * (1.0f / 65535.0f); }
+	inline float get_v() const { return float(v) * (1.0f / 65535.0f); }
+};
+
+static_assert(sizeof(OccluderRecord) == 12, "OccluderRecord should be 12 bytes");
+
+// Stores which samples of every vertex were occluded during the direct lighting pass, using a single bit per sample.
+// Optionally a sparse list of OccluderRecords is stored for every vertex as well.
+// Different vertices can be written by different threads at the same time, since the bits of every vertex start at a new word
+struct VisibilityStore {
+	int vertex_count;
+	int words_per_vertex; // Number of 32 bit words needed to store one bit per sample for a single vertex
+
+	u32 * occluded_bits; // words_per_vertex words per vertex
+
+	// Only used if records are stored, in which case every vertex has its own array sorted by sample index
+	bool              store_records;
+	OccluderRecord ** records;
+	int             * record_counts;
+
+	void init(int vertex_count, int sample_count, bool store_records);
+	void free();
+
+	// The index is calculated in 64 bits, with VISIBILITY_MAX_SAMPLE_COUNT samples an int would overflow at about a million vertices
+	inline size_t get_word_index(int vertex, int sample) const {
+		return size_t(vertex) * size_t(words_per_vertex) + size_t(sample >> 5);
+	}
+
+	inline bool is_occluded(int vertex, int sample) const {
+		return (occluded_bits[get_word_index(vertex, sample)] >> (sample & 31)) & 1;
+	}
+
+	inline void set_occluded(int vertex, int sample, bool occluded) {
+		u32& word = occluded_bits[get_word_index(vertex, sample)];
+		u32  bit  = 1u << (sample & 31);
+
+		word = occluded ? (word | bit) : (word & ~bit);
+	}
+
+	// Copies the records of the vertex, they should be sorted by sample index
+	void set_records(int vertex, const OccluderRecord vertex_records[], int record_count);
+
+	// Returns the number of bytes allocated for the occluded bits and for the OccluderRecords respectively
+	size_t get_memory_usage() const;
+	size_t get_record_memory_usage() const;
+};
@@ -0,0 +1,354 @@
+#include "WideBVH.h"
+
+#include <immintrin.h>
+
+#include "SIMD.h"
+
+#include "Util.h"
+
+// Recursively collapses the subtree of the interior FlatBVHNode at flat_index into WideBVHNodes, returns the index of the created node
+template<int Width>
+static int collapse_node(const FlatBVH& bvh, int flat_index, Array<WideBVHNode<Width>>& wide_nodes) {
+	int children[Width];
+	int child_count = 0;
+
+	const FlatBVHNode& flat_node = bvh.nodes[flat_index];
+
+	if (flat_node.is_leaf()) {
+		// Only happens if the root is a leaf, in which case the root gets a single leaf child
+		children[child_count++] = flat_index;
+	} else {
+		children[child_count++] = flat_index + 1;
+		children[child_count++] = flat_node.right_or_first;
+
+		// Pull up grandchildren until the node is full, always opening the interior child with the largest surface area.
+		// Large nodes are the most likely to be hit, so removing them from the tree saves the most AABB tests
+		while (child_count < Width) {
+			int   largest_child = INVALID;
+			float largest_area  = -INFINITY;
+
+			for (int i = 0; i < child_count; i++) {
+				const FlatBVHNode& child = bvh.nodes[children[i]];
+
+				if (!child.is_leaf() && child.aabb.surface_area() > largest_area) {
+					largest_child = i;
+					largest_area  = child.aabb.surface_area();
+				}
+			}
+
+			// All children are leaves
+			if (largest_child == INVALID) break;
+
+			int opened = children[largest_child];
+
+			children[largest_child]  = opened + 1;
+			children[child_count++] = bvh.nodes[opened].right_or_first;
+		}
+	}
+
+	int wide_index = int(wide_nodes.size());
+	wide_nodes.emplace_back();
+
+	// NOTE: the recursive calls below can reallocate wide_nodes, so the new node is only accessed through its index
+	for (int i = 0; i < Width; i++) {
+		// Unused slots get an empty AABB, they are excluded from traversal using child_count anyway
+		const AABB empty = { glm::vec3(+INFINITY), glm::vec3(-INFINITY) };
+		const AABB& aabb = i < child_count ? bvh.nodes[children[i]].aabb : empty;
+
+		for (int axis = 0; axis < 3; axis++) {
+			wide_nodes[wide_index].bounds[    axis][i] = aabb.min[axis];
+			wide_nodes[wide_index].bounds[3 + axis][i] = aabb.max[axis];
+		}
+
+		wide_nodes[wide_index].child_index   [i] = INVALID;
+		wide_nodes[wide_index].triangle_count[i] = 0;
+	}
+
+	wide_nodes[wide_index].child_count = child_count;
+
+	for (int i = 0; i < child_count; i++) {
+		const FlatBVHNode& child = bvh.nodes[children[i]];
+
+		if (child.is_leaf()) {
+			wide_nodes[wide_index].child_index   [i] = child.right_or_first;
+			wide_nodes[wide_index].triangle_count[i] = child.triangle_count;
+		} else {
+			int child_index = collapse_node(bvh, children[i], wide_nodes);
+
+			wide_nodes[wide_index].child_index[i] = child_index;
+		}
+	}
+
+	return wide_index;
+}
+
+template<int Width>
+WideBVH<Width> WideBVH<Width>::collapse(const FlatBVH& flat_bvh) {
+	WideBVH bvh;
+	bvh.triangle_count = flat_bvh.triangle_count;
+	bvh.triangles      = new Triangle[bvh.triangle_count];
+
+	// The leaves refer to the same Triangle ranges as the leaves of the binary tree, so the order of the Triangles is kept
+	memcpy(bvh.triangles, flat_bvh.triangles, bvh.triangle_count * sizeof(Triangle));
+
+	Array<WideBVHNode<Width>> wide_nodes;
+	wide_nodes.reserve(flat_bvh.node_count / (Width - 1) + 1);
+
+	collapse_node(flat_bvh, 0, wide_nodes);
+
+	bvh.node_count = int(wide_nodes.size());
+	bvh.nodes      = new WideBVHNode<Width>[bvh.node_count];
+	memcpy(bvh.nodes, wide_nodes.data(), bvh.node_count * sizeof(WideBVHNode<Width>));
+
+	bvh.triangles_soa.init(bvh.triangle_count, bvh.triangles);
+
+	return bvh;
+}
+
+template<int Width>
+void WideBVH<Width>::free() {
+	delete[] nodes;
+	delete[] triangles;
+
+	triangles_soa.free();
+}
+
+// The kernels below perform exactly the same operations as TraversalRay::trace(const AABB&, float), for multiple children at once.
+// The near and far side of every slab are selected once per node by picking either the minima or the maxima based on the sign of the direction.
+// std::max(a, b) is defined as (a < b) ? b : a, which is equivalent to _mm_max_ps(b, a) including for NaNs and signed zeroes.
+// Likewise std::min(a, b) is equivalent to _mm_min_ps(b, a)
+struct ChildSlabs {
+	const float * near_x;
+	const float * near_y;
+	const float * near_z;
+	const float * far_x;
+	const float * far_y;
+	const float * far_z;
+};
+
+static inline void child_distances_scalar(const ChildSlabs& slabs, const TraversalRay& ray, float max_distance, int first, int count, float distances[]) {
+	for (int i = first; i < first + count; i++) {
+		float tmin_x = (slabs.near_x[i] - ray.origin.x) * ray.inv_direction.x;
+		float tmax_x = (slabs.far_x [i] - ray.origin.x) * ray.inv_direction.x;
+		float tmin_y = (slabs.near_y[i] - ray.origin.y) * ray.inv_direction.y;
+		float tmax_y = (slabs.far_y [i] - ray.origin.y) * ray.inv_direction.y;
+		float tmin_z = (slabs.near_z[i] - ray.origin.z) * ray.inv_direction.z;
+		float tmax_z = (slabs.far_z [i] - ray.origin.z) * ray.inv_direction.z;
+
+		float tmin = std::max(std::max(tmin_x, tmin_y), std::max(tmin_z, 0.0f));
+		float tmax = std::min(std::min(tmax_x, tmax_y), std::min(tmax_z, max_distance));
+
+		distances[i] = tmin <= tmax ? tmin : INFINITY;
+	}
+}
+
+static inline void child_distances_sse(const ChildSlabs& slabs, const TraversalRay& ray, float max_distance, int first, float distances[]) {
+	const __m128 origin_x = _mm_set1_ps(ray.origin.x);
+	const __m128 origin_y = _mm_set1_ps(ray.origin.y);
+	const __m128 origin_z = _mm_set1_ps(ray.origin.z);
+
+	const __m128 inv_direction_x = _mm_set1_ps(ray.inv_direction.x);
+	const __m128 inv_direction_y = _mm_set1_ps(ray.inv_direction.y);
+	const __m128 inv_direction_z = _mm_set1_ps(ray.inv_direction.z);
+
+	__m128 tmin_x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(slabs.near_x + first), origin_x), inv_direction_x);
+	__m128 tmax_x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(slabs.far_x  + first), origin_x), inv_direction_x);
+	__m128 tmin_y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(slabs.near_y + first), origin_y), inv_direction_y);
+	__m128 tmax_y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(slabs.far_y  + first), origin_y), inv_direction_y);
+	__m128 tmin_z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(slabs.near_z + first), origin_z), inv_direction_z);
+	__m128 tmax_z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(slabs.far_z  + first), origin_z), inv_direction_z);
+
+	__m128 tmin = _mm_max_ps(_mm_max_ps(_mm_setzero_ps(),           tmin_z), _mm_max_ps(tmin_y, tmin_x));
+	__m128 tmax = _mm_min_ps(_mm_min_ps(_mm_set1_ps(max_distance), tmax_z), _mm_min_ps(tmax_y, tmax_x));
+
+	__m128 mask = _mm_cmple_ps(tmin, tmax);
+
+	// SSE2 does not have a blend instruction
+	_mm_storeu_ps(distances + first, _mm_or_ps(_mm_and_ps(mask, tmin), _mm_andnot_ps(mask, _mm_set1_ps(INFINITY))));
+}
+
+static inline void child_distances_avx2(const ChildSlabs& slabs, const TraversalRay& ray, float max_distance, float distances[]) {
+	const __m256 origin_x = _mm256_set1_ps(ray.origin.x);
+	const __m256 origin_y = _mm256_set1_ps(ray.origin.y);
+	const __m256 origin_z = _mm256_set1_ps(ray.origin.z);
+
+	const __m256 inv_direction_x = _mm256_set1_ps(ray.inv_direction.x);
+	const __m256 inv_direction_y = _mm256_set1_ps(ray.inv_direction.y);
+	const __m256 inv_direction_z = _mm256_set1_ps(ray.inv_direction.z);
+
+	// NOTE: FMA is deliberately not used, so that the results match TraversalRay::trace exactly
+	__m256 tmin_x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(slabs.near_x), origin_x), inv_direction_x);
+	__m256 tmax_x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(slabs.far_x),  origin_x), inv_direction_x);
+	__m256 tmin_y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(slabs.near_y), origin_y), inv_direction_y);
+	__m256 tmax_y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(slabs.far_y),  origin_y), inv_direction_y);
+	__m256 tmin_z = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(slabs.near_z), origin_z), inv_direction_z);
+	__m256 tmax_z = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(slabs.far_z),  origin_z), inv_direction_z);
+
+	__m256 tmin = _mm256_max_ps(_mm256_max_ps(_mm256_setzero_ps(),           tmin_z), _mm256_max_ps(tmin_y, tmin_x));
+	__m256 tmax = _mm256_min_ps(_mm256_min_ps(_mm256_set1_ps(max_distance), tmax_z), _mm256_min_ps(tmax_y, tmax_x));
+
+	_mm256_storeu_ps(distances, _mm256_blendv_ps(_mm256_set1_ps(INFINITY), tmin, _mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ)));
+}
+
+// Calculates the distance at which the Ray enters every child of the node, or INFINITY if the child is missed
+template<int Width>
+static inline void child_distances(const WideBVHNode<Width>& node, const TraversalRay& ray, float max_distance, float distances[Width]) {
+	ChildSlabs slabs;
+	slabs.near_x = node.bounds[    3 * ray.direction_sign[0]];
+	slabs.near_y = node.bounds[1 + 3 * ray.direction_sign[1]];
+	slabs.near_z = node.bounds[2 + 3 * ray.direction_sign[2]];
+	slabs.far_x  = node.bounds[3 - 3 * ray.direction_sign[0]];
+	slabs.far_y  = node.bounds[4 - 3 * ray.direction_sign[1]];
+	slabs.far_z  = node.bounds[5 - 3 * ray.direction_sign[2]];
+
+	switch (SIMD::get_level()) {
+		case SIMD::Level::SCALAR: {
+			child_distances_scalar(slabs, ray, max_distance, 0, node.child_count, distances);
+		} break;
+
+		case SIMD::Level::SSE: {
+			for (int i = 0; i < Width; i += 4) {
+				child_distances_sse(slabs, ray, max_distance, i, distances);
+			}
+		} break;
+
+		case SIMD::Level::AVX2: {
+			if (Width == 8) {
+				child_distances_avx2(slabs, ray, max_distance, distances);
+			} else {
+				child_distances_sse(slabs, ray, max_distance, 0, distances);
+			}
+		} break;
+
+		default: abort();
+	}
+}
+
+// Entry of the traversal stack, this can either be a node or a leaf
+struct WideStackEntry {
+	int   index;          // Node index, or index of the first Triangle for leaves
+	int   triangle_count; // 0 for nodes
+	float distance;       // Distance at which the Ray enters the AABB
+};
+
+// Pushes all children of the node that are hit onto the stack, sorted so that the closest child is popped first
+template<int Width>
+static inline void push_children(const WideBVHNode<Width>& node, const float distances[Width], WideStackEntry stack[], int& stack_size) {
+	assert(stack_size + Width <= WIDE_BVH_STACK_SIZE);
+
+	int first = stack_size;
+
+	for (int i = 0; i < node.child_count; i++) {
+		if (distances[i] == INFINITY) continue;
+
+		// Insertion sort on decreasing distance
+		int j = stack_size++;
+		while (j > first && stack[j - 1].distance < distances[i]) {
+			stack[j] = stack[j - 1];
+			j--;
+		}
+
+		stack[j].index          = node.child_index[i];
+		stack[j].triangle_count = node.triangle_count[i];
+		stack[j].distance       = distances[i];
+	}
+}
+
+template<int Width>
+bool WideBVH<Width>::intersects(const Ray& _ray) const {
+	if (triangle_count == 0) return false;
+
+	const TraversalRay ray(_ray);
+
+	WideStackEntry stack[WIDE_BVH_STACK_SIZE];
+	int stack_size = 1;
+
+	// The bounds of the root are not stored, so it is always visited
+	stack[0].index          = 0;
+	stack[0].triangle_count = 0;
+	stack[0].distance       = 0.0f;
+
+	float distances[Width];
+
+	while (stack_size > 0) {
+		WideStackEntry entry = stack[--stack_size];
+
+		if (entry.triangle_count > 0) {
+			if (triangles_soa.intersects(ray, entry.index, entry.triangle_count)) {
+				return true;
+			}
+		} else {
+			const WideBVHNode<Width>& node = nodes[entry.index];
+
+			child_distances(node, ray, INFINITY, distances);
+			push_children(node, distances, stack, stack_size);
+		}
+	}
+
+	return false;
+}
+
+template<int Width>
+float WideBVH<Width>::trace(const Ray& _ray, int& triangle_index, float& u, float& v, float max_distance) const {
+	if (triangle_count == 0) return INFINITY;
+
+	const TraversalRay ray(_ray);
+
+	float min_distance = max_distance;
+	bool  hit          = false;
+
+	WideStackEntry stack[WIDE_BVH_STACK_SIZE];
+	int stack_size = 1;
+
+	stack[0].index          = 0;
+	stack[0].triangle_count = 0;
+	stack[0].distance       = 0.0f;
+
+	float distances[Width];
+
+	while (stack_size > 0) {
+		WideStackEntry entry = stack[--stack_size];
+
+		// Skip entries that start beyond the closest hit found after they were pushed
+		if (entry.distance > min_distance) continue;
+
+		if (entry.triangle_count > 0) {
+			int leaf_triangle_index = triangles_soa.trace(ray, entry.index, entry.triangle_count, min_distance, u, v);
+			if (leaf_triangle_index != INVALID) {
+				hit = true;
+
+				triangle_index = leaf_triangle_index;
+			}
+		} else {
+			const WideBVHNode<Width>& node = nodes[entry.index];
+
+			// Children that start beyond the closest hit found so far are culled
+			child_distances(node, ray, min_distance, distances);
+			push_children(node, distances, stack, stack_size);
+		}
+	}
+
+	return hit ? min_distance : INFINITY;
+}
+
+template<int Width>
+void WideBVH<Width>::report(const char * name) const {
+	if (triangle_count == 0) return;
+
+	int child_count_sum = 0;
+	int leaf_count      = 0;
+
+	for (int i = 0; i < node_count; i++) {
+		child_count_sum += nodes[i].child_count;
+
+		for (int j = 0; j < nodes[i].child_count; j++) {
+			if (nodes[i].triangle_count[j] > 0) leaf_count++;
+		}
+	}
+
+	printf("BVH%i %s: %i nodes, %i leaves, average of %.2f children per node\n", Width, name, node_count, leaf_count, float(child_count_sum) / float(node_count));
+}
+
+// Explicit instantiation of the supported widths
+template struct WideBVH<4>;
+template struct WideBVH<8>;
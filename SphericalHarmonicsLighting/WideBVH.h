@@ -0,0 +1,56 @@
+#pragma once
+#include "BVH.h"
+
+// Size of the explicit stack used during traversal of a WideBVH.
+// A WideBVH is at most as deep as the FlatBVH it was collapsed from, and every level leaves at most Width - 1 siblings on the stack.
+// With a width of 8 and a depth of BVH_MAX_DEPTH this needs 7 entries per level plus the children of the deepest node
+#define WIDE_BVH_STACK_SIZE (7 * BVH_MAX_DEPTH + 8)
+
+// Node of a WideBVH with up to Width children.
+// The bounds of all children are stored in SoA layout, so that they can be tested against a Ray using a single SIMD instruction per slab
+template<int Width>
+struct WideBVHNode {
+	// bounds[axis][i] contains the minimum and bounds[3 + axis][i] the maximum of child i along the axis
+	float bounds[6][Width];
+
+	// For interior children this is the index of the child node, for leaf children the index of its first Triangle
+	int child_index   [Width];
+	int triangle_count[Width]; // 0 for interior children
+
+	int child_count;
+};
+
+// BVH with a branching factor of 4 or 8, obtained by collapsing a binary FlatBVH.
+// Every node is repeatedly expanded by replacing its interior child with the largest surface area by the children of that child,
+// until the node has Width children. This results in a tree that is roughly a factor log2(Width) less deep than the binary tree
+template<int Width>
+struct WideBVH {
+	static_assert(Width == 4 || Width == 8, "WideBVH only supports widths of 4 and 8");
+
+	int                  node_count;
+	WideBVHNode<Width> * nodes;
+
+	int        triangle_count;
+	Triangle * triangles;
+
+	TriangleSoA triangles_soa;
+
+	// Returns true if the Ray hits any Triangle, the traversal stops as soon as the first hit is found
+	bool intersects(const Ray& ray) const;
+
+	// Returns the distance to the closest Triangle hit by the Ray, or INFINITY if no Triangle closer than max_distance is hit.
+	// The distance is the same as FlatBVH::trace, if multiple Triangles are hit at exactly that distance another one may be reported
+	// triangle_index is set to the index of the hit Triangle in the triangles array
+	float trace(const Ray& ray, int& triangle_index, float& u, float& v, float max_distance = INFINITY) const;
+
+	// The Triangles are copied, so the FlatBVH can be freed afterwards
+	static WideBVH collapse(const FlatBVH& bvh);
+
+	void free();
+
+	// Prints the number of nodes and how well they are filled
+	void report(const char * name) const;
+};
+
+typedef WideBVH<4> BVH4;
+typedef WideBVH<8> BVH8;